@@ -16,6 +16,7 @@ export class MarketData {
     public onSubscribe: (data: any) => void = () => {};
     public onUnsubscribe: (data: any) => void = () => {};
     public onMarketData: (data: Message.MarketData) => void = () => {};
+    public onRestored: (data: any) => void = () => {};
 
     private ws: ws.WebSocket | undefined;
     private tradingDay: string | undefined;
@@ -164,6 +165,12 @@ export class MarketData {
                     this.onMarketData(d);
                 }
                 break;
+            case Message.MDMsgCode.RESTORED:
+                if (data.info && data.info.trading_day) {
+                    this.tradingDay = data.info.trading_day;
+                }
+                this.onRestored(data);
+                break;
             default:
                 this.onError("Unknown message: " + JSON.stringify(data));
                 return;
@@ -11,7 +11,8 @@ export enum MDMsgCode {
     TRADING_DAY = 7,
     SUBSCRIBE = 8,
     UNSUBSCRIBE = 9,
-    MARKET_DATA = 10
+    MARKET_DATA = 10,
+    RESTORED = 11
 }
 
 export const MDMsgInfo: Record<MDMsgCode, string> = {
@@ -25,7 +26,8 @@ export const MDMsgInfo: Record<MDMsgCode, string> = {
     [MDMsgCode.TRADING_DAY]: "Trading Day",
     [MDMsgCode.SUBSCRIBE]: "Subscribe",
     [MDMsgCode.UNSUBSCRIBE]: "Unsubscribe",
-    [MDMsgCode.MARKET_DATA]: "Market Data"
+    [MDMsgCode.MARKET_DATA]: "Market Data",
+    [MDMsgCode.RESTORED]: "Session Restored"
 }
 
 export enum TradeMsgCode {
@@ -50,7 +52,20 @@ export enum TradeMsgCode {
     ORDER_DELETE_ERROR,
     ORDER_DELETE_RETURN_ERROR,
     ORDER_DELETED,
-    QUERY_INSTRUMENT
+    QUERY_INSTRUMENT,
+    QUERY_POSITION,
+    POSITION_UPDATE,
+    POSITION_DRIFT,
+    QUERY_STATS,
+    RISK_LIMITS,
+    LOCAL_ORDERS,
+    ATTACHED,
+    CANCEL_ALL,
+    RESTORED,
+    CONDITIONAL_ORDER,
+    CONDITIONAL_ORDERS,
+    ALGO_ORDER,
+    ALGO_ORDERS
 }
 
 export const TradeMsgInfo: Record<TradeMsgCode, string> = {
@@ -75,7 +90,20 @@ export const TradeMsgInfo: Record<TradeMsgCode, string> = {
     [TradeMsgCode.ORDER_DELETE_ERROR]: "Failed to delete order",
     [TradeMsgCode.ORDER_DELETE_RETURN_ERROR]: "Delete order returned error",
     [TradeMsgCode.ORDER_DELETED]: "Order Deleted",
-    [TradeMsgCode.QUERY_INSTRUMENT]: "Query Instrument"
+    [TradeMsgCode.QUERY_INSTRUMENT]: "Query Instrument",
+    [TradeMsgCode.QUERY_POSITION]: "Query Position",
+    [TradeMsgCode.POSITION_UPDATE]: "Position Update",
+    [TradeMsgCode.POSITION_DRIFT]: "Position Drift",
+    [TradeMsgCode.QUERY_STATS]: "Query Scheduler Statistics",
+    [TradeMsgCode.RISK_LIMITS]: "Risk Limits",
+    [TradeMsgCode.LOCAL_ORDERS]: "Local Orders",
+    [TradeMsgCode.ATTACHED]: "Attached to Session",
+    [TradeMsgCode.CANCEL_ALL]: "Mass Cancel Acknowledgement",
+    [TradeMsgCode.RESTORED]: "Session Restored",
+    [TradeMsgCode.CONDITIONAL_ORDER]: "Conditional Order",
+    [TradeMsgCode.CONDITIONAL_ORDERS]: "Conditional Orders",
+    [TradeMsgCode.ALGO_ORDER]: "Parent Order",
+    [TradeMsgCode.ALGO_ORDERS]: "Parent Orders"
 }
 
 export interface MarketData {
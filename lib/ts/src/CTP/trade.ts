@@ -28,6 +28,19 @@ export class Trade {
     public onOrderDeleteReturnError: (data: Message.OrderDeleteReturnError) => void = () => {};
     public onOrderDeleteError: (data: Message.OrderDeleteError) => void = () => {};
     public onOrderDeleted: (data: Message.OrderDeleted) => void = () => {};
+    public onQueryPosition: (data: any) => void = () => {};
+    public onPositionUpdate: (data: any) => void = () => {};
+    public onPositionDrift: (data: any) => void = () => {};
+    public onQueryStats: (data: any) => void = () => {};
+    public onRiskLimits: (data: any) => void = () => {};
+    public onLocalOrders: (data: any) => void = () => {};
+    public onAttached: (data: any) => void = () => {};
+    public onCancelAll: (data: any) => void = () => {};
+    public onRestored: (data: any) => void = () => {};
+    public onConditionalOrder: (data: any) => void = () => {};
+    public onConditionalOrders: (data: any) => void = () => {};
+    public onAlgoOrder: (data: any) => void = () => {};
+    public onAlgoOrders: (data: any) => void = () => {};
     private brokerID: string;
     private investorID: string;
     private ws: ws.WebSocket | undefined;
@@ -159,25 +172,33 @@ export class Trade {
         offset: number,
         volume: number,
         priceType: number,
-        timeCondition: number
+        timeCondition: number,
+        tag?: string
     ) {
         if (!this.ws) {
             this.onError("WebCTP.Trade.insertOrder(): WebSocket is not connected");
             return;
         }
+        const data: any = {
+            instrument: instrument,
+            exchange: exchange,
+            price: price,
+            direction: direction,
+            offset: offset,
+            volume: volume,
+            price_type: priceType,
+            time_condition: timeCondition
+        };
+        // An empty ref lets the server allocate one.
+        if (ref !== "") {
+            data.ref = ref;
+        }
+        if (tag !== undefined) {
+            data.tag = tag;
+        }
         this.ws.send(JSON.stringify({
             op: "insert_order",
-            data: {
-                instrument: instrument,
-                exchange: exchange,
-                ref: ref,
-                price: price,
-                direction: direction,
-                offset: offset,
-                volume: volume,
-                price_type: priceType,
-                time_condition: timeCondition
-            }
+            data: data
         }));
     }
 
@@ -185,7 +206,8 @@ export class Trade {
         orderSysID?: string,
         exchangeID?: string,
         from?: string,
-        to?: string
+        to?: string,
+        aggregate?: boolean
     }) {
         if (!this.ws) {
             this.onError("WebCTP.Trade.queryOrder(): WebSocket is not connected");
@@ -205,6 +227,9 @@ export class Trade {
             if (options.to !== undefined) {
                 data.to = options.to;
             }
+            if (options.aggregate !== undefined) {
+                data.aggregate = options.aggregate;
+            }
         }
         this.ws.send(JSON.stringify({
             op: "query_order",
@@ -252,6 +277,317 @@ export class Trade {
         }));
     }
 
+    public queryPosition(instrument?: string, refresh?: boolean) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.queryPosition(): WebSocket is not connected");
+            return;
+        }
+        const data: any = {};
+        if (instrument !== undefined) {
+            data.instrument = instrument;
+        }
+        if (refresh !== undefined) {
+            data.refresh = refresh;
+        }
+        this.ws.send(JSON.stringify({
+            op: "query_position",
+            data: data
+        }));
+    }
+
+    public subscribePosition(enable: boolean = true) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.subscribePosition(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "subscribe_position",
+            data: {
+                enable: enable
+            }
+        }));
+    }
+
+    public queryStats() {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.queryStats(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "query_stats",
+            data: {}
+        }));
+    }
+
+    public setAggregate(enable: boolean, chunkSize?: number) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.setAggregate(): WebSocket is not connected");
+            return;
+        }
+        const data: any = {
+            aggregate: enable
+        };
+        if (chunkSize !== undefined) {
+            data.chunk_size = chunkSize;
+        }
+        this.ws.send(JSON.stringify({
+            op: "set",
+            data: data
+        }));
+    }
+
+    public setRisk(limits: {
+        instrument?: string,
+        max_order_volume?: number,
+        max_position?: number,
+        max_orders_per_second?: number,
+        price_band?: boolean,
+        self_cross?: boolean
+    }) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.setRisk(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "set_risk",
+            data: limits
+        }));
+    }
+
+    public queryLocalOrders(tag?: string) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.queryLocalOrders(): WebSocket is not connected");
+            return;
+        }
+        const data: any = {};
+        if (tag !== undefined) {
+            data.tag = tag;
+        }
+        this.ws.send(JSON.stringify({
+            op: "query_local_orders",
+            data: data
+        }));
+    }
+
+    public setLatency(enable: boolean) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.setLatency(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "set",
+            data: {
+                latency: enable
+            }
+        }));
+    }
+
+    public attach(brokerID: string, userID: string, password: string) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.attach(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "attach",
+            data: {
+                broker_id: brokerID,
+                user_id: userID,
+                password: password
+            }
+        }));
+    }
+
+    public setOrderEvents(all: boolean) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.setOrderEvents(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "set",
+            data: {
+                order_events: all ? "all" : "own"
+            }
+        }));
+    }
+
+    public cancelAll(instrument?: string, exchange?: string, direction?: number) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.cancelAll(): WebSocket is not connected");
+            return;
+        }
+        const data: any = {};
+        if (instrument !== undefined) {
+            data.instrument = instrument;
+        }
+        if (exchange !== undefined) {
+            data.exchange = exchange;
+        }
+        if (direction !== undefined) {
+            data.direction = direction;
+        }
+        this.ws.send(JSON.stringify({
+            op: "cancel_all",
+            data: data
+        }));
+    }
+
+    public setSettlementCache(enable: boolean) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.setSettlementCache(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "set",
+            data: {
+                settlement_cache: enable
+            }
+        }));
+    }
+
+    public insertConditional(
+        instrument: string,
+        exchange: string,
+        triggerPrice: number,
+        triggerOp: ">=" | "<=",
+        price: number,
+        direction: number,
+        offset: number,
+        volume: number,
+        priceType: number,
+        timeCondition: number,
+        options?: {
+            triggerField?: "last" | "bid" | "ask",
+            tag?: string
+        }
+    ) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.insertConditional(): WebSocket is not connected");
+            return;
+        }
+        const data: any = {
+            instrument: instrument,
+            exchange: exchange,
+            trigger_price: triggerPrice,
+            trigger_op: triggerOp,
+            price: price,
+            direction: direction,
+            offset: offset,
+            volume: volume,
+            price_type: priceType,
+            time_condition: timeCondition
+        };
+        if (options) {
+            if (options.triggerField !== undefined) {
+                data.trigger_field = options.triggerField;
+            }
+            if (options.tag !== undefined) {
+                data.tag = options.tag;
+            }
+        }
+        this.ws.send(JSON.stringify({
+            op: "insert_conditional",
+            data: data
+        }));
+    }
+
+    public cancelConditional(id: number) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.cancelConditional(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "cancel_conditional",
+            data: {
+                id: id
+            }
+        }));
+    }
+
+    public queryConditional() {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.queryConditional(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "query_conditional",
+            data: {}
+        }));
+    }
+
+    public startAlgo(
+        algo: "twap" | "iceberg",
+        instrument: string,
+        exchange: string,
+        price: number,
+        direction: number,
+        offset: number,
+        volume: number,
+        priceType: number,
+        timeCondition: number,
+        options: {
+            durationMs?: number,
+            slices?: number,
+            display?: number,
+            tag?: string
+        }
+    ) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.startAlgo(): WebSocket is not connected");
+            return;
+        }
+        const data: any = {
+            algo: algo,
+            instrument: instrument,
+            exchange: exchange,
+            price: price,
+            direction: direction,
+            offset: offset,
+            volume: volume,
+            price_type: priceType,
+            time_condition: timeCondition
+        };
+        if (options.durationMs !== undefined) {
+            data.duration_ms = options.durationMs;
+        }
+        if (options.slices !== undefined) {
+            data.slices = options.slices;
+        }
+        if (options.display !== undefined) {
+            data.display = options.display;
+        }
+        if (options.tag !== undefined) {
+            data.tag = options.tag;
+        }
+        this.ws.send(JSON.stringify({
+            op: "start_algo",
+            data: data
+        }));
+    }
+
+    public cancelAlgo(id: number) {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.cancelAlgo(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "cancel_algo",
+            data: {
+                id: id
+            }
+        }));
+    }
+
+    public queryAlgos() {
+        if (!this.ws) {
+            this.onError("WebCTP.Trade.queryAlgos(): WebSocket is not connected");
+            return;
+        }
+        this.ws.send(JSON.stringify({
+            op: "query_algos",
+            data: {}
+        }));
+    }
+
     public connectFront(addr: string, port: string) {
         if (!this.ws) 
             return;
@@ -720,6 +1056,45 @@ export class Trade {
                     this.onOrderDeleted(d);
                 }
                 break;
+            case Message.TradeMsgCode.QUERY_POSITION:
+                this.onQueryPosition(data);
+                break;
+            case Message.TradeMsgCode.POSITION_UPDATE:
+                this.onPositionUpdate(data);
+                break;
+            case Message.TradeMsgCode.POSITION_DRIFT:
+                this.onPositionDrift(data);
+                break;
+            case Message.TradeMsgCode.QUERY_STATS:
+                this.onQueryStats(data);
+                break;
+            case Message.TradeMsgCode.RISK_LIMITS:
+                this.onRiskLimits(data);
+                break;
+            case Message.TradeMsgCode.LOCAL_ORDERS:
+                this.onLocalOrders(data);
+                break;
+            case Message.TradeMsgCode.ATTACHED:
+                this.onAttached(data);
+                break;
+            case Message.TradeMsgCode.CANCEL_ALL:
+                this.onCancelAll(data);
+                break;
+            case Message.TradeMsgCode.RESTORED:
+                this.onRestored(data);
+                break;
+            case Message.TradeMsgCode.CONDITIONAL_ORDER:
+                this.onConditionalOrder(data);
+                break;
+            case Message.TradeMsgCode.CONDITIONAL_ORDERS:
+                this.onConditionalOrders(data);
+                break;
+            case Message.TradeMsgCode.ALGO_ORDER:
+                this.onAlgoOrder(data);
+                break;
+            case Message.TradeMsgCode.ALGO_ORDERS:
+                this.onAlgoOrders(data);
+                break;
             default:
                 this.onError("Unknown message: " + JSON.stringify(data));
             }
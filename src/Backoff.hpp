@@ -0,0 +1,36 @@
+#ifndef TABXX_BACKOFF_HPP_
+#define TABXX_BACKOFF_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+
+namespace tabxx {
+
+// Jittered exponential backoff: attempt n waits a random time between half
+// and all of min(cap, base * 2^n) milliseconds, so sessions dropped by the
+// same front do not all come back at once.
+class Backoff {
+public:
+    Backoff(int base_ms, int cap_ms):
+        base_(base_ms), cap_(cap_ms), rng_(std::random_device{}()) {}
+
+    int next() {
+        const int64_t ceiling = std::min<int64_t>(cap_, static_cast<int64_t>(base_) << std::min(attempt_, 20));
+        ++attempt_;
+        return std::uniform_int_distribution<int>(static_cast<int>(ceiling / 2), static_cast<int>(ceiling))(rng_);
+    }
+
+    void reset() noexcept { attempt_ = 0; }
+    int attempts() const noexcept { return attempt_; }
+
+private:
+    int base_;
+    int cap_;
+    int attempt_ = 0;
+    std::mt19937 rng_;
+};
+
+} // namespace tabxx
+
+#endif // TABXX_BACKOFF_HPP_
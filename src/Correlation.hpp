@@ -0,0 +1,68 @@
+#ifndef TABXX_CORRELATION_HPP_
+#define TABXX_CORRELATION_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include <json.hpp>
+
+namespace tabxx {
+
+// Client correlation ids of one handler. The `cid` a client sends with a
+// message is bound to the req_ids acknowledged while the message is handled,
+// and every later message routed by one of those req_ids carries it back in
+// its `info`, so that a client can keep many requests in flight.
+class Correlation {
+public:
+    // Old requests are long answered by the time they fall out.
+    static constexpr size_t kMaxBound = 65536;
+
+    // Loop thread only: the cid of the message being handled, null if none.
+    void handle(nlohmann::json cid) { current_ = std::move(cid); }
+    const nlohmann::json& current() const noexcept { return current_; }
+    // Any thread: no cid was ever bound.
+    bool empty() const noexcept { return !any_.load(std::memory_order_acquire); }
+
+    // Loop thread only: binds the current cid, if any, to `req_id`.
+    void bind(int req_id) {
+        if (current_.is_null() || req_id == 0)
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        bound_[req_id] = current_;
+        if (bound_.size() > kMaxBound)
+            bound_.erase(bound_.begin());
+        any_.store(true, std::memory_order_release);
+    }
+
+    // Any thread: the cid bound to `req_id`, null if none.
+    nlohmann::json find(int req_id) const {
+        if (empty())
+            return nullptr;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = bound_.find(req_id);
+        return it == bound_.end() ? nlohmann::json() : it->second;
+    }
+
+    // Any thread: adds the cid bound to `req_id` to the `info` of `message`.
+    void tag(nlohmann::json& message, int req_id) const {
+        auto info = message.find("info");
+        if (info == message.end() || !info->is_object() || info->contains("cid"))
+            return;
+        auto cid = find(req_id);
+        if (!cid.is_null())
+            (*info)["cid"] = std::move(cid);
+    }
+
+private:
+    nlohmann::json current_;
+    mutable std::mutex mutex_;
+    std::map<int, nlohmann::json> bound_;   // req_id -> cid
+    std::atomic<bool> any_ {false};
+};
+
+} // namespace tabxx
+
+#endif // TABXX_CORRELATION_HPP_
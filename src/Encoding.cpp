@@ -1,136 +1,157 @@
-#include <unicode/ucnv.h>
-#include <unicode/ustring.h>
-#include <unicode/errorcode.h>
-#include <unicode/utypes.h>
-#include <vector>
-#include <stdexcept>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "Encoding.hpp"
+#include "GbkTable.hpp"
 
 namespace tabxx {
 namespace {
 
-thread_local UConverter* gbk_converter = nullptr;
-thread_local UConverter* utf8_converter = nullptr;
-thread_local std::vector<UChar> unicode_buffer;
-thread_local std::string output_buffer;
-
-inline UConverter* init_converter(const char* name, UConverter*& cache) {
-    if (!cache) {
-        UErrorCode status = U_ZERO_ERROR;
-        cache = ucnv_open(name, &status);
-        if (U_FAILURE(status)) {
-            const char* error_name = u_errorName(status);
-            throw std::runtime_error(
-                std::string("Failed to initialize ") + name + 
-                " converter: " + (error_name ? error_name : "unknown error")
-            );
-        }
+// Offset of the first byte with the high bit set, `n` if there is none.
+inline size_t ascii_prefix(const char* s, size_t n) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        const unsigned high = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i))));
+        if (high)
+            return i + __builtin_ctz(high);
     }
-    return cache;
+#endif
+    for (; i < n; ++i) {
+        if (static_cast<unsigned char>(s[i]) & 0x80)
+            return i;
+    }
+    return n;
 }
 
-inline void throw_conversion_error(const char* stage, UErrorCode status) {
-    const char* error_name = u_errorName(status);
-    throw std::runtime_error(
-        std::string("Encoding conversion failed at ") + stage + 
-        ": " + (error_name ? error_name : "unknown error")
-    );
+// Code points out of GBK are all in the BMP and above ASCII.
+inline char* put_utf8(uint32_t c, char* out) {
+    if (c < 0x800) {
+        *out++ = static_cast<char>(0xC0 | (c >> 6));
+        *out++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    else {
+        *out++ = static_cast<char>(0xE0 | (c >> 12));
+        *out++ = static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+        *out++ = static_cast<char>(0x80 | (c & 0x3F));
+    }
+    return out;
 }
 
-} // namespace
-} // namespace tabxx
+std::atomic<uint64_t> cache_hits {0};
+std::atomic<uint64_t> cache_misses {0};
 
-std::string tabxx::u8(const std::string& gbk) {
-    if (gbk.empty()) return {};
-    
-    auto* gbk_conv = init_converter("GBK", gbk_converter);
-    auto* utf8_conv = init_converter("UTF-8", utf8_converter);
-    
-    ucnv_reset(gbk_conv);
-    ucnv_reset(utf8_conv);
-    
-    const int32_t gbk_len = static_cast<int32_t>(gbk.size());
-    UErrorCode status = U_ZERO_ERROR;
-    
-    // GBK -> Unicode
-    const size_t unicode_needed = static_cast<size_t>(gbk_len);
-    if (unicode_buffer.size() < unicode_needed) {
-        unicode_buffer.resize(unicode_needed);
-    }
-    
-    int32_t unicode_length = ucnv_toUChars(
-        gbk_conv,
-        unicode_buffer.data(), 
-        static_cast<int32_t>(unicode_buffer.size()),
-        gbk.data(),
-        gbk_len,
-        &status
-    );
-    
-    if (status == U_BUFFER_OVERFLOW_ERROR) {
-        const size_t unicode_required = static_cast<size_t>(-unicode_length);
-        if (unicode_buffer.size() < unicode_required) {
-            unicode_buffer.resize(unicode_required);
-        }
-        ucnv_reset(gbk_conv);
-        status = U_ZERO_ERROR;
-        unicode_length = ucnv_toUChars(
-            gbk_conv,
-            unicode_buffer.data(),
-            static_cast<int32_t>(unicode_buffer.size()),
-            gbk.data(),
-            gbk_len,
-            &status
-        );
-    }
-    
-    if (U_FAILURE(status)) {
-        throw_conversion_error("GBK to Unicode", status);
+// Conversions of short text (every CTP message and name field; statements
+// are longer) seen last on this thread, one per slot by hash of the bytes.
+class Cache {
+public:
+    static constexpr size_t kSlots = 256;
+    static constexpr size_t kMaxKey = 80;
+
+    // Nullptr on a miss. Allocation free.
+    const std::string* find(std::string_view key, size_t hash) const noexcept {
+        const Slot& slot = slots_[hash % kSlots];
+        if (slot.length != key.size() || slot.hash != hash || std::memcmp(slot.key, key.data(), key.size()) != 0)
+            return nullptr;
+        return &slot.value;
     }
-    if (unicode_length <= 0) {
-        throw std::runtime_error("GBK to Unicode conversion produced zero-length result");
+
+    void store(std::string_view key, size_t hash, const std::string& value) {
+        Slot& slot = slots_[hash % kSlots];
+        slot.hash = hash;
+        slot.length = key.size();
+        std::memcpy(slot.key, key.data(), key.size());
+        slot.value = value;
     }
-    
-    // Unicode -> UTF-8
-    const size_t utf8_needed = static_cast<size_t>(unicode_length * 3);
-    if (output_buffer.size() < utf8_needed) {
-        output_buffer.resize(utf8_needed);
+
+private:
+    struct Slot {
+        size_t hash = 0;
+        size_t length = kMaxKey + 1;    // matches no key while empty
+        char key[kMaxKey];
+        std::string value;
+    };
+    Slot slots_[kSlots];
+};
+
+// FNV-1a.
+inline size_t hash_bytes(std::string_view s) noexcept {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ull;
     }
-    
-    status = U_ZERO_ERROR;
-    int32_t utf8_length = ucnv_fromUChars(
-        utf8_conv,
-        output_buffer.data(),
-        static_cast<int32_t>(output_buffer.size()),
-        unicode_buffer.data(),
-        unicode_length,
-        &status
-    );
-    
-    if (status == U_BUFFER_OVERFLOW_ERROR) {
-        const size_t utf8_required = static_cast<size_t>(-utf8_length);
-        if (output_buffer.size() < utf8_required) {
-            output_buffer.resize(utf8_required);
+    return static_cast<size_t>(h);
+}
+
+// The text from `i`, the first byte that is not ASCII, on.
+std::string convert(const char* s, size_t n, size_t i) {
+    // No GBK byte takes more than three bytes of UTF-8.
+    std::string out;
+    out.resize(i + (n - i) * 3);
+    std::memcpy(out.data(), s, i);
+    char* target = out.data() + i;
+    while (i < n) {
+        const auto c = static_cast<unsigned char>(s[i]);
+        if (c < 0x80) {
+            const size_t plain = ascii_prefix(s + i, n - i);
+            std::memcpy(target, s + i, plain);
+            target += plain;
+            i += plain;
+            continue;
         }
-        ucnv_reset(utf8_conv);
-        status = U_ZERO_ERROR;
-        utf8_length = ucnv_fromUChars(
-            utf8_conv,
-            output_buffer.data(),
-            static_cast<int32_t>(output_buffer.size()),
-            unicode_buffer.data(),
-            unicode_length,
-            &status
-        );
-    }
-    
-    if (U_FAILURE(status)) {
-        throw_conversion_error("Unicode to UTF-8", status);
+        // Single bytes and malformed sequences decode as ICU does: 0x80 is
+        // the euro sign, 0xFF a private use character, and a lead byte
+        // without a valid trail is replaced, the trail read on its own.
+        uint32_t code = 0xFFFD;
+        if (c == 0x80) {
+            code = 0x20AC;
+        }
+        else if (c == 0xFF) {
+            code = 0xF8F5;
+        }
+        else if (i + 1 < n) {
+            const auto t = static_cast<unsigned char>(s[i + 1]);
+            if (t >= 0x40 && t != 0x7F && t != 0xFF) {
+                code = kGbkTable[(c - 0x81) * kGbkTrails + t - 0x40 - (t > 0x7F)];
+                ++i;
+            }
+        }
+        target = put_utf8(code, target);
+        ++i;
     }
-    if (utf8_length <= 0) {
-        throw std::runtime_error("Unicode to UTF-8 conversion produced zero-length result");
+    out.resize(static_cast<size_t>(target - out.data()));
+    return out;
+}
+
+} // namespace
+} // namespace tabxx
+
+std::string tabxx::u8(std::string_view gbk) {
+    const size_t i = ascii_prefix(gbk.data(), gbk.size());
+    if (i == gbk.size())
+        return std::string(gbk);
+    if (gbk.size() > Cache::kMaxKey)
+        return convert(gbk.data(), gbk.size(), i);
+    thread_local Cache cache;
+    const size_t hash = hash_bytes(gbk);
+    if (const auto* hit = cache.find(gbk, hash)) {
+        cache_hits.fetch_add(1, std::memory_order_relaxed);
+        return *hit;
     }
-    
-    return std::string(output_buffer.data(), static_cast<size_t>(utf8_length));
-}
\ No newline at end of file
+    cache_misses.fetch_add(1, std::memory_order_relaxed);
+    auto out = convert(gbk.data(), gbk.size(), i);
+    cache.store(gbk, hash, out);
+    return out;
+}
+
+tabxx::U8CacheStats tabxx::u8_cache_stats() noexcept {
+    return {cache_hits.load(std::memory_order_relaxed), cache_misses.load(std::memory_order_relaxed)};
+}
@@ -1,7 +1,26 @@
+#ifndef TABXX_ENCODING_HPP_
+#define TABXX_ENCODING_HPP_
+
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 namespace tabxx {
 
-std::string u8(const std::string& gbk);
+// GBK, as CTP sends text, to UTF-8. Pure ASCII input, most IDs, dates and
+// messages, is returned as it is. Short text is remembered per thread, so
+// the status and error messages and names that come back over and over are
+// converted once.
+std::string u8(std::string_view gbk);
+
+struct U8CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+};
+
+// Lookups in the caches of u8(), all threads together.
+U8CacheStats u8_cache_stats() noexcept;
+
+} // namespace tabxx
 
-} // namespace tabxx
\ No newline at end of file
+#endif // TABXX_ENCODING_HPP_
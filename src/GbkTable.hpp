@@ -0,0 +1,20 @@
+#ifndef TABXX_GBK_TABLE_HPP_
+#define TABXX_GBK_TABLE_HPP_
+
+#include <cstdint>
+
+namespace tabxx {
+
+// Double-byte GBK (Windows code page 936, as ICU's windows-936-2000 maps
+// it): lead bytes 0x81..0xFE, trail bytes 0x40..0xFE but 0x7F. Every code
+// is assigned, user-defined areas to the Private Use Area.
+constexpr int kGbkLeads = 126;
+constexpr int kGbkTrails = 190;
+
+// UTF-16 code unit of lead, trail at [(lead - 0x81) * kGbkTrails + trail
+// index], the trail index skipping 0x7F. Generated: `gbk_test --table`.
+extern const uint16_t kGbkTable[kGbkLeads * kGbkTrails];
+
+} // namespace tabxx
+
+#endif // TABXX_GBK_TABLE_HPP_
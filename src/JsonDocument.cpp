@@ -0,0 +1,525 @@
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "JsonDocument.hpp"
+
+namespace tabxx {
+namespace {
+
+inline bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool IsStructural(char c) {
+    return c == '{' || c == '}' || c == '[' || c == ']' || c == ':' || c == ',';
+}
+
+inline bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+int Hex(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Four hex digits at `p`, -1 if they are not.
+int Hex4(const char* p, const char* end) {
+    if (end - p < 4)
+        return -1;
+    int v = 0;
+    for (int i = 0; i < 4; ++i) {
+        const int d = Hex(p[i]);
+        if (d < 0)
+            return -1;
+        v = (v << 4) | d;
+    }
+    return v;
+}
+
+void AppendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    }
+    else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Decodes the escapes of a string body into `out`, or only checks them when
+// `out` is null. False on an invalid escape or unpaired surrogate.
+bool Unescape(const char* p, const char* end, std::string* out) {
+    while (p < end) {
+        const char* slash = static_cast<const char*>(std::memchr(p, '\\', end - p));
+        if (!slash)
+            slash = end;
+        if (out)
+            out->append(p, slash);
+        if (slash == end)
+            return true;
+        p = slash + 1;
+        if (p == end)
+            return false;
+        char c = *p++;
+        switch (c) {
+        case '"': case '\\': case '/':
+            break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u': {
+            int cp = Hex4(p, end);
+            if (cp < 0 || (cp >= 0xDC00 && cp <= 0xDFFF))
+                return false;
+            p += 4;
+            if (cp >= 0xD800 && cp <= 0xDBFF) {
+                if (end - p < 6 || p[0] != '\\' || p[1] != 'u')
+                    return false;
+                const int low = Hex4(p + 2, end);
+                if (low < 0xDC00 || low > 0xDFFF)
+                    return false;
+                p += 6;
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+            }
+            if (out)
+                AppendUtf8(*out, static_cast<uint32_t>(cp));
+            continue;
+        }
+        default:
+            return false;
+        }
+        if (out)
+            *out += c;
+    }
+    return true;
+}
+
+// JSON number grammar; `integer` when it has neither fraction nor exponent.
+bool IsNumber(std::string_view v, bool& integer) {
+    size_t i = 0;
+    const size_t n = v.size();
+    if (i < n && v[i] == '-')
+        ++i;
+    if (i == n)
+        return false;
+    if (v[i] == '0')
+        ++i;
+    else if (IsDigit(v[i]))
+        while (i < n && IsDigit(v[i])) ++i;
+    else
+        return false;
+    integer = true;
+    if (i < n && v[i] == '.') {
+        integer = false;
+        if (++i == n || !IsDigit(v[i]))
+            return false;
+        while (i < n && IsDigit(v[i])) ++i;
+    }
+    if (i < n && (v[i] == 'e' || v[i] == 'E')) {
+        integer = false;
+        ++i;
+        if (i < n && (v[i] == '+' || v[i] == '-'))
+            ++i;
+        if (i == n || !IsDigit(v[i]))
+            return false;
+        while (i < n && IsDigit(v[i])) ++i;
+    }
+    return i == n;
+}
+
+#ifdef __SSE2__
+// Bit i set when an odd number of bits 0..i of `m` are.
+inline unsigned PrefixXor(unsigned m) {
+    m ^= m << 1;
+    m ^= m << 2;
+    m ^= m << 4;
+    m ^= m << 8;
+    return m & 0xFFFF;
+}
+
+inline unsigned Match(__m128i block, char c) {
+    return static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))));
+}
+#endif
+
+} // namespace
+
+bool JsonDocument::index() {
+    index_.clear();
+    escapes_ = false;
+    const char* s = text_.data();
+    const size_t n = text_.size();
+    bool in_string = false;
+    size_t i = 0;
+    // Byte by byte up to `end`, for the tail and for blocks with escapes.
+    auto scan = [&] (size_t end) {
+        for (; i < end; ++i) {
+            const auto c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x80)
+                return false;
+            if (in_string) {
+                if (c == '\\') {
+                    // The escaped byte is checked when the string is.
+                    escapes_ = true;
+                    ++i;
+                }
+                else if (c == '"') {
+                    in_string = false;
+                    index_.push_back(static_cast<uint32_t>(i));
+                }
+                else if (c < 0x20) {
+                    return false;
+                }
+            }
+            else if (c == '"') {
+                in_string = true;
+                index_.push_back(static_cast<uint32_t>(i));
+            }
+            else if (IsStructural(c)) {
+                index_.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        return true;
+    };
+#ifdef __SSE2__
+    while (i + 16 <= n) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        if (_mm_movemask_epi8(block))
+            return false;
+        if (Match(block, '\\')) {
+            if (!scan(i + 16))
+                return false;
+            continue;
+        }
+        const unsigned quotes = Match(block, '"');
+        const unsigned structural = Match(block, '{') | Match(block, '}') | Match(block, '[')
+            | Match(block, ']') | Match(block, ':') | Match(block, ',');
+        const unsigned control = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_min_epu8(block, _mm_set1_epi8(0x1F)), block)));
+        // Opening quotes and string bodies; closing quotes are outside.
+        const unsigned inside = PrefixXor(quotes) ^ (in_string ? 0xFFFFu : 0u);
+        if (control & inside)
+            return false;
+        in_string = inside & 0x8000u;
+        unsigned bits = (structural & ~inside) | quotes;
+        while (bits) {
+            index_.push_back(static_cast<uint32_t>(i + __builtin_ctz(bits)));
+            bits &= bits - 1;
+        }
+        i += 16;
+    }
+#endif
+    return scan(n) && !in_string;
+}
+
+// Stage 2: checks the grammar over the structural index and records the
+// tape. The cursor `pos_` moves through the text, `k_` through the index.
+class JsonDocument::Parser {
+public:
+    explicit Parser(JsonDocument& doc):
+        doc_(doc), s_(doc.text_.data()), n_(static_cast<uint32_t>(doc.text_.size())), index_(doc.index_) {}
+
+    bool run() {
+        if (!value(0))
+            return false;
+        skip();
+        return pos_ == n_ && k_ == index_.size();
+    }
+
+private:
+    void skip() {
+        while (pos_ < n_ && IsSpace(s_[pos_])) ++pos_;
+    }
+
+    // The cursor is on the structural character `c`.
+    bool at(char c) const {
+        return pos_ < n_ && s_[pos_] == c && k_ < index_.size() && index_[k_] == pos_;
+    }
+
+    void take() {
+        ++k_;
+        ++pos_;
+    }
+
+    uint32_t push(Kind kind, uint32_t begin, uint32_t end) {
+        doc_.nodes_.push_back(Node {kind, false, begin, end, 0});
+        return static_cast<uint32_t>(doc_.nodes_.size() - 1);
+    }
+
+    void close(uint32_t id) {
+        doc_.nodes_[id].end = pos_;
+        doc_.nodes_[id].next = static_cast<uint32_t>(doc_.nodes_.size());
+    }
+
+    bool value(int depth) {
+        skip();
+        if (pos_ >= n_)
+            return false;
+        switch (s_[pos_]) {
+        case '"':
+            return string();
+        case '{':
+        case '[':
+            if (depth >= kMaxDepth)
+                return false;
+            return s_[pos_] == '{' ? object(depth) : array(depth);
+        default:
+            return scalar();
+        }
+    }
+
+    bool string() {
+        if (!at('"') || k_ + 1 >= index_.size())
+            return false;
+        // Inside a string only its closing quote is indexed.
+        const uint32_t begin = pos_ + 1;
+        const uint32_t end = index_[k_ + 1];
+        const uint32_t id = push(Kind::STRING, begin, end);
+        if (doc_.escapes_ && std::memchr(s_ + begin, '\\', end - begin)) {
+            if (!Unescape(s_ + begin, s_ + end, nullptr))
+                return false;
+            doc_.nodes_[id].escaped = true;
+        }
+        doc_.nodes_[id].next = id + 1;
+        k_ += 2;
+        pos_ = end + 1;
+        return true;
+    }
+
+    bool object(int depth) {
+        const uint32_t id = push(Kind::OBJECT, pos_, 0);
+        take();
+        skip();
+        if (!at('}')) {
+            for (;;) {
+                skip();
+                if (!string())
+                    return false;
+                skip();
+                if (!at(':'))
+                    return false;
+                take();
+                if (!value(depth + 1))
+                    return false;
+                skip();
+                if (at('}'))
+                    break;
+                if (!at(','))
+                    return false;
+                take();
+            }
+        }
+        take();
+        close(id);
+        return true;
+    }
+
+    bool array(int depth) {
+        const uint32_t id = push(Kind::ARRAY, pos_, 0);
+        take();
+        skip();
+        if (!at(']')) {
+            for (;;) {
+                if (!value(depth + 1))
+                    return false;
+                skip();
+                if (at(']'))
+                    break;
+                if (!at(','))
+                    return false;
+                take();
+            }
+        }
+        take();
+        close(id);
+        return true;
+    }
+
+    // A literal or number, running up to the next structural character.
+    bool scalar() {
+        const uint32_t begin = pos_;
+        uint32_t end = k_ < index_.size() ? index_[k_] : n_;
+        while (end > begin && IsSpace(s_[end - 1])) --end;
+        const std::string_view v(s_ + begin, end - begin);
+        Kind kind;
+        bool integer = false;
+        if (v == "true" || v == "false") {
+            kind = Kind::BOOLEAN;
+        }
+        else if (v == "null") {
+            kind = Kind::NIL;
+        }
+        else if (IsNumber(v, integer)) {
+            kind = integer ? Kind::INTEGER : Kind::FLOAT;
+            int64_t unused;
+            if (integer && std::from_chars(v.data(), v.data() + v.size(), unused).ec != std::errc())
+                return false;   // beyond int64, left to nlohmann
+        }
+        else {
+            return false;
+        }
+        const uint32_t id = push(kind, begin, end);
+        doc_.nodes_[id].next = id + 1;
+        pos_ = end;
+        return true;
+    }
+
+private:
+    JsonDocument& doc_;
+    const char* s_;
+    uint32_t n_;
+    const std::vector<uint32_t>& index_;
+    uint32_t pos_ = 0;
+    size_t k_ = 0;
+};
+
+bool JsonDocument::parse(std::string_view text) {
+    text_ = text;
+    nodes_.clear();
+    if (text.size() >= UINT32_MAX || !index())
+        return false;
+    return Parser(*this).run();
+}
+
+std::string JsonDocument::string(const Node& n) const {
+    if (!n.escaped)
+        return std::string(text_.data() + n.begin, n.end - n.begin);
+    std::string out;
+    out.reserve(n.end - n.begin);
+    Unescape(text_.data() + n.begin, text_.data() + n.end, &out);
+    return out;
+}
+
+bool JsonValue::is_object() const noexcept {
+    return doc_->nodes_[node_].kind == JsonDocument::Kind::OBJECT;
+}
+
+bool JsonValue::is_array() const noexcept {
+    return doc_->nodes_[node_].kind == JsonDocument::Kind::ARRAY;
+}
+
+bool JsonValue::is_string() const noexcept {
+    return doc_->nodes_[node_].kind == JsonDocument::Kind::STRING;
+}
+
+bool JsonValue::is_number_integer() const noexcept {
+    return doc_->nodes_[node_].kind == JsonDocument::Kind::INTEGER;
+}
+
+bool JsonValue::is_number() const noexcept {
+    const auto kind = doc_->nodes_[node_].kind;
+    return kind == JsonDocument::Kind::INTEGER || kind == JsonDocument::Kind::FLOAT;
+}
+
+bool JsonValue::is_boolean() const noexcept {
+    return doc_->nodes_[node_].kind == JsonDocument::Kind::BOOLEAN;
+}
+
+bool JsonValue::is_null() const noexcept {
+    return doc_->nodes_[node_].kind == JsonDocument::Kind::NIL;
+}
+
+std::optional<JsonValue> JsonValue::find(std::string_view key) const {
+    const auto& nodes = doc_->nodes_;
+    const auto& n = nodes[node_];
+    if (n.kind != JsonDocument::Kind::OBJECT)
+        return std::nullopt;
+    std::optional<JsonValue> found;
+    for (uint32_t k = node_ + 1; k < n.next; k = nodes[k + 1].next) {
+        if (JsonValue(doc_, k).equals(key))
+            found = JsonValue(doc_, k + 1);
+    }
+    return found;
+}
+
+bool JsonValue::equals(std::string_view s) const {
+    const auto& n = doc_->nodes_[node_];
+    if (n.kind != JsonDocument::Kind::STRING)
+        return false;
+    if (!n.escaped)
+        return doc_->text_.substr(n.begin, n.end - n.begin) == s;
+    return doc_->string(n) == s;
+}
+
+template <>
+std::string JsonValue::get<std::string>() const {
+    const auto& n = doc_->nodes_[node_];
+    if (n.kind != JsonDocument::Kind::STRING)
+        throw std::domain_error("JsonValue: type must be string");
+    return doc_->string(n);
+}
+
+template <>
+bool JsonValue::get<bool>() const {
+    const auto& n = doc_->nodes_[node_];
+    if (n.kind != JsonDocument::Kind::BOOLEAN)
+        throw std::domain_error("JsonValue: type must be boolean");
+    return doc_->text_[n.begin] == 't';
+}
+
+template <>
+double JsonValue::get<double>() const {
+    const auto& n = doc_->nodes_[node_];
+    if (n.kind != JsonDocument::Kind::INTEGER && n.kind != JsonDocument::Kind::FLOAT)
+        throw std::domain_error("JsonValue: type must be number");
+    const char* p = doc_->text_.data();
+    double v = 0;
+    std::from_chars(p + n.begin, p + n.end, v);
+    return v;
+}
+
+template <>
+int64_t JsonValue::get<int64_t>() const {
+    const auto& n = doc_->nodes_[node_];
+    if (n.kind == JsonDocument::Kind::FLOAT)
+        return static_cast<int64_t>(get<double>());
+    if (n.kind != JsonDocument::Kind::INTEGER)
+        throw std::domain_error("JsonValue: type must be number");
+    const char* p = doc_->text_.data();
+    int64_t v = 0;
+    std::from_chars(p + n.begin, p + n.end, v);
+    return v;
+}
+
+template <>
+int JsonValue::get<int>() const {
+    return static_cast<int>(get<int64_t>());
+}
+
+template <>
+std::vector<std::string> JsonValue::get<std::vector<std::string>>() const {
+    const auto& nodes = doc_->nodes_;
+    const auto& n = nodes[node_];
+    if (n.kind != JsonDocument::Kind::ARRAY)
+        throw std::domain_error("JsonValue: type must be array");
+    std::vector<std::string> out;
+    for (uint32_t k = node_ + 1; k < n.next; k = nodes[k].next)
+        out.push_back(JsonValue(doc_, k).get<std::string>());
+    return out;
+}
+
+} // namespace tabxx
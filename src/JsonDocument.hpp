@@ -0,0 +1,100 @@
+#ifndef TABXX_JSON_DOCUMENT_HPP_
+#define TABXX_JSON_DOCUMENT_HPP_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tabxx {
+
+class JsonDocument;
+
+// A value of a JsonDocument, read on demand: nothing is converted until one
+// of the get() calls asks for it. The method names follow nlohmann::json so
+// that request decoding can take either. Valid while its document is.
+class JsonValue {
+public:
+    bool is_object() const noexcept;
+    bool is_array() const noexcept;
+    bool is_string() const noexcept;
+    bool is_number_integer() const noexcept;
+    bool is_number() const noexcept;
+    bool is_boolean() const noexcept;
+    bool is_null() const noexcept;
+
+    // Member `key` of an object, the last one if it is repeated (as
+    // nlohmann::json keeps it).
+    std::optional<JsonValue> find(std::string_view key) const;
+    bool contains(std::string_view key) const { return find(key).has_value(); }
+    // A string equal to `s`.
+    bool equals(std::string_view s) const;
+
+    // Supported: std::string, bool, int, int64_t, double and
+    // std::vector<std::string>. Throws std::domain_error on a type mismatch.
+    template <typename T>
+    T get() const;
+
+private:
+    friend class JsonDocument;
+    JsonValue(const JsonDocument* doc, uint32_t node): doc_(doc), node_(node) {}
+
+    const JsonDocument* doc_;
+    uint32_t node_;
+};
+
+template <> std::string JsonValue::get<std::string>() const;
+template <> bool JsonValue::get<bool>() const;
+template <> int JsonValue::get<int>() const;
+template <> int64_t JsonValue::get<int64_t>() const;
+template <> double JsonValue::get<double>() const;
+template <> std::vector<std::string> JsonValue::get<std::vector<std::string>>() const;
+
+// On-demand reader for inbound messages. parse() finds the structural
+// characters of the text, 16 bytes at a time with SSE2 where available,
+// then checks the grammar over them into a flat tape of values that only
+// records where each one is; strings and numbers stay in the text until a
+// JsonValue reads them. No DOM and, once warm, no allocation per message.
+//
+// Anything it does not read itself (non-ASCII text, integers beyond int64,
+// nesting deeper than kMaxDepth) or that is not valid JSON makes parse()
+// return false, and the caller goes through nlohmann::json instead, which
+// decides between an unusual payload and a parse error.
+class JsonDocument {
+public:
+    static constexpr int kMaxDepth = 64;
+
+    // `text` must outlive the values read from it.
+    bool parse(std::string_view text);
+    JsonValue root() const { return JsonValue(this, 0); }
+
+private:
+    friend class JsonValue;
+    enum class Kind: uint8_t {
+        OBJECT, ARRAY, STRING, INTEGER, FLOAT, BOOLEAN, NIL
+    };
+    struct Node {
+        Kind kind;
+        bool escaped;       // string holding backslash escapes
+        uint32_t begin;     // text range, inside the quotes for strings
+        uint32_t end;
+        uint32_t next;      // node after this one and its children
+    };
+    class Parser;
+
+    // Stage 1: offsets of the quotes and of { } [ ] : , outside strings;
+    // false on bytes left to nlohmann.
+    bool index();
+    std::string string(const Node& n) const;
+
+    std::string_view text_;
+    std::vector<uint32_t> index_;
+    std::vector<Node> nodes_;
+    bool escapes_ = false;
+
+}; // class JsonDocument
+
+} // namespace tabxx
+
+#endif // TABXX_JSON_DOCUMENT_HPP_
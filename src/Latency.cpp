@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Latency.hpp"
+
+namespace tabxx {
+namespace {
+
+int Magnitude(uint64_t v) noexcept {
+    return 63 - __builtin_clzll(v);
+}
+
+double Micros(int64_t ns) {
+    return std::round(ns / 10.0) / 100.0;
+}
+
+bool IsSet(LatencyClock::time_point t) {
+    return t != LatencyClock::time_point();
+}
+
+} // namespace
+
+int LatencyHistogram::index(uint64_t v) noexcept {
+    if (v < static_cast<uint64_t>(kSub))
+        return static_cast<int>(v);
+    const int m = Magnitude(v);
+    if (m > kMaxMagnitude)
+        return kBuckets - 1;
+    // The kSubBits leading bits, the first of which is always set.
+    const int shift = m - kSubBits + 1;
+    const int sub = static_cast<int>(v >> shift) - kHalf;
+    return kSub + (m - kSubBits) * kHalf + sub;
+}
+
+int64_t LatencyHistogram::value(int i) noexcept {
+    if (i < kSub)
+        return i;
+    const int m = (i - kSub) / kHalf + kSubBits;
+    const int sub = (i - kSub) % kHalf + kHalf;
+    const int shift = m - kSubBits + 1;
+    const int64_t low = static_cast<int64_t>(sub) << shift;
+    return low + (int64_t(1) << shift) / 2;
+}
+
+void LatencyHistogram::record(int64_t ns) noexcept {
+    if (ns < 0)
+        ns = 0;
+    buckets_[index(static_cast<uint64_t>(ns))].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+    auto low = min_.load(std::memory_order_relaxed);
+    while (ns < low && !min_.compare_exchange_weak(low, ns, std::memory_order_relaxed))
+        ;
+    auto high = max_.load(std::memory_order_relaxed);
+    while (ns > high && !max_.compare_exchange_weak(high, ns, std::memory_order_relaxed))
+        ;
+}
+
+void LatencyHistogram::reset() noexcept {
+    for (auto& b : buckets_)
+        b.store(0, std::memory_order_relaxed);
+    count_ = 0;
+    sum_ = 0;
+    min_ = INT64_MAX;
+    max_ = 0;
+}
+
+int64_t LatencyHistogram::percentile(double q) const noexcept {
+    // Sum the buckets rather than trusting count_, writers may be mid-record.
+    uint64_t total = 0;
+    for (const auto& b : buckets_)
+        total += b.load(std::memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    const auto rank = static_cast<uint64_t>(std::ceil(std::clamp(q, 0.0, 100.0) / 100.0 * total));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= std::max<uint64_t>(rank, 1))
+            return std::min(value(i), max_.load(std::memory_order_relaxed));
+    }
+    return max_.load(std::memory_order_relaxed);
+}
+
+nlohmann::json LatencyHistogram::toJson() const {
+    const auto n = count();
+    if (n == 0)
+        return nlohmann::json {{"count", 0}};
+    return nlohmann::json {
+        {"count", n},
+        {"min_us", Micros(min_.load(std::memory_order_relaxed))},
+        {"mean_us", Micros(static_cast<int64_t>(sum_.load(std::memory_order_relaxed) / n))},
+        {"p50_us", Micros(percentile(50))},
+        {"p90_us", Micros(percentile(90))},
+        {"p99_us", Micros(percentile(99))},
+        {"p999_us", Micros(percentile(99.9))},
+        {"max_us", Micros(max_.load(std::memory_order_relaxed))}
+    };
+}
+
+const char* ToString(LatencyStage stage) noexcept {
+    switch (stage) {
+    case LatencyStage::PARSE: return "parse";
+    case LatencyStage::HANDLE: return "handle";
+    case LatencyStage::REQ_INSERT: return "req_insert";
+    case LatencyStage::CTP_ACK: return "ctp_ack";
+    case LatencyStage::EXCHANGE_ACK: return "exchange_ack";
+    case LatencyStage::FIRST_TRADE: return "first_trade";
+    case LatencyStage::TO_EXCHANGE: return "to_exchange";
+    default: return "unknown";
+    }
+}
+
+nlohmann::json ToJson(const OrderTiming& t) {
+    nlohmann::json j = nlohmann::json::object();
+    auto add = [&] (LatencyStage stage, LatencyClock::time_point from, LatencyClock::time_point to) {
+        if (IsSet(from) && IsSet(to))
+            j[ToString(stage)] = Micros(std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+    };
+    add(LatencyStage::PARSE, t.received, t.parsed);
+    add(LatencyStage::HANDLE, t.parsed, t.sending);
+    add(LatencyStage::REQ_INSERT, t.sending, t.sent);
+    add(LatencyStage::CTP_ACK, t.sent, t.ctp_ack);
+    add(LatencyStage::EXCHANGE_ACK, t.ctp_ack, t.exchange_ack);
+    add(LatencyStage::FIRST_TRADE, t.exchange_ack, t.first_trade);
+    add(LatencyStage::TO_EXCHANGE, t.received, t.exchange_ack);
+    return j;
+}
+
+void LatencyStats::record(LatencyStage stage, LatencyClock::time_point from, LatencyClock::time_point to) noexcept {
+    if (!IsSet(from) || !IsSet(to))
+        return;
+    stages_[static_cast<size_t>(stage)].record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count());
+}
+
+void LatencyStats::reset() noexcept {
+    for (auto& h : stages_)
+        h.reset();
+}
+
+nlohmann::json LatencyStats::toJson() const {
+    nlohmann::json j = nlohmann::json::object();
+    for (size_t i = 0; i < stages_.size(); ++i)
+        j[ToString(static_cast<LatencyStage>(i))] = stages_[i].toJson();
+    return j;
+}
+
+} // namespace tabxx
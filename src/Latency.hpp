@@ -0,0 +1,89 @@
+#ifndef TABXX_LATENCY_HPP_
+#define TABXX_LATENCY_HPP_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include <json.hpp>
+
+namespace tabxx {
+
+using LatencyClock = std::chrono::steady_clock;
+
+// Log-linear histogram of nanosecond durations, in the spirit of HDR
+// histograms: values below 2^kSubBits are exact, larger ones fall into one of
+// 2^(kSubBits-1) buckets per power of two (under 3.2% error). record() is a
+// couple of relaxed atomic increments, so any thread may call it.
+class LatencyHistogram {
+public:
+    static constexpr int kSubBits = 6;
+    static constexpr int kMaxMagnitude = 45;    // ~9.7 hours, larger values are clamped
+
+    void record(int64_t ns) noexcept;
+    void reset() noexcept;
+
+    uint64_t count() const noexcept { return count_.load(std::memory_order_relaxed); }
+    // Percentile `q` in [0, 100], in nanoseconds.
+    int64_t percentile(double q) const noexcept;
+    nlohmann::json toJson() const;
+
+private:
+    static constexpr int kSub = 1 << kSubBits;
+    static constexpr int kHalf = kSub / 2;
+    static constexpr int kBuckets = kSub + (kMaxMagnitude - kSubBits + 1) * kHalf;
+
+    static int index(uint64_t v) noexcept;
+    // Midpoint of the values falling into bucket `i`.
+    static int64_t value(int i) noexcept;
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_ {};
+    std::atomic<uint64_t> count_ {0};
+    std::atomic<uint64_t> sum_ {0};
+    std::atomic<int64_t> min_ {INT64_MAX};
+    std::atomic<int64_t> max_ {0};
+};
+
+// Stages of an order on its way through the gateway and out to the exchange.
+enum class LatencyStage {
+    PARSE = 0,      // WebSocket message received -> JSON parsed
+    HANDLE,         // parsed -> about to call ReqOrderInsert (validation, risk)
+    REQ_INSERT,     // ReqOrderInsert call
+    CTP_ACK,        // ReqOrderInsert returned -> first OnRtnOrder
+    EXCHANGE_ACK,   // first OnRtnOrder -> OnRtnOrder carrying the OrderSysID
+    FIRST_TRADE,    // exchange accepted -> first OnRtnTrade
+    TO_EXCHANGE,    // WebSocket message received -> exchange accepted
+    COUNT
+};
+
+const char* ToString(LatencyStage stage) noexcept;
+
+// Timestamps of one order, unset ones are default constructed.
+struct OrderTiming {
+    LatencyClock::time_point received;
+    LatencyClock::time_point parsed;
+    LatencyClock::time_point sending;
+    LatencyClock::time_point sent;
+    LatencyClock::time_point ctp_ack;
+    LatencyClock::time_point exchange_ack;
+    LatencyClock::time_point first_trade;
+};
+
+// Stage durations known so far, in microseconds.
+nlohmann::json ToJson(const OrderTiming& t);
+
+// One histogram per stage, shared by every trade session.
+class LatencyStats {
+public:
+    void record(LatencyStage stage, LatencyClock::time_point from, LatencyClock::time_point to) noexcept;
+    void reset() noexcept;
+    nlohmann::json toJson() const;
+
+private:
+    std::array<LatencyHistogram, static_cast<size_t>(LatencyStage::COUNT)> stages_;
+};
+
+} // namespace tabxx
+
+#endif // TABXX_LATENCY_HPP_
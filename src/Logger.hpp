@@ -1,243 +1,739 @@
-#ifndef LOG_HPP_
-#define LOG_HPP_
-
-#include <ctime>
-#include <cstring>
-#include <chrono>
-#include <fstream>
-#include <memory>
-#include <mutex>
-#include <iostream>
-#include <string>
-#include <filesystem>
-#include <queue>
-#include <thread>
-#include <atomic>
-
-namespace tabxx {
-
-inline std::string operator ""_s(const char* s, std::size_t len) {
-    return s;
-}
-
-class Logger {
-protected:
-    struct Message {
-        std::chrono::system_clock::time_point time;
-        int level;
-        std::string scope;
-        std::string text;
-    };
-
-public:
-    Logger(const std::string& default_scope = "default") : 
-        default_scope_(default_scope),
-        wait_time_(100), 
-        worker_stop_(false), 
-        worker_thread_(&Logger::worker, this) {
-    }
-
-    Logger(const std::string& filename, const std::string& default_scope) : Logger(default_scope) {
-        try {
-            std::filesystem::path file_path(filename);
-            std::filesystem::path dir_path = file_path.parent_path();
-            
-            if (!dir_path.empty() && !std::filesystem::exists(dir_path)) {
-                std::filesystem::create_directories(dir_path);
-            }
-            
-            file_ = std::make_shared<std::fstream>(filename, std::ios::app | std::ios::out);
-            if (!file_->is_open() || !file_->good()) {
-                std::cerr << "tabxx::Logger(): failed to open log file: " << filename << std::endl;
-                file_.reset();
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "tabxx::Logger(): failed to create directory or open log file. Exception: " << e.what() << std::endl;
-            try {
-                file_ = std::make_shared<std::fstream>(filename, std::ios::app | std::ios::out);
-                if (!file_->is_open() || !file_->good()) {
-                    file_.reset();
-                }
-            } catch (...) {
-                file_.reset();
-            }
-        }
-    }
-
-    ~Logger() {
-        worker_stop_.store(true);
-        if (worker_thread_.joinable()) 
-            worker_thread_.join();
-        if (file_)
-            file_->close();
-    }
-
-    Logger& info(const std::string& s, const std::string& scope = "") {
-        return this->enqueue(Message{std::chrono::system_clock::now() + std::chrono::hours(8), 0, scope, s});
-    }
-
-    Logger& warn(const std::string& s, const std::string& scope = "") {
-        return this->enqueue(Message{std::chrono::system_clock::now() + std::chrono::hours(8), 1, scope, s});
-    }
-
-    Logger& error(const std::string& s, const std::string& scope = "") {
-        return this->enqueue(Message{std::chrono::system_clock::now() + std::chrono::hours(8), 2, scope, s});
-    }
-
-    Logger& setDefaultScope(const std::string& scope) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        default_scope_ = scope;
-        return *this;
-    }
-
-    Logger& setWaitTime(std::chrono::milliseconds timeout) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        wait_time_ = timeout;
-        return *this;
-    }
-    
-protected:
-    Logger& enqueue(Message&& msg) noexcept {
-        std::lock_guard<std::mutex> lock(mutex_);
-        log_queue_.push(std::move(msg));
-        return *this;
-    }
-
-    void write(const Message& msg) noexcept {
-        try {
-            auto time_t = std::chrono::system_clock::to_time_t(msg.time);
-            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                msg.time.time_since_epoch()) % 1000;
-            
-            std::tm* tm = std::gmtime(&time_t);
-
-            const char* lv;
-            const char* color_start = "";
-            constexpr const char* color_reset = "\033[0m";
-            switch (msg.level) {
-            case 0:
-                lv = "INFO ";
-                color_start = "\033[32m";
-                break;
-            case 1:
-                lv = "WARN ";
-                color_start = "\033[33m";
-                break;
-            case 2:
-                lv = "ERROR";
-                color_start = "\033[31m";
-                break;
-            default:
-                lv = "?   ";
-                color_start = "\033[36m";
-            }
-            
-            char time_buf[64];
-            std::snprintf(time_buf, sizeof(time_buf), "[UTC+8 %04d-%02d-%02d %02d:%02d:%02d.%03ld]", 
-                         tm->tm_year+1900, tm->tm_mon+1, tm->tm_mday,
-                         tm->tm_hour, tm->tm_min, tm->tm_sec, ms.count());
-            
-            const std::string& use_scope = msg.scope.empty() ? default_scope_ : msg.scope;
-            size_t est_size = std::strlen(time_buf) + use_scope.size() + msg.text.size() + 32;
-   
-            std::string console_msg;
-            console_msg.reserve(est_size + 16);
-            console_msg = time_buf;
-            console_msg += " [";
-            console_msg += color_start;
-            console_msg += lv;
-            console_msg += color_reset;
-            console_msg += "] [";
-            console_msg += "\033[90m";
-            console_msg += use_scope;
-            console_msg += color_reset;
-            console_msg += "] ";
-            console_msg += msg.text;
-            console_msg += '\n';
-            
-            std::string file_msg;
-            if (file_) {
-                file_msg.reserve(est_size);
-                file_msg = time_buf;
-                file_msg += " [";
-                file_msg += lv;
-                file_msg += "] [";
-                file_msg += use_scope;
-                file_msg += "] ";
-                file_msg += msg.text;
-                file_msg += '\n'; 
-            }
-
-            std::cout.write(console_msg.c_str(), console_msg.size());
-            std::cout.flush();
-            
-            if (file_ && file_->is_open() && file_->good()) {
-                file_->write(file_msg.c_str(), file_msg.size());
-                file_->flush();
-            }
-        }
-        catch (const std::exception& e) {
-            try {
-                std::cerr << "[Logger Error] Exception in write(): " << e.what() << std::endl;
-            } catch (...) {
-            }
-        }
-        catch(...) {
-            try {
-                std::cerr << "[Logger Error] Unknown exception in write()" << std::endl;
-            } catch (...) {
-            }
-        }
-    }
-
-    void worker() {
-        bool run = true;
-        while (run) {
-            std::unique_lock<std::mutex> lock(mutex_);
-            if (log_queue_.empty()) {
-                lock.unlock();
-                if (worker_stop_.load())
-                    break;
-                std::this_thread::sleep_for(this->wait_time_);
-                continue;
-            }
-            Message msg(log_queue_.front());
-            log_queue_.pop();
-            if (worker_stop_.load())
-                run = false;
-            if (run) {
-                lock.unlock();
-                this->write(msg);
-            }
-            else { // flush remaining logs, keep lock held
-                this->write(msg);
-                while (!log_queue_.empty()) {
-                    Message m(log_queue_.front());
-                    log_queue_.pop();
-                    this->write(m);
-                }
-                lock.unlock();
-                break;
-            }
-        }
-    }
-
-private:
-    std::shared_ptr<std::fstream> file_;
-    std::mutex mutex_;
-    std::string default_scope_;
-    std::queue<Message> log_queue_;
-    std::thread worker_thread_;
-    std::atomic<bool> worker_stop_;
-    std::chrono::milliseconds wait_time_;
-
-}; // class Logger
-
-} // namespace tabxx
-
-
-#ifdef TABXX_USE_STRINGIFY
-using tabxx::operator""_s;
-#endif // TABXX_USE_STRINGIFY
-
-#endif // LOG_HPP_
+#ifndef LOG_HPP_
+#define LOG_HPP_
+
+#include <algorithm>
+#include <ctime>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <filesystem>
+#include <thread>
+#include <atomic>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "MpscRing.hpp"
+
+namespace tabxx {
+
+inline std::string operator ""_s(const char* s, std::size_t len) {
+    return s;
+}
+
+enum class LogLevel : int {
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+// Calls below this level are compiled out. Release builds leave out DEBUG.
+#ifndef TABXX_LOG_FLOOR
+#ifdef NDEBUG
+#define TABXX_LOG_FLOOR 1
+#else
+#define TABXX_LOG_FLOOR 0
+#endif
+#endif
+constexpr LogLevel kLogFloor = static_cast<LogLevel>(TABXX_LOG_FLOOR);
+
+inline const char* LogLevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::DEBUG: return "debug";
+    case LogLevel::INFO: return "info";
+    case LogLevel::WARN: return "warn";
+    case LogLevel::ERROR: return "error";
+    default: return "off";
+    }
+}
+
+inline std::optional<LogLevel> ParseLogLevel(std::string_view name) {
+    for (auto level : {LogLevel::DEBUG, LogLevel::INFO, LogLevel::WARN, LogLevel::ERROR, LogLevel::OFF}) {
+        if (name == LogLevelName(level))
+            return level;
+    }
+    return std::nullopt;
+}
+
+// Messages of one part of the server ("trade", "market-data", ...) and the
+// least level of them that is logged. A scope lives as long as its Logger
+// and never moves, so callers look it up once and keep it.
+class LogScope {
+public:
+    LogScope(const std::string& name, LogLevel level): name_(name), level_(static_cast<int>(level)) {}
+
+    const std::string& name() const noexcept { return name_; }
+
+    LogLevel level() const noexcept {
+        return static_cast<LogLevel>(level_.load(std::memory_order_relaxed));
+    }
+
+    void setLevel(LogLevel level) noexcept {
+        level_.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    bool allows(LogLevel level) const noexcept {
+        return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+    }
+
+private:
+    const std::string name_;
+    std::atomic<int> level_;
+};
+
+// When the worker writes what it has formatted. Output is written in one
+// write() per sink for as many messages as are queued.
+struct LogOptions {
+    // How long output may be held for more to go with it; 0 writes as soon
+    // as the queue is drained.
+    std::chrono::milliseconds flush_interval {0};
+    // Output held beyond this many bytes is written at once.
+    size_t flush_bytes = 64 * 1024;
+    // ERROR messages are always written at once; this also fsyncs the file.
+    bool sync_on_error = true;
+    // ANSI colors on the console. Auto: only when stdout is a terminal.
+    enum class Color { Auto, Always, Never } color = Color::Auto;
+    // Least level logged, of every scope until set otherwise.
+    LogLevel level = LogLevel::INFO;
+    // What a message finds when the queue is full: it is dropped, the
+    // oldest queued one is dropped for it, or, for ERROR only, the caller
+    // waits for room and other messages are dropped.
+    enum class Overflow { DropNew, DropOldest, BlockErrors } overflow = Overflow::BlockErrors;
+    // Dropped messages are counted and reported in a WARN at most this often.
+    std::chrono::seconds drop_report_interval {10};
+};
+
+// Messages dropped by a Logger since it started, by cause.
+struct LogDrops {
+    uint64_t newest;    // found the queue full
+    uint64_t oldest;    // made room for newer ones
+};
+
+// Text of a message logged with its arguments, "{}" standing for each in
+// turn. Defined once and static, it identifies the message; the text is
+// put together by the worker:
+//     static constexpr LogFormat kSent {"Request sent. ReqID: {}; Return: {}"};
+//     logger.info(kSent, "trade", req_id, ret);
+struct LogFormat {
+    const char* text;
+};
+
+// Arguments of a deferred message as they were when it was logged: numbers
+// by value, text copied in, up to kBytes of it altogether and cut beyond.
+// Trivially copyable, so that queueing one allocates nothing.
+class LogArgs {
+public:
+    static constexpr size_t kMax = 8;
+    static constexpr size_t kBytes = 192;
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value
+        && !std::is_same<T, char>::value, int>::type = 0>
+    void add(T value) noexcept {
+        Arg& arg = args_[count_++];
+        if (std::is_signed<T>::value) {
+            arg.type = Type::Int;
+            arg.i = static_cast<int64_t>(value);
+        } else {
+            arg.type = Type::Uint;
+            arg.u = static_cast<uint64_t>(value);
+        }
+    }
+
+    void add(double value) noexcept {
+        Arg& arg = args_[count_++];
+        arg.type = Type::Double;
+        arg.d = value;
+    }
+
+    void add(bool value) noexcept {
+        add(std::string_view(value ? "true" : "false"));
+    }
+
+    void add(char value) noexcept {
+        add(std::string_view(&value, 1));
+    }
+
+    // Also the NUL-terminated char arrays of CTP's fields.
+    void add(const char* value) noexcept {
+        add(std::string_view(value ? value : ""));
+    }
+
+    void add(const std::string& value) noexcept {
+        add(std::string_view(value));
+    }
+
+    void add(std::string_view value) noexcept {
+        Arg& arg = args_[count_++];
+        arg.type = Type::Text;
+        const size_t length = std::min(value.size(), kBytes - used_);
+        std::memcpy(bytes_ + used_, value.data(), length);
+        arg.text = {used_, static_cast<uint16_t>(length)};
+        used_ += static_cast<uint16_t>(length);
+    }
+
+    // Appends argument `i` as text.
+    void append(std::string& out, size_t i) const {
+        if (i >= count_)
+            return;
+        const Arg& arg = args_[i];
+        char buf[32];
+        int n = 0;
+        switch (arg.type) {
+        case Type::Int:
+            n = std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(arg.i));
+            break;
+        case Type::Uint:
+            n = std::snprintf(buf, sizeof(buf), "%llu", static_cast<unsigned long long>(arg.u));
+            break;
+        case Type::Double:
+            n = std::snprintf(buf, sizeof(buf), "%.15g", arg.d);
+            break;
+        case Type::Text:
+            out.append(bytes_ + arg.text.offset, arg.text.length);
+            return;
+        }
+        out.append(buf, static_cast<size_t>(n));
+    }
+
+private:
+    enum class Type : uint8_t { Int, Uint, Double, Text };
+    struct Arg {
+        Type type;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            struct {
+                uint16_t offset;
+                uint16_t length;
+            } text;
+        };
+    };
+
+    Arg args_[kMax];
+    uint8_t count_ = 0;
+    uint16_t used_ = 0;
+    char bytes_[kBytes];
+};
+
+static_assert(std::is_trivially_copyable<LogArgs>::value, "LogArgs is queued by copy");
+
+// Messages are queued by any thread into a bounded lock-free ring and
+// written by a worker thread, which sleeps only while the ring is empty and
+// is woken by the message that ends that.
+class Logger {
+protected:
+    struct Message {
+        std::chrono::system_clock::time_point time;
+        LogLevel level;
+        const LogScope* scope;
+        std::string text;
+        // Deferred messages: `text` is put together from these by the worker.
+        const LogFormat* format = nullptr;
+        LogArgs args;
+    };
+
+public:
+    // Messages the ring holds; beyond that LogOptions::overflow applies.
+    static constexpr size_t kQueueCapacity = 8192;
+    // Times the worker yields, finding the ring empty, before it sleeps.
+    static constexpr int kIdleSpins = 64;
+    // Scopes a Logger keeps; messages of any more go to the default one.
+    static constexpr size_t kMaxScopes = 64;
+
+    Logger(const std::string& default_scope = "default", const LogOptions& options = {}) : 
+        options_(options),
+        color_(useColor(options.color)),
+        level_(static_cast<int>(options.level)),
+        default_scope_(&scope(default_scope)) {
+        start();
+    }
+
+    Logger(const std::string& filename, const std::string& default_scope, const LogOptions& options = {}) : 
+        options_(options),
+        color_(useColor(options.color)),
+        level_(static_cast<int>(options.level)),
+        default_scope_(&scope(default_scope)) {
+        try {
+            std::filesystem::path file_path(filename);
+            std::filesystem::path dir_path = file_path.parent_path();
+            
+            if (!dir_path.empty() && !std::filesystem::exists(dir_path)) {
+                std::filesystem::create_directories(dir_path);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "tabxx::Logger(): failed to create directory for log file. Exception: " << e.what() << std::endl;
+        }
+        file_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (file_ < 0)
+            std::cerr << "tabxx::Logger(): failed to open log file: " << filename << ": " << std::strerror(errno) << std::endl;
+        start();
+    }
+
+    ~Logger() {
+        worker_stop_.store(true);
+        wake();
+        if (worker_thread_.joinable()) 
+            worker_thread_.join();
+        if (file_ >= 0)
+            ::close(file_);
+    }
+
+    // `scope` "" is the default one.
+    Logger& debug(const std::string& s, const std::string& scope = "") {
+        return this->eager<LogLevel::DEBUG>(s, resolve(scope));
+    }
+
+    Logger& info(const std::string& s, const std::string& scope = "") {
+        return this->eager<LogLevel::INFO>(s, resolve(scope));
+    }
+
+    Logger& warn(const std::string& s, const std::string& scope = "") {
+        return this->eager<LogLevel::WARN>(s, resolve(scope));
+    }
+
+    Logger& error(const std::string& s, const std::string& scope = "") {
+        return this->eager<LogLevel::ERROR>(s, resolve(scope));
+    }
+
+    Logger& debug(const std::string& s, const LogScope& scope) {
+        return this->eager<LogLevel::DEBUG>(s, scope);
+    }
+
+    Logger& info(const std::string& s, const LogScope& scope) {
+        return this->eager<LogLevel::INFO>(s, scope);
+    }
+
+    Logger& warn(const std::string& s, const LogScope& scope) {
+        return this->eager<LogLevel::WARN>(s, scope);
+    }
+
+    Logger& error(const std::string& s, const LogScope& scope) {
+        return this->eager<LogLevel::ERROR>(s, scope);
+    }
+
+    // Deferred: only the arguments are captured here.
+    template <typename... Args>
+    Logger& debug(const LogFormat& format, const LogScope& scope, const Args&... args) {
+        return this->deferred<LogLevel::DEBUG>(format, scope, args...);
+    }
+
+    template <typename... Args>
+    Logger& info(const LogFormat& format, const LogScope& scope, const Args&... args) {
+        return this->deferred<LogLevel::INFO>(format, scope, args...);
+    }
+
+    template <typename... Args>
+    Logger& warn(const LogFormat& format, const LogScope& scope, const Args&... args) {
+        return this->deferred<LogLevel::WARN>(format, scope, args...);
+    }
+
+    template <typename... Args>
+    Logger& error(const LogFormat& format, const LogScope& scope, const Args&... args) {
+        return this->deferred<LogLevel::ERROR>(format, scope, args...);
+    }
+
+    // The scope of this name, made at the level of all scopes if it is new.
+    // Finding one takes no lock.
+    LogScope& scope(const std::string& name) {
+        if (LogScope* found = find(name))
+            return *found;
+        std::lock_guard<std::mutex> lock(scope_mutex_);
+        if (LogScope* found = find(name))
+            return *found;
+        const size_t n = scope_count_.load(std::memory_order_relaxed);
+        if (n == kMaxScopes)
+            return *default_scope_.load(std::memory_order_acquire);
+        scopes_[n] = std::make_unique<LogScope>(name, static_cast<LogLevel>(level_.load(std::memory_order_relaxed)));
+        scope_count_.store(n + 1, std::memory_order_release);
+        return *scopes_[n];
+    }
+
+    // The scope of this name if there is one, nullptr otherwise. Takes no
+    // lock.
+    LogScope* find(const std::string& name) const noexcept {
+        const size_t n = scope_count_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i) {
+            if (scopes_[i]->name() == name)
+                return scopes_[i].get();
+        }
+        return nullptr;
+    }
+
+    // Sets the level of every scope, and of those made later.
+    Logger& setLevel(LogLevel level) {
+        std::lock_guard<std::mutex> lock(scope_mutex_);
+        level_.store(static_cast<int>(level), std::memory_order_relaxed);
+        const size_t n = scope_count_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; ++i)
+            scopes_[i]->setLevel(level);
+        return *this;
+    }
+
+    // Name and level of every scope.
+    std::vector<std::pair<std::string, LogLevel>> levels() const {
+        std::vector<std::pair<std::string, LogLevel>> out;
+        const size_t n = scope_count_.load(std::memory_order_acquire);
+        for (size_t i = 0; i < n; ++i)
+            out.emplace_back(scopes_[i]->name(), scopes_[i]->level());
+        return out;
+    }
+
+    Logger& setDefaultScope(const std::string& name) {
+        default_scope_.store(&scope(name), std::memory_order_release);
+        return *this;
+    }
+
+    LogDrops drops() const noexcept {
+        return {dropped_newest_.load(std::memory_order_relaxed), dropped_oldest_.load(std::memory_order_relaxed)};
+    }
+    
+protected:
+    // Never waits but for an ERROR under Overflow::BlockErrors.
+    Logger& enqueue(Message&& msg) noexcept {
+        while (!queue_.push(std::move(msg))) {
+            wake();
+            const bool block = options_.overflow == LogOptions::Overflow::BlockErrors
+                && msg.level >= LogLevel::ERROR;
+            if (options_.overflow == LogOptions::Overflow::DropOldest) {
+                Message oldest;
+                if (queue_.pop(oldest))
+                    dropped_oldest_.fetch_add(1, std::memory_order_relaxed);
+            }
+            else if (block) {
+                std::this_thread::yield();
+            }
+            else {
+                dropped_newest_.fetch_add(1, std::memory_order_relaxed);
+                return *this;
+            }
+        }
+        // Pairs with the fence in worker(): either it sees the message
+        // before going to sleep, or we see it asleep.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleeping_.load(std::memory_order_relaxed))
+            wake();
+        return *this;
+    }
+
+    const LogScope& resolve(const std::string& name) {
+        return name.empty() ? *default_scope_.load(std::memory_order_acquire) : scope(name);
+    }
+
+    template <LogLevel L>
+    Logger& eager(const std::string& s, const LogScope& scope) {
+        if constexpr (L >= kLogFloor) {
+            if (!scope.allows(L))
+                return *this;
+            Message msg;
+            msg.time = std::chrono::system_clock::now() + std::chrono::hours(8);
+            msg.level = L;
+            msg.scope = &scope;
+            msg.text = s;
+            return this->enqueue(std::move(msg));
+        }
+        return *this;
+    }
+
+    template <LogLevel L, typename... Args>
+    Logger& deferred(const LogFormat& format, const LogScope& scope, const Args&... args) {
+        static_assert(sizeof...(Args) <= LogArgs::kMax, "too many arguments for a deferred message");
+        if constexpr (L >= kLogFloor) {
+            if (!scope.allows(L))
+                return *this;
+            Message msg;
+            msg.time = std::chrono::system_clock::now() + std::chrono::hours(8);
+            msg.level = L;
+            msg.scope = &scope;
+            msg.format = &format;
+            (msg.args.add(args), ...);
+            return this->enqueue(std::move(msg));
+        }
+        return *this;
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lock(wake_mutex_);
+        wakeup_.notify_one();
+    }
+
+    static bool useColor(LogOptions::Color color) {
+        if (color == LogOptions::Color::Auto)
+            return ::isatty(STDOUT_FILENO) == 1;
+        return color == LogOptions::Color::Always;
+    }
+
+    // Appends the message to the output held for the console, and for the
+    // file when that differs (colors).
+    void format(const Message& msg) noexcept {
+        try {
+            const char* lv;
+            const char* color_start = "";
+            switch (msg.level) {
+            case LogLevel::DEBUG:
+                lv = "DEBUG";
+                color_start = "\033[90m";
+                break;
+            case LogLevel::INFO:
+                lv = "INFO ";
+                color_start = "\033[32m";
+                break;
+            case LogLevel::WARN:
+                lv = "WARN ";
+                color_start = "\033[33m";
+                break;
+            case LogLevel::ERROR:
+                lv = "ERROR";
+                color_start = "\033[31m";
+                break;
+            default:
+                lv = "?   ";
+                color_start = "\033[36m";
+            }
+            
+            const char* time_buf = timestamp(msg.time);
+
+            const std::string& use_scope = msg.scope->name();
+            const std::string& text = msg.format ? render(*msg.format, msg.args) : msg.text;
+
+            auto plain = [&] (std::string& out) {
+                out += time_buf;
+                out += " [";
+                out += lv;
+                out += "] [";
+                out += use_scope;
+                out += "] ";
+                out += text;
+                out += '\n';
+            };
+            if (!color_) {
+                plain(console_out_);
+                return;
+            }
+            constexpr const char* color_reset = "\033[0m";
+            console_out_ += time_buf;
+            console_out_ += " [";
+            console_out_ += color_start;
+            console_out_ += lv;
+            console_out_ += color_reset;
+            console_out_ += "] [";
+            console_out_ += "\033[90m";
+            console_out_ += use_scope;
+            console_out_ += color_reset;
+            console_out_ += "] ";
+            console_out_ += text;
+            console_out_ += '\n';
+            if (file_ >= 0)
+                plain(file_out_);
+        }
+        catch (const std::exception& e) {
+            try {
+                std::cerr << "[Logger Error] Exception in format(): " << e.what() << std::endl;
+            } catch (...) {
+            }
+        }
+        catch(...) {
+            try {
+                std::cerr << "[Logger Error] Unknown exception in format()" << std::endl;
+            } catch (...) {
+            }
+        }
+    }
+
+    // "[UTC+8 YYYY-MM-DD HH:MM:SS.mmm]", the date and time rendered once a
+    // second.
+    const char* timestamp(std::chrono::system_clock::time_point time) noexcept {
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        const std::time_t second = static_cast<std::time_t>(ms / 1000);
+        if (second != stamp_second_) {
+            std::tm tm;
+            gmtime_r(&second, &tm);
+            std::snprintf(stamp_, sizeof(stamp_), "[UTC+8 %04d-%02d-%02d %02d:%02d:%02d.000]",
+                          tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday,
+                          tm.tm_hour, tm.tm_min, tm.tm_sec);
+            stamp_second_ = second;
+        }
+        // The milliseconds, in the "000]" the prefix ends with.
+        const int millis = static_cast<int>(ms % 1000);
+        char* digits = stamp_ + std::strlen(stamp_) - 4;
+        digits[0] = static_cast<char>('0' + millis / 100);
+        digits[1] = static_cast<char>('0' + millis / 10 % 10);
+        digits[2] = static_cast<char>('0' + millis % 10);
+        return stamp_;
+    }
+
+    const std::string& render(const LogFormat& format, const LogArgs& args) {
+        text_.clear();
+        size_t next = 0;
+        const char* p = format.text;
+        while (const char* slot = std::strstr(p, "{}")) {
+            text_.append(p, static_cast<size_t>(slot - p));
+            args.append(text_, next++);
+            p = slot + 2;
+        }
+        text_ += p;
+        return text_;
+    }
+
+    size_t held() const noexcept {
+        return console_out_.size() + file_out_.size();
+    }
+
+    // Writes out everything held, one write() per sink unless it is short.
+    void flush(bool sync) noexcept {
+        writeAll(STDOUT_FILENO, console_out_);
+        if (file_ >= 0) {
+            writeAll(file_, color_ ? file_out_ : console_out_);
+            if (sync)
+                ::fsync(file_);
+        }
+        console_out_.clear();
+        file_out_.clear();
+    }
+
+    static void writeAll(int fd, const std::string& s) noexcept {
+        const char* p = s.data();
+        size_t left = s.size();
+        while (left > 0) {
+            const ssize_t n = ::write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            p += n;
+            left -= static_cast<size_t>(n);
+        }
+    }
+
+    // Started last, once everything it reads is set up.
+    void start() {
+        worker_thread_ = std::thread(&Logger::worker, this);
+    }
+
+    uint64_t dropped() const noexcept {
+        const auto d = drops();
+        return d.newest + d.oldest;
+    }
+
+    // Adds a WARN with the messages dropped since the last one, if there
+    // are any and the report interval is over or `now` is forced.
+    void reportDrops(std::chrono::steady_clock::time_point now, bool force) {
+        const auto d = drops();
+        const uint64_t total = d.newest + d.oldest;
+        if (total == drops_reported_ || (!force && now < next_drop_report_))
+            return;
+        Message msg;
+        msg.time = std::chrono::system_clock::now() + std::chrono::hours(8);
+        msg.level = LogLevel::WARN;
+        msg.scope = default_scope_.load(std::memory_order_acquire);
+        msg.text = "Log queue full, dropped " + std::to_string(total - drops_reported_)
+            + " message(s) since the last report; " + std::to_string(d.newest) + " new and "
+            + std::to_string(d.oldest) + " oldest in all";
+        format(msg);
+        drops_reported_ = total;
+        next_drop_report_ = now + options_.drop_report_interval;
+    }
+
+    void worker() {
+        using Clock = std::chrono::steady_clock;
+        Message msg;
+        Clock::time_point held_since;
+        for (;;) {
+            bool error = false;
+            while (held() < options_.flush_bytes && queue_.pop(msg)) {
+                if (held() == 0)
+                    held_since = Clock::now();
+                format(msg);
+                error |= msg.level >= LogLevel::ERROR;
+            }
+            // Stop before empty: what was queued before the stop is seen.
+            const bool stop = worker_stop_.load();
+            const bool drained = queue_.empty();
+            if (held() == 0)
+                held_since = Clock::now();
+            reportDrops(Clock::now(), stop && drained);
+            if (held() > 0 && (error || stop || !drained
+                    || Clock::now() - held_since >= options_.flush_interval))
+                flush(error && options_.sync_on_error);
+            if (!drained)
+                continue;
+            if (stop)
+                break;
+            // Messages often come in bursts the worker outpaces: give the
+            // producers a few turns before paying for a sleep and a wakeup.
+            bool idle = true;
+            for (int i = 0; i < kIdleSpins && idle; ++i) {
+                std::this_thread::yield();
+                idle = queue_.empty() && !worker_stop_.load();
+            }
+            if (!idle)
+                continue;
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto ready = [this] { return !queue_.empty() || worker_stop_.load(); };
+            // Held output, and drops not reported yet, set a time to wake.
+            auto deadline = Clock::time_point::max();
+            if (held() > 0)
+                deadline = held_since + options_.flush_interval;
+            if (dropped() != drops_reported_)
+                deadline = std::min(deadline, next_drop_report_);
+            if (deadline == Clock::time_point::max())
+                wakeup_.wait(lock, ready);
+            else
+                wakeup_.wait_until(lock, deadline, ready);
+            sleeping_.store(false, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    const LogOptions options_;
+    const bool color_;
+    int file_ = -1;
+    std::mutex scope_mutex_;        // making scopes and setting all levels
+    std::unique_ptr<LogScope> scopes_[kMaxScopes];
+    std::atomic<size_t> scope_count_ {0};
+    std::atomic<int> level_;        // of scopes made from now on
+    std::atomic<LogScope*> default_scope_;
+    MpscRing<Message> queue_ {kQueueCapacity};
+    // Formatted, not yet written; worker only. Without colors both sinks
+    // get console_out_.
+    std::string console_out_;
+    std::string file_out_;
+    std::string text_;              // deferred message being rendered
+    std::time_t stamp_second_ = -1;
+    char stamp_[48];
+    std::atomic<uint64_t> dropped_newest_ {0};
+    std::atomic<uint64_t> dropped_oldest_ {0};
+    uint64_t drops_reported_ = 0;   // worker only
+    std::chrono::steady_clock::time_point next_drop_report_;
+    std::atomic<bool> worker_stop_ {false};
+    std::atomic<bool> sleeping_ {false};
+    std::mutex wake_mutex_;
+    std::condition_variable wakeup_;
+    std::thread worker_thread_;     // last: the worker uses all of the above
+
+}; // class Logger
+
+} // namespace tabxx
+
+
+#ifdef TABXX_USE_STRINGIFY
+using tabxx::operator""_s;
+#endif // TABXX_USE_STRINGIFY
+
+#endif // LOG_HPP_
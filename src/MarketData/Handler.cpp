@@ -4,6 +4,11 @@ namespace tabxx {
 
 
 void MarketDataHandler::OnRspError(CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
+    if (nRequestID < 0 && nRequestID == restore_req_) {
+        const string msg = pRspInfo ? u8(pRspInfo->ErrorMsg) : "error response";
+        post([this, msg] () { onRestoreLogin(false, msg); });
+        return;
+    }
     send(MDMsgCode::ERROR, pRspInfo,
         {
             {"req_id", nRequestID},
@@ -13,17 +18,92 @@ void MarketDataHandler::OnRspError(CThostFtdcRspInfoField *pRspInfo, int nReques
 }
 
 void MarketDataHandler::OnFrontConnected() {
+    if (restore_wanted_) {
+        // CTP reconnected by itself; log in and resubscribe without the
+        // client, which hears about it once the session is restored.
+        restoring_ = true;
+        post([this] () {
+            restore_backoff_.reset();
+            restore_timer_.once(restore_backoff_.next(), [this] () { restoreLogin(); });
+        });
+        return;
+    }
     send(MDMsgCode::CONNECTED, {}, {});
 }
 
 void MarketDataHandler::OnFrontDisconnected(int reason) {
+    post([this] () {
+        restore_timer_.stop();
+        restore_req_ = 0;
+    });
     send(MDMsgCode::DISCONNECTED, {},
         {
-            {"reason", reason}
+            {"reason", reason},
+            {"restoring", restore_wanted_.load()}
         }
     );
 }
 
+void MarketDataHandler::restoreLogin() {
+    if (!restoring_)
+        return;
+    int req_id = restore_next_req_--;
+    restore_req_ = req_id;
+    auto ret = reqUserLogin(req_id);
+    info("Restoring session, sent login request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
+    if (ret != 0)
+        retryRestore("login request could not be sent (" + std::to_string(ret) + ")");
+}
+
+void MarketDataHandler::onRestoreLogin(bool ok, const string& msg) {
+    if (!restoring_)
+        return;
+    restore_req_ = 0;
+    if (!ok) {
+        retryRestore(msg);
+        return;
+    }
+    std::vector<char*> mem;
+    for (const auto& i : subscriptions_)
+        mem.push_back(const_cast<char*>(i.c_str()));
+    auto ret = mem.empty() ? 0 : api_->SubscribeMarketData(mem.data(), static_cast<int>(mem.size()));
+    restoring_ = false;
+    info("Session restored after "_s + std::to_string(restore_backoff_.attempts()) + " attempt(s), resubscribed "
+        + std::to_string(mem.size()) + " instruments. Return: " + std::to_string(ret));
+    send(MDMsgCode::RESTORED, json {
+            {"code", ret},
+            {"msg", ""}
+        },
+        json {
+            {"trading_day", api_->GetTradingDay()},
+            {"subscriptions", subscriptions_},
+            {"attempts", restore_backoff_.attempts()}
+        }
+    );
+    restore_backoff_.reset();
+}
+
+void MarketDataHandler::retryRestore(const string& msg) {
+    if (restore_backoff_.attempts() >= kRestoreAttempts) {
+        restoring_ = false;
+        restore_wanted_ = false;
+        error("Session restore given up: "_s + msg);
+        send(MDMsgCode::RESTORED, json {
+                {"code", -1},
+                {"msg", msg}
+            },
+            json {
+                {"attempts", restore_backoff_.attempts()}
+            }
+        );
+        restore_backoff_.reset();
+        return;
+    }
+    const int ms = restore_backoff_.next();
+    warn("Session restore failed: "_s + msg + "; Retrying in " + std::to_string(ms) + "ms");
+    restore_timer_.once(ms, [this] () { restoreLogin(); });
+}
+
 void MarketDataHandler::OnHeartBeatWarning(int time) {
     send(MDMsgCode::HEARTBEAT_TIMEOUT, {}, 
         {
@@ -35,6 +115,14 @@ void MarketDataHandler::OnHeartBeatWarning(int time) {
 void MarketDataHandler::OnRspUserLogin(
     CThostFtdcRspUserLoginField *pRspUserLogin, 
     CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
+    const bool ok = pRspUserLogin && (!pRspInfo || pRspInfo->ErrorID == 0);
+    if (ok)
+        restore_wanted_ = true;
+    if (nRequestID < 0 && nRequestID == restore_req_) {
+        const string msg = ok ? "" : "login failed: " + (pRspInfo ? u8(pRspInfo->ErrorMsg) : "no response");
+        post([this, ok, msg] () { onRestoreLogin(ok, msg); });
+        return;
+    }
     send(MDMsgCode::LOGIN, pRspInfo,
         pRspUserLogin? json {
             {"msg", "Login success"},
@@ -116,6 +204,11 @@ void MarketDataHandler::OnRspUnSubMarketData(
 
 
 void MarketDataHandler::OnRtnDepthMarketData(CThostFtdcDepthMarketDataField *pDepthMarketData) {
+    if (pDepthMarketData && state_) {
+        const auto received = LatencyClock::now();
+        state_->ticks.update(*pDepthMarketData);
+        state_->triggers.onTick(*pDepthMarketData, received);
+    }
     send(MDMsgCode::MARKET_DATA, {},
         pDepthMarketData? json {
             {"trading_day", pDepthMarketData->TradingDay},
@@ -3,6 +3,8 @@
 
 #include <atomic>
 #include <cstring>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -11,17 +13,22 @@
 #include <json.hpp>
 
 #include "MessageCode.hpp"
+#include "../Backoff.hpp"
+#include "../Correlation.hpp"
+#include "../Timer.hpp"
 #include "../Types.hpp"
 #include "../Logger.hpp"
 #include "../Encoding.hpp"
+#include "../SharedState.hpp"
 
 namespace tabxx {
 class MarketDataHandler final: public CThostFtdcMdSpi {
     using string = std::string;
 public:
-    MarketDataHandler(WebSocket* ws, uWS::Loop* loop, Logger* logger, const string& flow):
+    MarketDataHandler(WebSocket* ws, uWS::Loop* loop, Logger* logger, const string& flow, SharedState* state):
         api_(CThostFtdcMdApi::CreateFtdcMdApi(flow.c_str())), 
-        ws_(ws), loop_(loop), logger_(logger), req_id_(1) {
+        ws_(ws), wire_(ws ? ws->getUserData()->wire : Wire::JSON),
+        loop_(loop), logger_(logger), log_scope_(logger ? &logger->scope("market-data") : nullptr), state_(state), req_id_(1), restore_timer_(loop) {
         api_->RegisterSpi(this);
     }
 
@@ -32,6 +39,12 @@ public:
 
     void OnRspError(CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
 
+    // Client correlation id of the message being handled, null if none; it
+    // is echoed in every reply to the requests the message makes.
+    inline void correlate(json cid) {
+        cids_.handle(std::move(cid));
+    }
+
     void connect(const std::string& addr, const std::string& port) {
         string front = "tcp://" + addr + ":" + port;
         info("Client attempting to connect to Market Data front: "_s + front);
@@ -43,14 +56,16 @@ public:
     void OnFrontDisconnected(int reason) override;
     void OnHeartBeatWarning(int time) override;
 
+    // Failed logins of a session restore are retried this many times.
+    static constexpr int kRestoreAttempts = 10;
+
     void login(const std::string& broker_id, const std::string& user_id, const std::string& password) {
-        CThostFtdcReqUserLoginField f;
-        clear(&f);
-        copy(f.BrokerID, broker_id);
-        copy(f.UserID, user_id);
-        copy(f.Password, password);
+        // Replayed when the front reconnects.
+        broker_id_ = broker_id;
+        user_id_ = user_id;
+        password_ = password;
         int req_id = req_id_++;
-        auto ret = api_->ReqUserLogin(&f, req_id);
+        auto ret = reqUserLogin(req_id);
         info("Sent login request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
         performed(req_id, ret);
     }
@@ -84,8 +99,11 @@ public:
             mem.emplace_back(i.c_str());
         }
         auto ret = api_->SubscribeMarketData((char**)mem.data(), mem.size());
+        if (ret == 0)
+            subscriptions_.insert(instruments.begin(), instruments.end());
         auto req = req_id_++;
-        info("Client subscribed to Market Data for "_s + std::to_string(instruments.size()) + " instruments. ReqID: " + std::to_string(req) + "; Return: "_s + std::to_string(ret));
+        static constexpr LogFormat kSubscribed {"Client subscribed to Market Data for {} instruments. ReqID: {}; Return: {}"};
+        info(kSubscribed, instruments.size(), req, ret);
         performed(req, ret);
     }
     void OnRspSubMarketData(
@@ -99,8 +117,13 @@ public:
             mem.emplace_back(i.c_str());
         }
         auto ret = api_->UnSubscribeMarketData((char**)mem.data(), mem.size());
+        if (ret == 0) {
+            for (const auto& i : instruments)
+                subscriptions_.erase(i);
+        }
         auto req = req_id_++;
-        info("Client unsubscribed from Market Data for "_s + std::to_string(instruments.size()) + " instruments. ReqID: " + std::to_string(req) + "; Return: "_s + std::to_string(ret));
+        static constexpr LogFormat kUnsubscribed {"Client unsubscribed from Market Data for {} instruments. ReqID: {}; Return: {}"};
+        info(kUnsubscribed, instruments.size(), req, ret);
         performed(req, ret);
     }
     void OnRspUnSubMarketData(
@@ -108,6 +131,30 @@ public:
         CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
     
 private:
+    int reqUserLogin(int req_id) {
+        CThostFtdcReqUserLoginField f;
+        clear(&f);
+        copy(f.BrokerID, broker_id_);
+        copy(f.UserID, user_id_);
+        copy(f.Password, password_);
+        return api_->ReqUserLogin(&f, req_id);
+    }
+
+    // Session restore after the front reconnected, loop thread only: login
+    // again and resubscribe what the client had subscribed.
+    void restoreLogin();
+    void onRestoreLogin(bool ok, const string& msg);
+    void retryRestore(const string& msg);
+
+    // Runs `f` on the loop thread unless this handler is gone by then.
+    template <typename F>
+    inline void post(F&& f) {
+        loop_->defer([alive=std::weak_ptr<int>(alive_), f=std::forward<F>(f)] () {
+            if (alive.lock())
+                f();
+        });
+    }
+
     template <typename T>
     inline void clear(T* mem) noexcept {
         std::memset(mem, 0, sizeof(T));
@@ -125,31 +172,72 @@ private:
 
     inline void info(const string& s) {
         if (logger_) {
-            logger_->info(s, "market-data");
+            logger_->info(s, *log_scope_);
         }
     }
 
     inline void warn(const string& s) {
         if (logger_) {
-            logger_->warn(s, "market-data");
+            logger_->warn(s, *log_scope_);
         }
     }
 
     inline void error(const string& s) {
         if (logger_) {
-            logger_->error(s, "market-data");
+            logger_->error(s, *log_scope_);
+        }
+    }
+
+    // Deferred: the message is put together by the logger's worker.
+    template <typename... Args>
+    inline void debug(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->debug(format, *log_scope_, args...);
+        }
+    }
+
+    template <typename... Args>
+    inline void info(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->info(format, *log_scope_, args...);
+        }
+    }
+
+    template <typename... Args>
+    inline void warn(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->warn(format, *log_scope_, args...);
+        }
+    }
+
+    template <typename... Args>
+    inline void error(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->error(format, *log_scope_, args...);
         }
     }
 
+    // Client requests are all acknowledged on the loop thread.
     inline void performed(int req_id, int err) {
-        send(MDMsgCode::PERFORMED, {{"code", err}}, {{"req_id", req_id}});
+        json info {{"req_id", req_id}};
+        if (!cids_.current().is_null()) {
+            cids_.bind(req_id);
+            info["cid"] = cids_.current();
+        }
+        send(MDMsgCode::PERFORMED, {{"code", err}}, info);
     }
 
     inline void send(json&& data) {
         if (ws_) {
+            // Ticks answer no request, and are too many to look at.
+            if (!cids_.empty() && data.value("msg", 0) != static_cast<int>(MDMsgCode::MARKET_DATA)) {
+                auto info = data.find("info");
+                if (info != data.end() && info->is_object())
+                    cids_.tag(data, info->value("req_id", 0));
+            }
             try {
-                loop_->defer([d=std::move(data), ws=ws_] () {
-                    ws->send(d.dump(), uWS::OpCode::TEXT);
+                loop_->defer([d=std::move(data), ws=ws_, wire=wire_] () {
+                    ws->send(Encode(d, wire), OpCodeOf(wire));
                 });
             } catch (const std::exception& e) {
                 logger_->error("tabxx::TraderHandler::send(): Exception caught. what(): "_s + e.what());
@@ -179,9 +267,25 @@ private:
 private:
     CThostFtdcMdApi* api_;
     WebSocket* ws_;
+    Wire wire_;
     uWS::Loop* loop_;
     Logger* logger_;
+    const LogScope* log_scope_;
+    SharedState* state_;
     std::atomic<int> req_id_;
+    Correlation cids_;
+    // Loop thread only.
+    string broker_id_;
+    string user_id_;
+    string password_;
+    std::set<string> subscriptions_;
+    Backoff restore_backoff_ {500, 30000};
+    std::atomic<bool> restore_wanted_ {false};  // logged in before the front dropped
+    std::atomic<bool> restoring_ {false};
+    std::atomic<int> restore_req_ {0};
+    int restore_next_req_ = -1;                 // restore logins count down, never clash with clients
+    std::shared_ptr<int> alive_ = std::make_shared<int>(0);
+    Timer restore_timer_;
 
 }; // class MarketDataHandler
 
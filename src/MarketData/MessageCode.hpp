@@ -14,7 +14,8 @@ enum class MDMsgCode {
     TRADING_DAY = 7,
     SUBSCRIBE = 8,
     UNSUBSCRIBE = 9,
-    MARKET_DATA = 10
+    MARKET_DATA = 10,
+    RESTORED = 11
 };
 
 } // namespace tabxx
@@ -0,0 +1,77 @@
+#ifndef TABXX_MARKET_DATA_TICK_STORE_HPP_
+#define TABXX_MARKET_DATA_TICK_STORE_HPP_
+
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ThostFtdcMdApi.h>
+
+namespace tabxx {
+
+// Latest top-of-book snapshot of an instrument.
+struct Tick {
+    double last_price = 0;
+    double bid_price = 0;
+    double ask_price = 0;
+    double upper_limit_price = 0;
+    double lower_limit_price = 0;
+    double pre_settlement_price = 0;
+    int bid_volume = 0;
+    int ask_volume = 0;
+    int volume = 0;
+    bool valid = false;
+};
+
+// Process-wide cache of the latest tick per instrument, written by every
+// MarketDataHandler and read by trade sessions (valuation, risk, triggers).
+class TickStore {
+    using string = std::string;
+public:
+    void update(const CThostFtdcDepthMarketDataField& f) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto& t = ticks_[slot(f.InstrumentID)];
+        t.last_price = f.LastPrice;
+        t.bid_price = f.BidPrice1;
+        t.ask_price = f.AskPrice1;
+        t.bid_volume = f.BidVolume1;
+        t.ask_volume = f.AskVolume1;
+        t.upper_limit_price = f.UpperLimitPrice;
+        t.lower_limit_price = f.LowerLimitPrice;
+        t.pre_settlement_price = f.PreSettlementPrice;
+        t.volume = f.Volume;
+        t.valid = true;
+    }
+
+    bool get(const string& instrument, Tick& out) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = index_.find(instrument);
+        if (it == index_.end() || !ticks_[it->second].valid)
+            return false;
+        out = ticks_[it->second];
+        return true;
+    }
+
+private:
+    // Requires the exclusive lock.
+    size_t slot(const string& instrument) {
+        auto it = index_.find(instrument);
+        if (it != index_.end())
+            return it->second;
+        index_.emplace(instrument, ticks_.size());
+        ticks_.emplace_back();
+        return ticks_.size() - 1;
+    }
+
+private:
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<string, size_t> index_;
+    std::vector<Tick> ticks_;
+
+}; // class TickStore
+
+} // namespace tabxx
+
+#endif // TABXX_MARKET_DATA_TICK_STORE_HPP_
@@ -1,7 +1,11 @@
-#include <functional>
-#include <unordered_map>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <tuple>
 
 #include "MessageHandler.hpp"
+#include "Request.hpp"
 
 namespace tabxx {
 
@@ -10,315 +14,765 @@ using cjr = const json&;
 using mdr = MarketDataHandler&;
 using thr = TraderHandler&;
 
-const std::unordered_map<std::string, std::function<std::string(cjr, mdr)>> map_md {
-    {"connect", [](cjr j, mdr md) {
-        if (!j.contains("addr"))
-            return "Error: Field \"addr\" not found.";
-        if (!j["addr"].is_string())
-            return "Error: Field \"addr\" type error (expected string).";
-        if (!j.contains("port"))
-            return "Error: Field \"port\" not found.";
-        if (!j["port"].is_string())
-            return "Error: Field \"port\" type error (expected string).";
-        md.connect(string(j["addr"]), string(j["port"]));
-        return "";
-    }},
-    {"login", [](cjr j, mdr md) {
-        if (!j.contains("broker_id"))
-            return "Error: Field \"broker_id\" not found.";
-        if (!j["broker_id"].is_string())
-            return "Error: Field \"broker_id\" type error (expected string).";
-        if (!j.contains("user_id"))
-            return "Error: Field \"user_id\" not found.";
-        if (!j["user_id"].is_string())
-            return "Error: Field \"user_id\" type error (expected string).";
-        if (!j.contains("password"))
-            return "Error: Field \"password\" not found.";
-        if (!j["password"].is_string())
-            return "Error: Field \"password\" type error (expected string).";
-        md.login(string(j["broker_id"]).c_str(), string(j["user_id"]).c_str(), string(j["password"]).c_str());
-        return "";
-    }},
-    {"logout", [](cjr j, mdr md) {
-        // if (!j.contains("broker_id"))
-        //     return "Error: Field \"broker_id\" not found.";
-        // if (!j["broker_id"].is_string())
-        //     return "Error: Field \"broker_id\" type error (expected string).";
-        // if (!j.contains("user_id"))
-        //     return "Error: Field \"user_id\" not found.";
-        // if (!j["user_id"].is_string())
-        //     return "Error: Field \"user_id\" type error (expected string).";
-        // md.logout(j["user_id"], j["broker_id"]);
+namespace {
+
+// Kept with every request it is bound to.
+constexpr size_t kMaxCidLength = 64;
+
+template <typename J>
+string Cid(const J& msg, json& cid) {
+    cid = nullptr;
+    const auto v = request::Member(msg, "cid");
+    if (!v)
+        return "";
+    if (v->is_number_integer()) {
+        cid = v->template get<int64_t>();
+        return "";
+    }
+    if (!v->is_string())
+        return "Error: Field `cid` type error (expected string or integer).";
+    auto s = v->template get<string>();
+    if (s.size() > kMaxCidLength)
+        return "Error: Field `cid` too long (at most " + std::to_string(kMaxCidLength) + " bytes).";
+    cid = std::move(s);
+    return "";
+}
+
+} // namespace
+
+string ReadCid(cjr msg, json& cid) {
+    return Cid(msg, cid);
+}
+
+string ReadCid(const JsonValue& msg, json& cid) {
+    return Cid(msg, cid);
+}
+
+namespace md {
+
+struct Connect {
+    static constexpr std::string_view kOp = "connect";
+    string addr;
+    string port;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("addr", &Connect::addr),
+            Required("port", &Connect::port));
+    }
+    string run(mdr md) const {
+        md.connect(addr, port);
+        return "";
+    }
+};
+
+struct Login {
+    static constexpr std::string_view kOp = "login";
+    string broker_id;
+    string user_id;
+    string password;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("broker_id", &Login::broker_id),
+            Required("user_id", &Login::user_id),
+            Required("password", &Login::password));
+    }
+    string run(mdr md) const {
+        md.login(broker_id, user_id, password);
+        return "";
+    }
+};
+
+struct Logout {
+    static constexpr std::string_view kOp = "logout";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(mdr md) const {
+        // md.logout(user_id, broker_id);
         return "Unsupported method";
-    }},
-    {"subscribe", [](cjr j, mdr md) {
-        if (!j.contains("instruments"))
-            return "Error: Field \"instruments\" not found.";
-        if (!j["instruments"].is_array())
-            return "Error: \"instruments\" is not an array.";
-        md.subscribe(j["instruments"]);
-        return "";
-    }},
-    {"unsubscribe", [](cjr j, mdr md) {
-        if (!j.contains("instruments"))
-            return "Error: Field \"instruments\" not found.";
-        if (!j["instruments"].is_array())
-            return "Error: \"instruments\" is not an array.";
-        md.unsubscribe(j["instruments"]);
-        return "";
-    }},
-    {"get_trading_day", [](cjr j, mdr md){
+    }
+};
+
+struct Subscribe {
+    static constexpr std::string_view kOp = "subscribe";
+    std::vector<string> instruments;
+    static constexpr auto fields() {
+        return std::make_tuple(Required("instruments", &Subscribe::instruments));
+    }
+    string run(mdr md) const {
+        md.subscribe(instruments);
+        return "";
+    }
+};
+
+struct Unsubscribe {
+    static constexpr std::string_view kOp = "unsubscribe";
+    std::vector<string> instruments;
+    static constexpr auto fields() {
+        return std::make_tuple(Required("instruments", &Unsubscribe::instruments));
+    }
+    string run(mdr md) const {
+        md.unsubscribe(instruments);
+        return "";
+    }
+};
+
+struct GetTradingDay {
+    static constexpr std::string_view kOp = "get_trading_day";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(mdr md) const {
         md.getTradingDay();
         return "";
-    }}
+    }
 };
 
-string HandleMarketDataMessage(cjr j, mdr md) {
-    if (!j.contains("op"))
+#define TABXX_OP(R) case OpHash(R::kOp): return MatchOp<R, MarketDataHandler, J>(op)
+
+template <typename J>
+OpRunner<MarketDataHandler, J> Find(std::string_view op) {
+    switch (OpHash(op)) {
+    TABXX_OP(Connect);
+    TABXX_OP(Login);
+    TABXX_OP(Logout);
+    TABXX_OP(Subscribe);
+    TABXX_OP(Unsubscribe);
+    TABXX_OP(GetTradingDay);
+    default: return nullptr;
+    }
+}
+
+#undef TABXX_OP
+
+template <typename J>
+string Handle(const J& j, mdr md) {
+    const auto op = request::Member(j, "op");
+    if (!op)
         return "Error: Field `op` not found.";
-    string operation = j["op"];
-    if (map_md.find(operation) == map_md.end())
+    const string operation = op->template get<string>();
+    auto run = Find<J>(operation);
+    if (!run)
         return "Error: Unknown op `" + operation + "`.";
-    if (!j.contains("data"))
+    const auto data = request::Member(j, "data");
+    if (!data)
         return "Error: Field `data` not found.";
-    if (!j["data"].is_object())
+    if (!data->is_object())
         return "Error: Field `data` type error (expected object).";
-    return map_md.at(operation)(j["data"], md);
+    return run(*data, md);
 }
 
-const std::unordered_map<std::string, std::function<std::string(cjr, thr)>> map_trader {
-    {"connect", [](cjr j, thr t) {
-        if (!j.contains("addr"))
-            return "Error: Field \"addr\" not found.";
-        if (!j["addr"].is_string())
-            return "Error: Field \"addr\" type error (expected string).";
-        if (!j.contains("port"))
-            return "Error: Field \"port\" not found.";
-        if (!j["port"].is_string())
-            return "Error: Field \"port\" type error (expected string).";
-        t.connect(j["addr"], j["port"]);
-        return "";
-    }},
-    {"get_trading_day", [](cjr j, thr t) {
+} // namespace md
+
+string HandleMarketDataMessage(cjr j, mdr md) {
+    return md::Handle(j, md);
+}
+
+string HandleMarketDataMessage(const JsonValue& j, mdr md) {
+    return md::Handle(j, md);
+}
+
+namespace trade {
+
+// Fields of an order shared by insert_order, insert_conditional and
+// start_algo.
+struct OrderFields {
+    string instrument;
+    string exchange;
+    double price = 0;
+    Direction direction = Direction::BUY;
+    OrderOffset offset = OrderOffset::OPEN;
+    int volume = 0;
+    OrderPriceType price_type = OrderPriceType::LIMITED;
+    TimeCondition time_condition = TimeCondition::ONE_DAY;
+    string memo;
+    string tag;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("instrument", &OrderFields::instrument),
+            Required("exchange", &OrderFields::exchange),
+            Required("price", &OrderFields::price),
+            Required("direction", &OrderFields::direction).range(0, 1),
+            Required("offset", &OrderFields::offset).range(0, 6),
+            Required("volume", &OrderFields::volume).as(FieldType::NUMBER),
+            Required("price_type", &OrderFields::price_type).range(0, 2),
+            Required("time_condition", &OrderFields::time_condition).range(0, 1),
+            Optional("memo", &OrderFields::memo),
+            Optional("tag", &OrderFields::tag));
+    }
+};
+
+struct Connect {
+    static constexpr std::string_view kOp = "connect";
+    string addr;
+    string port;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("addr", &Connect::addr),
+            Required("port", &Connect::port));
+    }
+    string run(thr t) const {
+        t.connect(addr, port);
+        return "";
+    }
+};
+
+struct GetTradingDay {
+    static constexpr std::string_view kOp = "get_trading_day";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(thr t) const {
         t.getTradingDay();
         return "";
-    }},
-    {"set", [](cjr j, thr t) {
-        if (j.contains("broker_id")) {
-            if (j["broker_id"].is_string())
-                t.setBrokerID(j["broker_id"]);
-            else
-                return "Error: Field \"broker_id\" type error (expected string).";
-        }
-        if (j.contains("investor_id")) {
-            if (j["investor_id"].is_string())
-                t.setInvestorID(j["investor_id"]);
-            else
-                return "Error: Field \"investor_id\" type error (expected string).";
-        }
+    }
+};
+
+// broker_id, investor_id, reconcile_interval and settlement_cache set up the
+// shared session; the others are options of the client sending them.
+struct Set {
+    static constexpr std::string_view kOp = "set";
+    std::optional<string> broker_id;
+    std::optional<string> investor_id;
+    std::optional<int> reconcile_interval;
+    std::optional<int> query_interval;
+    std::optional<bool> aggregate;
+    std::optional<int> chunk_size;
+    std::optional<bool> latency;
+    std::optional<bool> settlement_cache;
+    std::optional<int> order_events;    // 0: all, 1: own
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Optional("broker_id", &Set::broker_id),
+            Optional("investor_id", &Set::investor_id),
+            Optional("reconcile_interval", &Set::reconcile_interval),
+            Optional("query_interval", &Set::query_interval),
+            Optional("aggregate", &Set::aggregate),
+            Optional("chunk_size", &Set::chunk_size),
+            Optional("latency", &Set::latency),
+            Optional("settlement_cache", &Set::settlement_cache),
+            OneOf(Optional("order_events", &Set::order_events), "all", "own"));
+    }
+    string run(thr t) const {
+        if (broker_id)
+            t.setBrokerID(*broker_id);
+        if (investor_id)
+            t.setInvestorID(*investor_id);
+        if (reconcile_interval)
+            t.setReconcileInterval(*reconcile_interval);
+        if (query_interval)
+            t.setQueryInterval(*query_interval);
+        if (aggregate)
+            t.setAggregate(*aggregate);
+        if (chunk_size)
+            t.setChunkSize(*chunk_size);
+        if (latency)
+            t.setLatencyReplies(*latency);
+        if (settlement_cache)
+            t.setSettlementCache(*settlement_cache);
+        if (order_events)
+            t.setOrderEvents(*order_events == 0);
+        return "";
+    }
+};
+
+struct Auth {
+    static constexpr std::string_view kOp = "auth";
+    string user_id;
+    string app_id;
+    string auth_code;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("user_id", &Auth::user_id),
+            Required("app_id", &Auth::app_id),
+            Required("auth_code", &Auth::auth_code));
+    }
+    string run(thr t) const {
+        t.auth(user_id, app_id, auth_code);
+        return "";
+    }
+};
+
+struct Login {
+    static constexpr std::string_view kOp = "login";
+    string user_id;
+    string password;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("user_id", &Login::user_id),
+            Required("password", &Login::password));
+    }
+    string run(thr t) const {
+        t.login(user_id, password);
+        return "";
+    }
+};
+
+struct Logout {
+    static constexpr std::string_view kOp = "logout";
+    string user_id;
+    static constexpr auto fields() {
+        return std::make_tuple(Required("user_id", &Logout::user_id));
+    }
+    string run(thr t) const {
+        t.logout(user_id);
         return "";
-    }},
-    {"auth", [](cjr j, thr t) {
-        if (!j.contains("user_id"))
-            return "Error: Field \"user_id\" not found.";
-        if (!j["user_id"].is_string())
-            return "Error: Field \"user_id\" type error (expected string).";
-        if (!j.contains("app_id"))
-            return "Error: Field \"app_id\" not found.";
-        if (!j["app_id"].is_string())
-            return "Error: Field \"app_id\" type error (expected string).";
-        if (!j.contains("auth_code"))
-            return "Error: Field \"auth_code\" not found.";
-        if (!j["auth_code"].is_string())
-            return "Error: Field \"auth_code\" type error (expected string).";
-        t.auth(j["user_id"], j["app_id"], j["auth_code"]);
-        return "";
-    }},
-    {"login", [](cjr j, thr t) {
-        if (!j.contains("user_id"))
-            return "Error: Field \"user_id\" not found.";
-        if (!j["user_id"].is_string())
-            return "Error: Field \"user_id\" type error (expected string).";
-        if (!j.contains("password"))
-            return "Error: Field \"password\" not found.";
-        if (!j["password"].is_string())
-            return "Error: Field \"password\" type error (expected string).";
-        t.login(j["user_id"], j["password"]);
-        return "";
-    }},
-    {"logout", [](cjr j, thr t) {
-        if (!j.contains("user_id"))
-            return "Error: Field \"user_id\" not found.";
-        if (!j["user_id"].is_string())
-            return "Error: Field \"user_id\" type error (expected string).";
-        t.logout(j["user_id"]);
-        return "";
-    }},
-    {"query_settlement_info", [](cjr j, thr t) {
-        if (!j.contains("trading_day"))
-            return "Error: Field \"trading_day\" not found.";
-        if (!j["trading_day"].is_string())
-            return "Error: Field \"trading_day\" type error (expected string).";
-        t.querySettlementInfo(j["trading_day"]);
-        return "";
-    }},
-    {"confirm_settlement_info", [](cjr j, thr t) {
+    }
+};
+
+struct QuerySettlementInfo {
+    static constexpr std::string_view kOp = "query_settlement_info";
+    string trading_day;
+    std::optional<bool> aggregate;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("trading_day", &QuerySettlementInfo::trading_day),
+            Optional("aggregate", &QuerySettlementInfo::aggregate));
+    }
+    string run(thr t) const {
+        t.aggregateNext(aggregate);
+        t.querySettlementInfo(trading_day);
+        return "";
+    }
+};
+
+struct ConfirmSettlementInfo {
+    static constexpr std::string_view kOp = "confirm_settlement_info";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(thr t) const {
         t.confirmSettlementInfo();
         return "";
-    }},
-    {"query_trading_account", [](cjr j, thr t) {
-        t.queryTradingAccount();
+    }
+};
+
+struct QueryTradingAccount {
+    static constexpr std::string_view kOp = "query_trading_account";
+    bool cached = false;
+    static constexpr auto fields() {
+        return std::make_tuple(Optional("cached", &QueryTradingAccount::cached));
+    }
+    string run(thr t) const {
+        if (cached)
+            t.queryCachedTradingAccount();
+        else
+            t.queryTradingAccount();
+        return "";
+    }
+};
+
+struct QueryPosition {
+    static constexpr std::string_view kOp = "query_position";
+    string instrument;
+    bool refresh = false;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Optional("instrument", &QueryPosition::instrument),
+            Optional("refresh", &QueryPosition::refresh));
+    }
+    string run(thr t) const {
+        t.queryPosition(instrument, refresh);
         return "";
-    }},
-    {"insert_order", [](cjr j, thr t) {
+    }
+};
+
+struct QueryStats {
+    static constexpr std::string_view kOp = "query_stats";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(thr t) const {
+        t.queryStats();
+        return "";
+    }
+};
+
+struct SetRisk {
+    static constexpr std::string_view kOp = "set_risk";
+    std::optional<string> instrument;
+    std::optional<int> max_order_volume;
+    std::optional<int> max_position;
+    std::optional<int> max_orders_per_second;
+    std::optional<bool> price_band;
+    std::optional<bool> self_cross;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Optional("instrument", &SetRisk::instrument),
+            Optional("max_order_volume", &SetRisk::max_order_volume),
+            Optional("max_position", &SetRisk::max_position),
+            Optional("max_orders_per_second", &SetRisk::max_orders_per_second),
+            Optional("price_band", &SetRisk::price_band),
+            Optional("self_cross", &SetRisk::self_cross));
+    }
+    string run(thr t) const {
+        // Only the given fields are changed.
+        json limits = json::object();
+        if (instrument)
+            limits["instrument"] = *instrument;
+        if (max_order_volume)
+            limits["max_order_volume"] = *max_order_volume;
+        if (max_position)
+            limits["max_position"] = *max_position;
+        if (max_orders_per_second)
+            limits["max_orders_per_second"] = *max_orders_per_second;
+        if (price_band)
+            limits["price_band"] = *price_band;
+        if (self_cross)
+            limits["self_cross"] = *self_cross;
+        t.setRisk(limits);
+        return "";
+    }
+};
+
+struct SubscribePosition {
+    static constexpr std::string_view kOp = "subscribe_position";
+    bool enable = true;
+    static constexpr auto fields() {
+        return std::make_tuple(Optional("enable", &SubscribePosition::enable));
+    }
+    string run(thr t) const {
+        t.subscribePosition(enable);
+        return "";
+    }
+};
+
+struct InsertOrder: OrderFields {
+    static constexpr std::string_view kOp = "insert_order";
+    string ref;
+    static constexpr auto fields() {
+        return std::tuple_cat(OrderFields::fields(), std::make_tuple(
+            Optional("ref", &InsertOrder::ref)));
+    }
+    string run(thr t) const {
         try {
-            if (!j.contains("instrument"))
-                return "Error: Field \"instrument\" not found.";
-            if (!j["instrument"].is_string())
-                return "Error: Field \"instrument\" type error (expected string).";
-            if (!j.contains("exchange"))
-                return "Error: Field \"exchange\" not found.";
-            if (!j["exchange"].is_string())
-                return "Error: Field \"exchange\" type error (expected string).";
-            if (!j.contains("ref"))
-                return "Error: Field \"ref\" not found.";
-            if (!j["ref"].is_string())
-                return "Error: Field \"ref\" type error (expected string).";
-            if (!j.contains("price"))
-                return "Error: Field \"price\" not found.";
-            if (!j["price"].is_number())
-                return "Error: Field \"price\" type error (expected number).";
-            if (!j.contains("direction"))
-                return "Error: Field \"direction\" not found.";
-            if (!j["direction"].is_number_integer())
-                return "Error: Field \"direction\" type error (expected integer).";
-            if (static_cast<int>(j["direction"]) < 0 || static_cast<int>(j["direction"]) > 1)
-                return "Error: Field \"direction\" out of range (0..1).";
-            if (!j.contains("offset"))
-                return "Error: Field \"offset\" not found.";
-            if (!j["offset"].is_number_integer())
-                return "Error: Field \"offset\" type error (expected integer).";
-            if (static_cast<int>(j["offset"]) < 0 || static_cast<int>(j["offset"]) > 6)
-                return "Error: Field \"offset\" out of range (0..6).";
-            if (!j.contains("volume"))
-                return "Error: Field \"volume\" not found.";
-            if (!j["volume"].is_number())
-                return "Error: Field \"volume\" type error (expected number).";
-            if (!j.contains("price_type"))
-                return "Error: Field \"price_type\" not found.";
-            if (!j["price_type"].is_number_integer())
-                return "Error: Field \"price_type\" type error (expected integer).";
-            if (static_cast<int>(j["price_type"]) < 0 || static_cast<int>(j["price_type"]) > 2)
-                return "Error: Field \"price_type\" out of range (0..2).";
-            if (!j.contains("time_condition"))
-                return "Error: Field \"time_condition\" not found.";
-            if (!j["time_condition"].is_number_integer())
-                return "Error: Field \"time_condition\" type error (expected integer).";
-            if (static_cast<int>(j["time_condition"]) < 0 || static_cast<int>(j["time_condition"]) > 1)
-                return "Error: Field \"time_condition\" out of range (0..1).";
-            if (j.contains("memo")) {
-                if (!j["memo"].is_string())
-                    return "Error: Field \"memo\" type error (expected string).";
-            }
-            t.insertOrder(
-                j["instrument"], j["exchange"], j["ref"], 
-                j["price"], j["direction"], j["offset"], j["volume"],
-                j["price_type"], j["time_condition"], j.contains("memo")? j["memo"]: "");
+            t.insertOrder(instrument, exchange, ref, price, direction, offset, volume,
+                price_type, time_condition, memo, tag);
             return "";
         }
         catch (const std::exception& e) {
             return e.what();
         }
-    }},
-    {"query_order", [](cjr j, thr t) {
-        if (j.contains("order_sys_id")) {
-            if (!j["order_sys_id"].is_string())
-                return "Error: Field \"order_sys_id\" type error (expected string).";
-            t.queryOrderByID(j["order_sys_id"]);
-        }
-        else if (j.contains("exchange_id")) {
-            if (!j["exchange_id"].is_string())
-                return "Error: Field \"exchange_id\" type error (expected string).";
-            t.queryOrderByExchange(j["exchange_id"]);
+    }
+};
+
+struct InsertConditional: OrderFields {
+    static constexpr std::string_view kOp = "insert_conditional";
+    double trigger_price = 0;
+    int trigger_op = 0;                         // 0: >=, 1: <=
+    TriggerField trigger_field = TriggerField::LAST;
+    static constexpr auto fields() {
+        return std::tuple_cat(OrderFields::fields(), std::make_tuple(
+            Required("trigger_price", &InsertConditional::trigger_price),
+            OneOf(Required("trigger_op", &InsertConditional::trigger_op), ">=", "<="),
+            OneOf(Optional("trigger_field", &InsertConditional::trigger_field), "last", "bid", "ask")));
+    }
+    string run(thr t) const {
+        ConditionalOrder o;
+        o.instrument = instrument;
+        o.exchange = exchange;
+        o.field = trigger_field;
+        o.above = trigger_op == 0;
+        o.level = trigger_price;
+        o.price = price;
+        o.direction = direction;
+        o.offset = offset;
+        o.volume = volume;
+        o.price_type = price_type;
+        o.time_condition = time_condition;
+        o.memo = memo;
+        o.tag = tag;
+        t.insertConditional(std::move(o));
+        return "";
+    }
+};
+
+struct CancelConditional {
+    static constexpr std::string_view kOp = "cancel_conditional";
+    int id = 0;
+    static constexpr auto fields() {
+        return std::make_tuple(Required("id", &CancelConditional::id));
+    }
+    string run(thr t) const {
+        t.cancelConditional(id);
+        return "";
+    }
+};
+
+struct QueryConditional {
+    static constexpr std::string_view kOp = "query_conditional";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(thr t) const {
+        t.queryConditional();
+        return "";
+    }
+};
+
+struct StartAlgo: OrderFields {
+    static constexpr std::string_view kOp = "start_algo";
+    AlgoType algo = AlgoType::TWAP;
+    std::optional<int> duration_ms;
+    std::optional<int> slices;
+    std::optional<int> display;
+    static constexpr auto fields() {
+        return std::tuple_cat(OrderFields::fields(), std::make_tuple(
+            OneOf(Required("algo", &StartAlgo::algo), "twap", "iceberg"),
+            Optional("duration_ms", &StartAlgo::duration_ms).atLeast(0),
+            Optional("slices", &StartAlgo::slices).atLeast(1),
+            Optional("display", &StartAlgo::display).atLeast(1)));
+    }
+    string run(thr t) const {
+        ParentOrder o;
+        o.type = algo;
+        if (algo == AlgoType::TWAP) {
+            if (!duration_ms)
+                return "Error: Field \"duration_ms\" not found.";
+            o.duration_ms = *duration_ms;
+            // One slice a second unless told otherwise.
+            o.slices = slices ? *slices : std::max(1, o.duration_ms / 1000);
         }
-        else if (j.contains("from") && j.contains("to")) {
-            if (!j["from"].is_string())
-                return "Error: Field \"from\" type error (expected string).";
-            if (!j["to"].is_string())
-                return "Error: Field \"to\" type error (expected string).";
-            t.queryOrderByRange(j["from"], j["to"]);
+        else {
+            if (!display)
+                return "Error: Field \"display\" not found.";
+            o.display = *display;
         }
+        if (volume <= 0)
+            return "Error: Field \"volume\" out of range (expected positive).";
+        o.instrument = instrument;
+        o.exchange = exchange;
+        o.price = price;
+        o.direction = direction;
+        o.offset = offset;
+        o.volume = volume;
+        o.slices = std::min(o.slices, o.volume);
+        o.price_type = price_type;
+        o.time_condition = time_condition;
+        o.tag = tag;
+        t.startAlgo(std::move(o));
+        return "";
+    }
+};
+
+struct CancelAlgo {
+    static constexpr std::string_view kOp = "cancel_algo";
+    int id = 0;
+    static constexpr auto fields() {
+        return std::make_tuple(Required("id", &CancelAlgo::id));
+    }
+    string run(thr t) const {
+        t.cancelAlgo(id);
+        return "";
+    }
+};
+
+struct QueryAlgos {
+    static constexpr std::string_view kOp = "query_algos";
+    static constexpr auto fields() { return std::make_tuple(); }
+    string run(thr t) const {
+        t.queryAlgos();
+        return "";
+    }
+};
+
+struct QueryLocalOrders {
+    static constexpr std::string_view kOp = "query_local_orders";
+    string tag;
+    static constexpr auto fields() {
+        return std::make_tuple(Optional("tag", &QueryLocalOrders::tag));
+    }
+    string run(thr t) const {
+        t.queryLocalOrders(tag);
+        return "";
+    }
+};
+
+struct QueryOrder {
+    static constexpr std::string_view kOp = "query_order";
+    std::optional<bool> aggregate;
+    std::optional<string> order_sys_id;
+    std::optional<string> exchange_id;
+    std::optional<string> from;
+    std::optional<string> to;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Optional("aggregate", &QueryOrder::aggregate),
+            FirstOf(
+                AllOf(Optional("order_sys_id", &QueryOrder::order_sys_id)),
+                AllOf(Optional("exchange_id", &QueryOrder::exchange_id)),
+                AllOf(Optional("from", &QueryOrder::from), Optional("to", &QueryOrder::to))));
+    }
+    string run(thr t) const {
+        t.aggregateNext(aggregate);
+        if (order_sys_id)
+            t.queryOrderByID(*order_sys_id);
+        else if (exchange_id)
+            t.queryOrderByExchange(*exchange_id);
+        else if (from && to)
+            t.queryOrderByRange(*from, *to);
         else
             t.queryOrder();
         return "";
-    }},
-    {"delete_order", [](cjr j, thr t) {
-        if (!j.contains("exchange"))
-            return "Error: Field `exchange` not found.";
-        if (!j["exchange"].is_string())
-            return "Error: Field `exchange` type error (expected string).";
-        if (!j.contains("instrument"))
-            return "Error: Field `instrument` not found.";
-        if (!j["instrument"].is_string())
-            return "Error: Field `instrument` type error (expected string).";
-        if (!j.contains("delete_ref"))
-            return "Error: Field `delete_ref` not found.";
-        if (!j["delete_ref"].is_number_integer())
-            return "Error: Field `delete_ref` type error (expected integer).";
-        if (!j.contains("order_sys_id"))
-            return "Error: Field `order_sys_id` not found.";
-        if (!j["order_sys_id"].is_string())
-            return "Error: Field `order_sys_id` type error (expected string).";
-        t.deleteOrder(j["exchange"], j["instrument"], j["delete_ref"], j["order_sys_id"]);
-        return "";
-    }},
-    {"query_instrument", [](cjr j, thr t) {
-        if (j.contains("exchange")) {
-            if (!j["exchange"].is_string())
-                return "Error: Field \"exchange\" type error (expected string).";
-            if (j.contains("instrument")) {
-                if (!j["instrument"].is_string())
-                    return "Error: Field \"instrument\" type error (expected string).";
-                if (j.contains("exchange_inst_id")) {
-                    if (!j["exchange_inst_id"].is_string())
-                        return "Error: Field \"exchange_inst_id\" type error (expected string).";
-                    if (j.contains("product_id")) {
-                        if (!j["product_id"].is_string())
-                            return "Error: Field \"product_id\" type error (expected string).";
-                        t.queryInstrument(j["exchange"], j["instrument"], j["exchange_inst_id"], j["product_id"]);
-                    }
-                    else {
-                        t.queryInstrument(j["exchange"], j["instrument"], j["exchange_inst_id"]);
-                    }
-                }
-                else {
-                    t.queryInstrument(j["exchange"], j["instrument"]);
-                }
-            }
-            else {
-                t.queryInstrument(j["exchange"]);
-            }
-        }
-        else {
-            t.queryInstrument();
-        }
+    }
+};
+
+struct DeleteOrder {
+    static constexpr std::string_view kOp = "delete_order";
+    string exchange;
+    string instrument;
+    int delete_ref = 0;
+    string order_sys_id;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("exchange", &DeleteOrder::exchange).quoted('`'),
+            Required("instrument", &DeleteOrder::instrument).quoted('`'),
+            Required("delete_ref", &DeleteOrder::delete_ref).quoted('`'),
+            Required("order_sys_id", &DeleteOrder::order_sys_id).quoted('`'));
+    }
+    string run(thr t) const {
+        t.deleteOrder(exchange, instrument, delete_ref, order_sys_id);
         return "";
-    }}
+    }
 };
 
-string HandleTraderMessage(const json& msg, TraderHandler& trader) {
-    if (!msg.contains("op"))
+struct CancelAll {
+    static constexpr std::string_view kOp = "cancel_all";
+    string instrument;
+    string exchange;
+    std::optional<Direction> direction;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Optional("instrument", &CancelAll::instrument),
+            Optional("exchange", &CancelAll::exchange),
+            Optional("direction", &CancelAll::direction).range(0, 1));
+    }
+    string run(thr t) const {
+        t.cancelAll(instrument, exchange, direction);
+        return "";
+    }
+};
+
+struct QueryInstrument {
+    static constexpr std::string_view kOp = "query_instrument";
+    std::optional<bool> aggregate;
+    string exchange;
+    string instrument;
+    string exchange_inst_id;
+    string product_id;
+    static constexpr auto fields() {
+        constexpr auto ex = Optional("exchange", &QueryInstrument::exchange);
+        constexpr auto inst = Optional("instrument", &QueryInstrument::instrument);
+        constexpr auto ex_inst = Optional("exchange_inst_id", &QueryInstrument::exchange_inst_id);
+        constexpr auto product = Optional("product_id", &QueryInstrument::product_id);
+        return std::make_tuple(
+            Optional("aggregate", &QueryInstrument::aggregate),
+            // Each field is only read along with all those before it.
+            FirstOf(
+                AllOf(ex, inst, ex_inst, product),
+                AllOf(ex, inst, ex_inst),
+                AllOf(ex, inst),
+                AllOf(ex)));
+    }
+    string run(thr t) const {
+        t.aggregateNext(aggregate);
+        t.queryInstrument(exchange, instrument, exchange_inst_id, product_id);
+        return "";
+    }
+};
+
+#define TABXX_OP(R) case OpHash(R::kOp): return MatchOp<R, TraderHandler, J>(op)
+
+template <typename J>
+OpRunner<TraderHandler, J> Find(std::string_view op) {
+    switch (OpHash(op)) {
+    TABXX_OP(Connect);
+    TABXX_OP(GetTradingDay);
+    TABXX_OP(Set);
+    TABXX_OP(Auth);
+    TABXX_OP(Login);
+    TABXX_OP(Logout);
+    TABXX_OP(QuerySettlementInfo);
+    TABXX_OP(ConfirmSettlementInfo);
+    TABXX_OP(QueryTradingAccount);
+    TABXX_OP(QueryPosition);
+    TABXX_OP(QueryStats);
+    TABXX_OP(SetRisk);
+    TABXX_OP(SubscribePosition);
+    TABXX_OP(InsertOrder);
+    TABXX_OP(InsertConditional);
+    TABXX_OP(CancelConditional);
+    TABXX_OP(QueryConditional);
+    TABXX_OP(StartAlgo);
+    TABXX_OP(CancelAlgo);
+    TABXX_OP(QueryAlgos);
+    TABXX_OP(QueryLocalOrders);
+    TABXX_OP(QueryOrder);
+    TABXX_OP(DeleteOrder);
+    TABXX_OP(CancelAll);
+    TABXX_OP(QueryInstrument);
+    default: return nullptr;
+    }
+}
+
+#undef TABXX_OP
+
+template <typename J>
+string Handle(const J& msg, thr trader) {
+    const auto op = request::Member(msg, "op");
+    if (!op)
         return "Error: Field `op` not found.";
-    string operation = msg["op"];
+    const string operation = op->template get<string>();
+    const auto data = request::Member(msg, "data");
+    if (!data)
+        return "Error: Field `data` not found.";
+    if (!data->is_object())
+        return "Error: Field `data` type error (expected object).";
+    auto run = Find<J>(operation);
+    if (!run)
+        return "Error: Unknown operation `" + operation + "`.";
+    auto res = run(*data, trader);
+    // A per-query "aggregate" flag never outlives its request.
+    trader.aggregateNext(std::nullopt);
+    return res;
+}
+
+// Not dispatched by Find(): it runs on the connection, not on its session.
+struct Attach {
+    static constexpr std::string_view kOp = "attach";
+    string broker_id;
+    string user_id;
+    string password;
+    static constexpr auto fields() {
+        return std::make_tuple(
+            Required("broker_id", &Attach::broker_id),
+            Required("user_id", &Attach::user_id),
+            Required("password", &Attach::password));
+    }
+    string run(WebSocket* ws, TraderPool& pool) const {
+        auto session = pool.find(TraderPool::Key(broker_id, user_id), password);
+        if (!session)
+            return "Error: No logged-in session of this account to attach to (or wrong password).";
+        auto& ctx = *ws->getUserData();
+        if (ctx.trade == session)
+            return "";
+        if (ctx.trade)
+            ctx.trade->detach(ws);
+        // Our own session goes away here unless it is pooled too.
+        ctx.trade = std::move(session);
+        ctx.trade->attach(ws);
+        return "";
+    }
+};
+
+} // namespace trade
+
+string HandleTraderMessage(const json& msg, TraderHandler& trader) {
+    return trade::Handle(msg, trader);
+}
+
+string HandleTraderMessage(const JsonValue& msg, TraderHandler& trader) {
+    return trade::Handle(msg, trader);
+}
+
+string HandleTraderAttach(const json& msg, WebSocket* ws, TraderPool& pool) {
     if (!msg.contains("data"))
         return "Error: Field `data` not found.";
     if (!msg["data"].is_object())
         return "Error: Field `data` type error (expected object).";
-    if (map_trader.find(operation) != map_trader.end())
-        return map_trader.at(operation)(msg["data"], trader);
-    else
-        return "Error: Unknown operation `" + operation + "`.";
-    return "";
+    trade::Attach r;
+    auto err = Decode(msg["data"], r);
+    if (!err.empty())
+        return err;
+    return r.run(ws, pool);
 }
 
 } // namespace tabxx
@@ -6,14 +6,27 @@
 #include <uWebSockets/App.h>
 #include <json.hpp>
 
+#include "JsonDocument.hpp"
 #include "MarketData/Handler.hpp"
 #include "Trade/Handler.hpp"
 
 namespace tabxx {
     
+// Messages come either read on demand (JsonValue) or, when JsonDocument
+// leaves them to nlohmann, as a parsed json; both take the same ops.
 std::string HandleTraderMessage(const nlohmann::json& msg, TraderHandler& trader);
+std::string HandleTraderMessage(const JsonValue& msg, TraderHandler& trader);
+
+// Moves `ws` onto the pooled session of an account, replacing its own.
+std::string HandleTraderAttach(const nlohmann::json& msg, WebSocket* ws, TraderPool& pool);
+
+// The optional client correlation id (`cid`) of a message, a string or an
+// integer, into `cid`; null when absent. Returns an error message if invalid.
+std::string ReadCid(const nlohmann::json& msg, nlohmann::json& cid);
+std::string ReadCid(const JsonValue& msg, nlohmann::json& cid);
 
 std::string HandleMarketDataMessage(const nlohmann::json&, MarketDataHandler&);
+std::string HandleMarketDataMessage(const JsonValue&, MarketDataHandler&);
 
 } // namespace tabxx
 
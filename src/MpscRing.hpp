@@ -0,0 +1,108 @@
+#ifndef TABXX_MPSC_RING_HPP_
+#define TABXX_MPSC_RING_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace tabxx {
+
+// Bounded lock-free queue for any number of producers and one consumer,
+// over a ring of preallocated slots. Each slot carries a sequence number
+// telling whose turn it is: producers claim a position with one CAS and
+// publish the slot by advancing its sequence, the consumer takes slots in
+// order and hands them back a lap later. Nothing is allocated after
+// construction. Taking a slot is a CAS as well, so that a producer finding
+// the ring full may take the oldest message away itself.
+template <typename T>
+class MpscRing {
+public:
+    // `capacity` is rounded up to a power of two.
+    explicit MpscRing(size_t capacity) {
+        size_t n = 2;
+        while (n < capacity)
+            n <<= 1;
+        mask_ = n - 1;
+        slots_ = std::make_unique<Slot[]>(n);
+        for (size_t i = 0; i < n; ++i)
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    size_t capacity() const noexcept { return mask_ + 1; }
+
+    // Any thread. False, and `value` left alone, when the ring is full.
+    bool push(T&& value) noexcept(std::is_nothrow_move_assignable<T>::value) {
+        size_t pos = tail_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & mask_];
+            const size_t seq = slot->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::move(value);
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // The consumer, or a producer dropping the oldest message. False when
+    // nothing is published at the head.
+    bool pop(T& out) noexcept(std::is_nothrow_move_assignable<T>::value) {
+        size_t pos = head_.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &slots_[pos & mask_];
+            const size_t seq = slot->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0) {
+                return false;
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        out = std::move(slot->value);
+        slot->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const noexcept {
+        const size_t pos = head_.load(std::memory_order_relaxed);
+        return slots_[pos & mask_].sequence.load(std::memory_order_acquire) != pos + 1;
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    // Apart, so that producers and the consumer do not share a line.
+    alignas(64) std::atomic<size_t> tail_ {0};
+    alignas(64) std::atomic<size_t> head_ {0};
+};
+
+} // namespace tabxx
+
+#endif // TABXX_MPSC_RING_HPP_
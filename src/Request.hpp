@@ -0,0 +1,304 @@
+#ifndef TABXX_REQUEST_HPP_
+#define TABXX_REQUEST_HPP_
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <json.hpp>
+
+#include "JsonDocument.hpp"
+
+namespace tabxx {
+
+// Typed requests. Every op is a struct with its name in `kOp`, its fields as
+// members and a `static constexpr auto fields()` schema listing them once;
+// Decode() walks that schema, checking and filling the members in order, and
+// stops at the first bad field with the message the op always used. The
+// data may be a nlohmann::json or a JsonValue read on demand.
+//
+//     struct Logout {
+//         static constexpr std::string_view kOp = "logout";
+//         std::string user_id;
+//         static constexpr auto fields() {
+//             return std::make_tuple(Required("user_id", &Logout::user_id));
+//         }
+//         std::string run(TraderHandler& t) const;
+//     };
+
+enum class FieldType {
+    STRING,
+    INTEGER,
+    NUMBER,     // integer or floating point
+    BOOLEAN,
+    ARRAY
+};
+
+template <typename T>
+struct FieldValue { using type = T; };
+template <typename T>
+struct FieldValue<std::optional<T>> { using type = T; };
+
+template <typename T>
+constexpr FieldType FieldTypeOf() {
+    using V = typename FieldValue<T>::type;
+    if constexpr (std::is_same_v<V, std::string>)
+        return FieldType::STRING;
+    else if constexpr (std::is_same_v<V, bool>)
+        return FieldType::BOOLEAN;
+    else if constexpr (std::is_floating_point_v<V>)
+        return FieldType::NUMBER;
+    else if constexpr (std::is_integral_v<V> || std::is_enum_v<V>)
+        return FieldType::INTEGER;
+    else
+        return FieldType::ARRAY;
+}
+
+// One field of a request. A missing optional field leaves the member as it
+// is; a `std::optional` member tells whether it was given.
+template <typename R, typename T>
+struct Field {
+    const char* name;
+    T R::* member;
+    bool required;
+    FieldType type = FieldTypeOf<T>();
+    int64_t min = 1;            // inclusive range of an integer, none when min > max
+    int64_t max = 0;
+    int64_t floor = 0;          // lowest integer, reported as a type error
+    bool has_floor = false;
+    char quote = '"';
+
+    constexpr Field as(FieldType t) const { Field f = *this; f.type = t; return f; }
+    constexpr Field range(int64_t lo, int64_t hi) const { Field f = *this; f.min = lo; f.max = hi; return f; }
+    // 0 reads "non-negative integer", 1 "positive integer".
+    constexpr Field atLeast(int64_t lo) const { Field f = *this; f.floor = lo; f.has_floor = true; return f; }
+    constexpr Field quoted(char q) const { Field f = *this; f.quote = q; return f; }
+};
+
+// A string field taking one of `N` values, stored as the index of the value.
+template <typename R, typename T, size_t N>
+struct Choice {
+    Field<R, T> field;
+    std::array<const char*, N> values;
+};
+
+// Alternative sets of fields: the first group whose fields are all present
+// is decoded, the others are neither checked nor filled, and nothing is when
+// no group is complete. For ops that branch on which fields they were sent.
+template <typename... F>
+struct Group {
+    std::tuple<F...> fields;
+};
+
+template <typename... G>
+struct Alternatives {
+    std::tuple<G...> groups;
+};
+
+template <typename R, typename T>
+constexpr Field<R, T> Required(const char* name, T R::* member) {
+    return Field<R, T> {name, member, true};
+}
+
+template <typename R, typename T>
+constexpr Field<R, T> Optional(const char* name, T R::* member) {
+    return Field<R, T> {name, member, false};
+}
+
+template <typename R, typename T, typename... V>
+constexpr Choice<R, T, sizeof...(V)> OneOf(Field<R, T> field, V... values) {
+    return Choice<R, T, sizeof...(V)> {field, {values...}};
+}
+
+template <typename... F>
+constexpr Group<F...> AllOf(F... fields) {
+    return Group<F...> {std::make_tuple(fields...)};
+}
+
+template <typename... G>
+constexpr Alternatives<G...> FirstOf(G... groups) {
+    return Alternatives<G...> {std::make_tuple(groups...)};
+}
+
+namespace request {
+
+inline std::string FieldError(char quote, const char* name, const std::string& what) {
+    return std::string("Error: Field ") + quote + name + quote + " " + what + ".";
+}
+
+inline const char* TypeName(FieldType t) {
+    switch (t) {
+    case FieldType::STRING: return "string";
+    case FieldType::INTEGER: return "integer";
+    case FieldType::NUMBER: return "number";
+    case FieldType::BOOLEAN: return "boolean";
+    default: return "array";
+    }
+}
+
+inline const nlohmann::json* Member(const nlohmann::json& j, const char* name) {
+    auto it = j.find(name);
+    return it == j.end() ? nullptr : &*it;
+}
+
+inline std::optional<JsonValue> Member(const JsonValue& j, const char* name) {
+    return j.find(name);
+}
+
+inline bool StringEquals(const nlohmann::json& v, const char* s) {
+    return v.is_string() && v.get_ref<const std::string&>() == s;
+}
+
+inline bool StringEquals(const JsonValue& v, const char* s) {
+    return v.equals(s);
+}
+
+template <typename J>
+bool IsType(const J& v, FieldType t) {
+    switch (t) {
+    case FieldType::STRING: return v.is_string();
+    case FieldType::INTEGER: return v.is_number_integer();
+    case FieldType::NUMBER: return v.is_number();
+    case FieldType::BOOLEAN: return v.is_boolean();
+    default: return v.is_array();
+    }
+}
+
+template <typename J, typename T>
+void Assign(const J& v, T& member) {
+    using V = typename FieldValue<T>::type;
+    if constexpr (std::is_enum_v<V>)
+        member = static_cast<V>(v.template get<int64_t>());
+    else
+        member = v.template get<V>();
+}
+
+// Each returns false to stop decoding; a missing field only does when it is
+// required, with `err` set.
+template <typename J, typename O, typename R, typename T>
+bool DecodeField(const J& j, O& r, const Field<R, T>& f, std::string& err) {
+    const auto found = Member(j, f.name);
+    if (!found) {
+        if (f.required)
+            err = FieldError(f.quote, f.name, "not found");
+        return !f.required;
+    }
+    const auto& v = *found;
+    if (f.has_floor) {
+        if (!v.is_number_integer() || v.template get<int64_t>() < f.floor) {
+            err = FieldError(f.quote, f.name, f.floor > 0
+                ? "type error (expected positive integer)"
+                : "type error (expected non-negative integer)");
+            return false;
+        }
+    }
+    else if (!IsType(v, f.type)) {
+        if (f.type == FieldType::ARRAY)
+            err = std::string("Error: \"") + f.name + "\" is not an array.";
+        else
+            err = FieldError(f.quote, f.name, std::string("type error (expected ") + TypeName(f.type) + ")");
+        return false;
+    }
+    if (f.min <= f.max) {
+        const auto n = v.template get<int64_t>();
+        if (n < f.min || n > f.max) {
+            err = FieldError(f.quote, f.name,
+                "out of range (" + std::to_string(f.min) + ".." + std::to_string(f.max) + ")");
+            return false;
+        }
+    }
+    Assign(v, r.*f.member);
+    return true;
+}
+
+template <typename J, typename O, typename R, typename T, size_t N>
+bool DecodeField(const J& j, O& r, const Choice<R, T, N>& c, std::string& err) {
+    const auto found = Member(j, c.field.name);
+    if (!found) {
+        if (c.field.required)
+            err = FieldError(c.field.quote, c.field.name, "not found");
+        return !c.field.required;
+    }
+    for (size_t i = 0; i < N; ++i) {
+        if (StringEquals(*found, c.values[i])) {
+            r.*c.field.member = static_cast<typename FieldValue<T>::type>(i);
+            return true;
+        }
+    }
+    // "a" or "b" / "a", "b" or "c"
+    std::string expected;
+    for (size_t i = 0; i < N; ++i) {
+        if (i > 0)
+            expected += i + 1 == N ? " or " : ", ";
+        expected += std::string("\"") + c.values[i] + "\"";
+    }
+    err = FieldError(c.field.quote, c.field.name, "value error (expected " + expected + ")");
+    return false;
+}
+
+template <typename J, typename O, typename... G>
+bool DecodeField(const J& j, O& r, const Alternatives<G...>& a, std::string& err) {
+    bool chosen = false, ok = true;
+    auto visit = [&] (const auto& g) {
+        if (chosen)
+            return;
+        chosen = std::apply([&] (const auto&... f) { return (static_cast<bool>(Member(j, f.name)) && ...); }, g.fields);
+        if (chosen)
+            ok = std::apply([&] (const auto&... f) { return (DecodeField(j, r, f, err) && ...); }, g.fields);
+    };
+    std::apply([&] (const auto&... g) { (visit(g), ...); }, a.groups);
+    return ok;
+}
+
+} // namespace request
+
+// Fills `r` from the `data` object of a message; returns an error message,
+// empty on success.
+template <typename R, typename J>
+std::string Decode(const J& j, R& r) {
+    static constexpr auto kFields = R::fields();
+    std::string err;
+    std::apply([&] (const auto&... f) {
+        static_cast<void>((request::DecodeField(j, r, f, err) && ...));
+    }, kFields);
+    return err;
+}
+
+// FNV-1a of an op name, so ops can be dispatched with a switch; two names
+// hashing alike would be duplicate case labels and fail to compile.
+constexpr uint64_t OpHash(std::string_view s) {
+    uint64_t h = 14695981039346656037ull;
+    for (char c : s) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+template <typename H, typename J>
+using OpRunner = std::string (*)(const J& data, H& handler);
+
+// Decodes an `R` and runs it on `handler`.
+template <typename R, typename H, typename J>
+std::string RunRequest(const J& data, H& handler) {
+    R r;
+    auto err = Decode(data, r);
+    if (!err.empty())
+        return err;
+    return r.run(handler);
+}
+
+// The runner of `R` if `op` is its name; confirms a hash match.
+template <typename R, typename H, typename J>
+OpRunner<H, J> MatchOp(std::string_view op) {
+    return op == R::kOp ? &RunRequest<R, H, J> : nullptr;
+}
+
+} // namespace tabxx
+
+#endif // TABXX_REQUEST_HPP_
@@ -0,0 +1,26 @@
+#ifndef TABXX_SHARED_STATE_HPP_
+#define TABXX_SHARED_STATE_HPP_
+
+#include "Latency.hpp"
+#include "MarketData/TickStore.hpp"
+#include "Trade/InstrumentCatalog.hpp"
+#include "Trade/TraderPool.hpp"
+#include "Trade/TriggerBook.hpp"
+
+namespace tabxx {
+
+// State shared by every connection of one server instance.
+// Owned by WebSocketApp, handed to handlers as a raw pointer.
+struct SharedState {
+    TickStore ticks;
+    InstrumentCatalog instruments;
+    LatencyStats latency;
+    TriggerBook triggers;
+    // Last: pooled sessions end with it, and use the members above as they
+    // go (~TraderHandler removes its triggers).
+    TraderPool traders;
+};
+
+} // namespace tabxx
+
+#endif // TABXX_SHARED_STATE_HPP_
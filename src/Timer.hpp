@@ -0,0 +1,74 @@
+#ifndef TABXX_TIMER_HPP_
+#define TABXX_TIMER_HPP_
+
+#include <functional>
+
+#include <uWebSockets/App.h>
+
+namespace tabxx {
+
+// Thin wrapper around a uSockets timer bound to a uWS event loop.
+// Must be created, armed and destroyed on the loop thread.
+class Timer {
+public:
+    explicit Timer(uWS::Loop* loop):
+        timer_(us_create_timer(reinterpret_cast<us_loop_t*>(loop), 0, sizeof(Timer*))) {
+        *static_cast<Timer**>(us_timer_ext(timer_)) = this;
+    }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    ~Timer() {
+        stop();
+        us_timer_close(timer_);
+    }
+
+    // Fire `cb` once after `ms` milliseconds.
+    void once(int ms, std::function<void()> cb) {
+        start(ms, 0, std::move(cb));
+    }
+
+    // Fire `cb` every `ms` milliseconds.
+    void every(int ms, std::function<void()> cb) {
+        start(ms, ms, std::move(cb));
+    }
+
+    void stop() {
+        if (armed_) {
+            us_timer_set(timer_, &Timer::fire, 0, 0);
+            armed_ = false;
+        }
+    }
+
+    bool armed() const noexcept { return armed_; }
+
+private:
+    void start(int ms, int repeat_ms, std::function<void()> cb) {
+        cb_ = std::move(cb);
+        repeat_ = repeat_ms > 0;
+        armed_ = true;
+        us_timer_set(timer_, &Timer::fire, ms > 0 ? ms : 1, repeat_ms);
+    }
+
+    static void fire(us_timer_t* t) {
+        auto* self = *static_cast<Timer**>(us_timer_ext(t));
+        if (!self->repeat_)
+            self->armed_ = false;
+        if (self->cb_) {
+            // Callback may re-arm this timer, keep our own copy alive while it runs.
+            auto cb = self->cb_;
+            cb();
+        }
+    }
+
+private:
+    us_timer_t* timer_;
+    std::function<void()> cb_;
+    bool repeat_ = false;
+    bool armed_ = false;
+};
+
+} // namespace tabxx
+
+#endif // TABXX_TIMER_HPP_
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <iterator>
+
+#include "ExecutionEngine.hpp"
+
+namespace tabxx {
+
+nlohmann::json ToJson(const ParentOrder& o) {
+    return nlohmann::json {
+        {"id", o.id},
+        {"order_req_id", o.req_id},
+        {"algo", o.type},
+        {"instrument_id", o.instrument},
+        {"exchange_id", o.exchange},
+        {"price", o.price},
+        {"direction", o.direction},
+        {"offset", o.offset},
+        {"volume", o.volume},
+        {"price_type", o.price_type},
+        {"time_condition", o.time_condition},
+        {"tag", o.tag},
+        {"duration_ms", o.duration_ms},
+        {"slices", o.slices},
+        {"display", o.display},
+        {"state", o.state},
+        {"slices_sent", o.sent},
+        {"children", o.children},
+        {"volume_traded", o.filled},
+        {"volume_working", o.working},
+        {"error", o.error}
+    };
+}
+
+int ExecutionEngine::start(ParentOrder parent) {
+    parent.id = next_id_++;
+    parent.state = AlgoState::RUNNING;
+    const int id = parent.id;
+    auto& p = parents_[id];
+    p.order = std::move(parent);
+    p.start = clock::now();
+    work(p, p.start);
+    report_(p.order);
+    if (p.order.state != AlgoState::RUNNING && p.refs.empty())
+        parents_.erase(id);
+    arm();
+    return id;
+}
+
+bool ExecutionEngine::cancel(int id) {
+    auto it = parents_.find(id);
+    if (it == parents_.end() || it->second.order.state != AlgoState::RUNNING)
+        return false;
+    stop(it->second, AlgoState::CANCELED);
+    settle(it);
+    arm();
+    return true;
+}
+
+int ExecutionEngine::cancelAll(const string& instrument, const string& exchange, std::optional<Direction> direction) {
+    int stopped = 0;
+    for (auto it = parents_.begin(); it != parents_.end();) {
+        const auto& o = it->second.order;
+        const bool match = o.state == AlgoState::RUNNING
+            && (instrument.empty() || o.instrument == instrument)
+            && (exchange.empty() || o.exchange == exchange)
+            && (!direction || o.direction == *direction);
+        auto next = std::next(it);
+        if (match) {
+            stop(it->second, AlgoState::CANCELED);
+            settle(it);
+            ++stopped;
+        }
+        it = next;
+    }
+    if (stopped > 0)
+        arm();
+    return stopped;
+}
+
+void ExecutionEngine::onOrder(const TrackedOrder& order) {
+    auto child = children_.find(order.ref);
+    if (child == children_.end())
+        return;
+    auto& c = child->second;
+    auto parent = parents_.find(c.parent);
+    if (parent == parents_.end()) {
+        children_.erase(child);
+        return;
+    }
+    auto& p = parent->second;
+    const int traded = std::min(order.traded, c.volume);
+    if (traded > c.traded) {
+        p.order.filled += traded - c.traded;
+        p.order.working -= traded - c.traded;
+        c.traded = traded;
+    }
+    const bool done = order.state == OrderLifecycle::TRADED
+        || order.state == OrderLifecycle::CANCELED
+        || order.state == OrderLifecycle::REJECTED;
+    if (done) {
+        p.order.working -= c.volume - c.traded;
+        p.refs.erase(std::remove(p.refs.begin(), p.refs.end(), order.ref), p.refs.end());
+        children_.erase(child);
+        // The engine only cancels children of parents it has stopped.
+        const bool expired = order.state == OrderLifecycle::CANCELED
+            && p.order.type == AlgoType::TWAP && p.order.time_condition == TimeCondition::IMMEDIATE;
+        if (p.order.state == AlgoState::RUNNING && order.state != OrderLifecycle::TRADED && !expired) {
+            if (order.state == OrderLifecycle::REJECTED)
+                stop(p, AlgoState::FAILED, "Child order " + order.ref + " was rejected");
+            else
+                stop(p, AlgoState::CANCELED, "Child order " + order.ref + " was canceled with "
+                    + std::to_string(order.traded) + " of " + std::to_string(order.volume) + " traded");
+        }
+    }
+    // An iceberg shows its next child once the last one has fully traded.
+    work(p, clock::now());
+    settle(parent);
+    arm();
+}
+
+void ExecutionEngine::onUntracked(const string& ref) {
+    auto child = children_.find(ref);
+    if (child == children_.end())
+        return;
+    const auto c = child->second;
+    auto parent = parents_.find(c.parent);
+    if (parent == parents_.end()) {
+        children_.erase(child);
+        return;
+    }
+    auto& p = parent->second;
+    if (p.order.state == AlgoState::RUNNING)
+        stop(p, AlgoState::FAILED, "Child order " + ref + " is not tracked");
+    // Its events cannot be followed any more: stop waiting for them.
+    p.order.working -= c.volume - c.traded;
+    p.refs.erase(std::remove(p.refs.begin(), p.refs.end(), ref), p.refs.end());
+    children_.erase(child);
+    settle(parent);
+    arm();
+}
+
+std::vector<ParentOrder> ExecutionEngine::parents() const {
+    std::vector<ParentOrder> out;
+    out.reserve(parents_.size());
+    for (const auto& [id, p] : parents_)
+        out.push_back(p.order);
+    return out;
+}
+
+bool ExecutionEngine::sendChild(Parent& p, int volume) {
+    string ref;
+    const int ret = send_(p.order, volume, ref);
+    if (ret != 0) {
+        p.order.error = "Child order of " + std::to_string(volume) + " returned " + std::to_string(ret);
+        return false;
+    }
+    children_[ref] = Child {p.order.id, volume};
+    p.refs.push_back(ref);
+    ++p.order.children;
+    p.order.working += volume;
+    return true;
+}
+
+void ExecutionEngine::stop(Parent& p, AlgoState state, const string& error) {
+    p.order.state = state;
+    if (!error.empty())
+        p.order.error = error;
+    for (const auto& ref : p.refs)
+        cancel_(p.order, ref);
+}
+
+void ExecutionEngine::settle(std::map<int, Parent>::iterator it) {
+    report_(it->second.order);
+    if (it->second.order.state != AlgoState::RUNNING && it->second.refs.empty())
+        parents_.erase(it);
+}
+
+void ExecutionEngine::work(Parent& p, clock::time_point now) {
+    auto& o = p.order;
+    if (o.state != AlgoState::RUNNING)
+        return;
+    if (o.type == AlgoType::ICEBERG) {
+        const int remaining = o.volume - o.filled;
+        if (o.working == 0 && remaining > 0 && !sendChild(p, std::min(o.display, remaining)))
+            o.state = AlgoState::FAILED;
+    }
+    else {
+        // Each slice tops the parent up to its share of the schedule, so a
+        // slice that did not trade in time is made up by the next one.
+        while (o.sent < o.slices && due(p) <= now) {
+            const int target = static_cast<int>(static_cast<int64_t>(o.volume) * (o.sent + 1) / o.slices);
+            ++o.sent;
+            const int volume = target - o.filled - o.working;
+            if (volume > 0 && !sendChild(p, volume)) {
+                o.state = AlgoState::FAILED;
+                return;
+            }
+        }
+    }
+    if (o.state != AlgoState::RUNNING)
+        return;
+    if (o.filled >= o.volume)
+        o.state = AlgoState::FILLED;
+    else if (o.type == AlgoType::TWAP && o.sent >= o.slices && o.working == 0)
+        o.state = AlgoState::FINISHED;
+}
+
+ExecutionEngine::clock::time_point ExecutionEngine::due(const Parent& p) const {
+    return p.start + std::chrono::milliseconds(static_cast<int64_t>(p.order.duration_ms) * p.order.sent / p.order.slices);
+}
+
+void ExecutionEngine::arm() {
+    bool any = false;
+    clock::time_point next;
+    for (const auto& [id, p] : parents_) {
+        if (p.order.state != AlgoState::RUNNING || p.order.type != AlgoType::TWAP || p.order.sent >= p.order.slices)
+            continue;
+        const auto t = due(p);
+        if (!any || t < next)
+            next = t;
+        any = true;
+    }
+    if (!any) {
+        timer_.stop();
+        return;
+    }
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(next - clock::now()).count();
+    timer_.once(static_cast<int>(std::max<int64_t>(ms, 0)), [this] () { run(); });
+}
+
+void ExecutionEngine::run() {
+    const auto now = clock::now();
+    for (auto it = parents_.begin(); it != parents_.end();) {
+        auto& p = it->second;
+        const int sent = p.order.sent;
+        work(p, now);
+        if (p.order.sent != sent)
+            report_(p.order);
+        if (p.order.state != AlgoState::RUNNING && p.refs.empty())
+            it = parents_.erase(it);
+        else
+            ++it;
+    }
+    arm();
+}
+
+} // namespace tabxx
@@ -0,0 +1,137 @@
+#ifndef TABXX_TRADE_EXECUTION_ENGINE_HPP_
+#define TABXX_TRADE_EXECUTION_ENGINE_HPP_
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <uWebSockets/App.h>
+#include <json.hpp>
+
+#include "../Timer.hpp"
+#include "Flags.hpp"
+#include "OrderTracker.hpp"
+
+namespace tabxx {
+
+enum class AlgoType {
+    TWAP = 0,       // `volume` spread evenly over `duration_ms` in `slices` children
+    ICEBERG = 1     // one child of at most `display` working at a time
+};
+
+enum class AlgoState {
+    RUNNING = 0,
+    FILLED = 1,     // the whole volume traded
+    FINISHED = 2,   // TWAP schedule over and no child working, volume not all traded
+    CANCELED = 3,   // by the client, or a child was canceled outside the engine
+    FAILED = 4      // a child could not be sent, was rejected or is no longer tracked
+};
+
+// A parent order worked by the server through child orders.
+struct ParentOrder {
+    int id = 0;
+    int req_id = 0;             // children are sent with this req_id, so their events reach the client
+    AlgoType type = AlgoType::TWAP;
+    std::string instrument;
+    std::string exchange;
+    double price = 0;
+    Direction direction = Direction::BUY;
+    OrderOffset offset = OrderOffset::OPEN;
+    int volume = 0;
+    OrderPriceType price_type = OrderPriceType::LIMITED;
+    TimeCondition time_condition = TimeCondition::ONE_DAY;
+    std::string tag;
+    bool latency = false;       // children carry their timing in their events
+    int duration_ms = 0;
+    int slices = 0;
+    int display = 0;
+    // Progress.
+    AlgoState state = AlgoState::RUNNING;
+    int sent = 0;               // slices sent so far (TWAP)
+    int children = 0;
+    int filled = 0;
+    int working = 0;            // volume of children still working
+    std::string error;
+};
+
+nlohmann::json ToJson(const ParentOrder& o);
+
+// Works TWAP and iceberg parent orders of one trader session: TWAP slices are
+// sent from a loop timer, iceberg children are replaced as soon as the
+// previous one has fully traded, both straight from the order events. A
+// child that ends any other way ends its parent, except for the IOC slices
+// of a TWAP, which the next slice makes up for. Loop thread only.
+class ExecutionEngine {
+    using string = std::string;
+    using clock = std::chrono::steady_clock;
+public:
+    // Sends a child of `parent` for `volume`; returns the CTP code and sets
+    // the ref used.
+    using Send = std::function<int(const ParentOrder& parent, int volume, string& ref)>;
+    // Cancels the working child `ref`.
+    using Cancel = std::function<void(const ParentOrder& parent, const string& ref)>;
+    // Receives every change of a parent.
+    using Report = std::function<void(const ParentOrder& parent)>;
+
+    ExecutionEngine(uWS::Loop* loop, Send send, Cancel cancel, Report report):
+        timer_(loop), send_(std::move(send)), cancel_(std::move(cancel)), report_(std::move(report)) {}
+
+    // Starts `parent`, returns its id.
+    int start(ParentOrder parent);
+    // Stops sending and cancels the working children.
+    bool cancel(int id);
+    // cancel() for every running parent on `instrument` / `exchange` /
+    // `direction`, empty or unset ones match all; returns how many stopped.
+    int cancelAll(const string& instrument, const string& exchange, std::optional<Direction> direction);
+    // Whether `ref` is a child the engine still follows.
+    bool isChild(const string& ref) const { return children_.count(ref) != 0; }
+    // A child order changed, as seen by the OrderTracker.
+    void onOrder(const TrackedOrder& order);
+    // An event of order `ref` of this session that the OrderTracker does not
+    // follow: if it is a child, its parent can no longer be worked.
+    void onUntracked(const string& ref);
+
+    std::vector<ParentOrder> parents() const;
+
+private:
+    struct Child {
+        int parent;
+        int volume;
+        int traded = 0;
+    };
+    struct Parent {
+        ParentOrder order;
+        clock::time_point start;
+        std::vector<string> refs;   // children still working
+    };
+
+    // Sends `volume` for `p`, false if the child could not be sent.
+    bool sendChild(Parent& p, int volume);
+    // Ends `p` in `state` and cancels its working children.
+    void stop(Parent& p, AlgoState state, const string& error = "");
+    // Reports `p`, and forgets it once it is over and has no child left.
+    void settle(std::map<int, Parent>::iterator it);
+    // Sends what is due for `p` and settles its state.
+    void work(Parent& p, clock::time_point now);
+    clock::time_point due(const Parent& p) const;
+    void arm();
+    void run();
+
+private:
+    Timer timer_;
+    Send send_;
+    Cancel cancel_;
+    Report report_;
+    int next_id_ = 1;
+    std::map<int, Parent> parents_;
+    std::unordered_map<string, Child> children_;    // OrderRef -> child
+
+}; // class ExecutionEngine
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_EXECUTION_ENGINE_HPP_
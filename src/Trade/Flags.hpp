@@ -6,6 +6,7 @@
 #include <string>
 
 #include <ThostFtdcUserApiDataType.h>
+#include <ThostFtdcUserApiStruct.h>
 
 namespace tabxx {
 
@@ -104,6 +105,22 @@ inline TimeCondition GetTimeCondition(TThostFtdcTimeConditionType tc) {
     }
 }
 
+enum class PositionDirection {
+    LONG = 0,
+    SHORT = 1
+};
+
+inline PositionDirection GetPositionDirection(TThostFtdcPosiDirectionType d) {
+    switch (d) {
+    case THOST_FTDC_PD_Long:
+        return PositionDirection::LONG;
+    case THOST_FTDC_PD_Short:
+        return PositionDirection::SHORT;
+    default:
+        throw std::runtime_error(std::string("tabxx::GetPositionDirection(): Unsupported position direction: ") + d);
+    }
+}
+
 enum class OrderSubmitStatus {
     INSERT_SUBMITTED = 0,
     CANCEL_SUBMITTED = 1,
@@ -172,6 +189,20 @@ inline OrderStatus GetOrderStatus(TThostFtdcOrderStatusType s) {
     }
 }
 
+// Whether the order can still trade: accepted and neither filled, cancelled
+// nor expired.
+inline bool IsWorking(const CThostFtdcOrderField& f) {
+    switch (f.OrderStatus) {
+    case THOST_FTDC_OST_AllTraded:
+    case THOST_FTDC_OST_Canceled:
+    case THOST_FTDC_OST_PartTradedNotQueueing:
+    case THOST_FTDC_OST_NoTradeNotQueueing:
+        return false;
+    default:
+        return f.OrderSubmitStatus != THOST_FTDC_OSS_InsertRejected;
+    }
+}
+
 } // namespace tabxx
 
 #endif // TABXX_TRADE_FLAGS_HPP_
\ No newline at end of file
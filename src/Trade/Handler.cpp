@@ -1,8 +1,35 @@
 #include "Handler.hpp"
 
 namespace tabxx {
+namespace {
+
+// Adds the client tag and local lifecycle of an order sent by this session,
+// and its stage latencies when asked for.
+void AddTracking(json& data, const std::optional<TrackedOrder>& order) {
+    if (!order || !data.is_object())
+        return;
+    data["tag"] = order->tag;
+    data["lifecycle"] = order->state;
+    if (order->latency)
+        data["latency"] = ToJson(order->timing);
+}
+
+} // namespace
 
 void TraderHandler::OnRspError(CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
+    if (isRestoreReply(nRequestID)) {
+        const string msg = pRspInfo ? u8(pRspInfo->ErrorMsg) : "error response";
+        post([this, msg] () { onRestoreStep(false, msg); });
+        return;
+    }
+    auto callers = queryCallers(nRequestID, bIsLast);
+    if (!callers.empty()) {
+        onQueryFailed(callers, pRspInfo? json {
+            {"code", pRspInfo->ErrorID},
+            {"msg", u8(pRspInfo->ErrorMsg)}
+        }: json());
+        return;
+    }
     send(TradeMsgCode::ERROR, pRspInfo, {
         {"req_id", nRequestID},
         {"is_last", bIsLast}
@@ -10,10 +37,28 @@ void TraderHandler::OnRspError(CThostFtdcRspInfoField *pRspInfo, int nRequestID,
 }
 
 void TraderHandler::OnFrontConnected()  {
+    if (restore_wanted_) {
+        // CTP reconnected by itself; log the session in again without the
+        // client, which hears about it once the session is restored.
+        restoring_ = true;
+        post([this] () {
+            restore_step_ = restore_.app_id.empty() ? RestoreStep::LOGIN : RestoreStep::AUTH;
+            restore_backoff_.reset();
+            restore_timer_.once(restore_backoff_.next(), [this] () { restoreStep(); });
+        });
+        return;
+    }
     send(TradeMsgCode::CONNECTED, {}, {});
 }
 
 void TraderHandler::OnFrontDisconnected(int nReason) {
+    logged_in_ = false;
+    // The in-flight query will not be answered.
+    post([this] () {
+        queries_.abort(-1);
+        restore_timer_.stop();
+        restore_req_ = 0;
+    });
     string reason;
     switch (nReason) {
     case 0x1001:
@@ -36,7 +81,7 @@ void TraderHandler::OnFrontDisconnected(int nReason) {
     }
     send(TradeMsgCode::DISCONNECTED, 
         {{"code", nReason}, {"msg", reason}},
-        {}
+        {{"restoring", restore_wanted_.load()}}
     );
 }
 
@@ -44,6 +89,12 @@ void TraderHandler::OnRspAuthenticate(
     CThostFtdcRspAuthenticateField *pRspAuthenticateField, 
     CThostFtdcRspInfoField *pRspInfo, 
     int nRequestID, bool bIsLast)  {
+    if (isRestoreReply(nRequestID)) {
+        const bool ok = !pRspInfo || pRspInfo->ErrorID == 0;
+        const string msg = ok ? "" : "authentication failed: " + u8(pRspInfo->ErrorMsg);
+        post([this, ok, msg] () { onRestoreStep(ok, msg); });
+        return;
+    }
     send(TradeMsgCode::AUTHENTICATE, pRspInfo, pRspAuthenticateField? json {
             {"req_id", nRequestID},
             {"is_last", bIsLast},
@@ -63,6 +114,32 @@ void TraderHandler::OnRspUserLogin(
     CThostFtdcRspUserLoginField *pRspUserLogin, 
     CThostFtdcRspInfoField *pRspInfo, 
     int nRequestID, bool bIsLast)  {
+    if (pRspUserLogin && (!pRspInfo || pRspInfo->ErrorID == 0)) {
+        // Seed the position book; the timer issues the queries.
+        logged_in_ = true;
+        front_id_ = pRspUserLogin->FrontID;
+        session_id_ = pRspUserLogin->SessionID;
+        orders_.seed(pRspUserLogin->FrontID, pRspUserLogin->SessionID, pRspUserLogin->MaxOrderRef);
+        position_due_ = true;
+        account_due_ = true;
+        restore_wanted_ = true;
+        post([this] () {
+            fetchCatalog();
+            state_->traders.add(TraderPool::Key(broker_id_, login_user_), login_password_, shared_from_this());
+            restore_.user_id = login_user_;
+            restore_.password = std::move(login_password_);
+            login_password_.clear();
+        });
+    }
+    else {
+        post([this] () { login_password_.clear(); });
+    }
+    if (isRestoreReply(nRequestID)) {
+        const bool ok = pRspUserLogin && (!pRspInfo || pRspInfo->ErrorID == 0);
+        const string msg = ok ? "" : "login failed: " + (pRspInfo ? u8(pRspInfo->ErrorMsg) : "no response");
+        post([this, ok, msg] () { onRestoreStep(ok, msg); });
+        return;
+    }
     send(TradeMsgCode::LOGIN, pRspInfo, pRspUserLogin? json {
             {"req_id", nRequestID},
             {"is_last", bIsLast},
@@ -95,6 +172,15 @@ void TraderHandler::OnRspUserLogout(
     CThostFtdcUserLogoutField *pUserLogout, 
     CThostFtdcRspInfoField *pRspInfo, 
     int nRequestID, bool bIsLast) {
+    if (pUserLogout && (!pRspInfo || pRspInfo->ErrorID == 0)) {
+        logged_in_ = false;
+        restore_wanted_ = false;
+        restore_confirm_ = false;
+        post([this] () {
+            state_->traders.remove(this);
+            restore_ = Restore();
+        });
+    }
     send(TradeMsgCode::LOGOUT, pRspInfo, pUserLogout? json {
             {"req_id", nRequestID},
             {"is_last", bIsLast},
@@ -110,27 +196,68 @@ void TraderHandler::OnRspUserLogout(
 void TraderHandler::OnRspQrySettlementInfo(
     CThostFtdcSettlementInfoField *pSettlementInfo, 
     CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
-    send(TradeMsgCode::SETTLEMENT_INFO, pRspInfo, pSettlementInfo? json {
-            {"req_id", nRequestID},
-            {"is_last", bIsLast},
-            {"trading_day", pSettlementInfo->TradingDay},
-            {"settlement_id", pSettlementInfo->SettlementID},
-            {"broker_id", pSettlementInfo->BrokerID},
-            {"investor_id", pSettlementInfo->InvestorID},
-            {"sequence_no", pSettlementInfo->SequenceNo},
-            {"content", u8(pSettlementInfo->Content)},
-            {"account_id", pSettlementInfo->AccountID},
-            {"currency_id", pSettlementInfo->CurrencyID}
-        }: json {
-            {"req_id", nRequestID},
-            {"is_last", bIsLast},
+    // The statement comes in 500 byte chunks which may split a GBK character,
+    // so it is converted once as a whole.
+    auto& part = settlement_parts_[nRequestID];
+    if (pSettlementInfo) {
+        if (part.head.is_null()) {
+            part.head = json {
+                {"trading_day", pSettlementInfo->TradingDay},
+                {"settlement_id", pSettlementInfo->SettlementID},
+                {"broker_id", pSettlementInfo->BrokerID},
+                {"investor_id", pSettlementInfo->InvestorID},
+                {"sequence_no", pSettlementInfo->SequenceNo},
+                {"account_id", pSettlementInfo->AccountID},
+                {"currency_id", pSettlementInfo->CurrencyID}
+            };
         }
-    );
+        part.content.append(pSettlementInfo->Content,
+            strnlen(pSettlementInfo->Content, sizeof(pSettlementInfo->Content)));
+    }
+    if (!bIsLast)
+        return;
+    auto done = std::move(part);
+    settlement_parts_.erase(nRequestID);
+    string key;
+    {
+        std::lock_guard<std::mutex> lock(settlement_mutex_);
+        auto it = settlement_keys_.find(nRequestID);
+        if (it != settlement_keys_.end()) {
+            key = std::move(it->second);
+            settlement_keys_.erase(it);
+        }
+    }
+    json data = {
+        {"req_id", nRequestID},
+        {"is_last", true}
+    };
+    if (!done.head.is_null()) {
+        data.update(done.head);
+        data["content"] = u8(done.content);
+        const bool ok = !pRspInfo || pRspInfo->ErrorID == 0;
+        if (ok && !key.empty() && settlement_cache_enabled_) {
+            json cached = data;
+            cached.erase("req_id");
+            cached.erase("is_last");
+            std::lock_guard<std::mutex> lock(settlement_mutex_);
+            if (settlement_day_ == api_->GetTradingDay())
+                settlements_[key] = std::move(cached);
+        }
+    }
+    reply(TradeMsgCode::SETTLEMENT_INFO, pRspInfo, std::move(data), nRequestID, true);
 }
 
 void TraderHandler::OnRspSettlementInfoConfirm(
     CThostFtdcSettlementInfoConfirmField *pSettlementInfoConfirm, 
     CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
+    const bool ok = pSettlementInfoConfirm && (!pRspInfo || pRspInfo->ErrorID == 0);
+    if (ok)
+        restore_confirm_ = true;
+    if (isRestoreReply(nRequestID)) {
+        const string msg = ok ? "" : "settlement info confirm failed: " + (pRspInfo ? u8(pRspInfo->ErrorMsg) : "no response");
+        post([this, ok, msg] () { onRestoreStep(ok, msg); });
+        return;
+    }
     send(TradeMsgCode::SETTLEMENT_INFO_CONFIRM, pRspInfo,
         pSettlementInfoConfirm? json {
             {"req_id", nRequestID},
@@ -152,64 +279,78 @@ void TraderHandler::OnRspSettlementInfoConfirm(
 void TraderHandler::OnRspQryTradingAccount(
     CThostFtdcTradingAccountField *pTradingAccount, 
     CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
-    send(TradeMsgCode::TRADING_ACCOUNT, pRspInfo,
-        pTradingAccount? json {
-            {"req_id", nRequestID},
-            {"is_last", bIsLast},
-            {"broker_id", pTradingAccount->BrokerID},
-            {"account_id", pTradingAccount->AccountID},
-            {"pre_mortgage", pTradingAccount->PreMortgage},
-            {"pre_credit", pTradingAccount->PreCredit},
-            {"pre_deposit", pTradingAccount->PreDeposit},
-            {"pre_balance", pTradingAccount->PreBalance},
-            {"pre_margin", pTradingAccount->PreMargin},
-            {"interest_base", pTradingAccount->InterestBase},
-            {"interest", pTradingAccount->Interest},
-            {"deposit", pTradingAccount->Deposit},
-            {"withdraw", pTradingAccount->Withdraw},
-            {"frozen_margin", pTradingAccount->FrozenMargin},
-            {"frozen_cash", pTradingAccount->FrozenCash},
-            {"frozen_commission", pTradingAccount->FrozenCommission},
-            {"current_margin", pTradingAccount->CurrMargin},
-            {"cash_in", pTradingAccount->CashIn},
-            {"commission", pTradingAccount->Commission},
-            {"close_profit", pTradingAccount->CloseProfit},
-            {"position_profit", pTradingAccount->PositionProfit},
-            {"available", pTradingAccount->Available},
-            {"withdraw_quota", pTradingAccount->WithdrawQuota},
-            // {"reserve", pTradingAccount->Reserve},
-            {"trading_day", pTradingAccount->TradingDay},
-            {"settlement_id", pTradingAccount->SettlementID},
-            {"credit", pTradingAccount->Credit},
-            {"mortgage", pTradingAccount->Mortgage},
-            {"exchange_margin", pTradingAccount->ExchangeMargin},
-            {"delivery_margin", pTradingAccount->DeliveryMargin},
-            {"exchange_delivery_margin", pTradingAccount->ExchangeDeliveryMargin},
-            {"reserve_balance", pTradingAccount->ReserveBalance},
-            {"currency_id", pTradingAccount->CurrencyID},
-            {"pre_fund_mortgage_in", pTradingAccount->PreFundMortgageIn},
-            {"pre_fund_mortgage_out", pTradingAccount->PreFundMortgageOut},
-            {"fund_mortgage_in", pTradingAccount->FundMortgageIn},
-            {"fund_mortgage_out", pTradingAccount->FundMortgageOut},
-            {"fund_mortgage_available", pTradingAccount->FundMortgageAvailable},
-            {"mortgageable_fund", pTradingAccount->MortgageableFund},
-            {"spec_product_margin", pTradingAccount->SpecProductMargin},
-            {"spec_product_frozen_margin", pTradingAccount->SpecProductFrozenMargin},
-            {"spec_product_commission", pTradingAccount->SpecProductCommission},
-            {"spec_product_frozen_commission", pTradingAccount->SpecProductFrozenCommission},
-            {"spec_product_position_profit", pTradingAccount->SpecProductPositionProfit},
-            {"spec_product_close_profit", pTradingAccount->SpecProductCloseProfit},
-            {"spec_product_position_profit_by_alg", pTradingAccount->SpecProductPositionProfitByAlg},
-            {"spec_product_exchange_margin", pTradingAccount->SpecProductExchangeMargin},
-            {"biz_type", pTradingAccount->BizType},
-            {"frozen_swap", pTradingAccount->FrozenSwap},
-            {"remain_swap", pTradingAccount->RemainSwap},
-            {"option_value", pTradingAccount->OptionValue}
-        }: json {
-            {"req_id", nRequestID},
-            {"is_last", bIsLast},
+    auto callers = queryCallers(nRequestID, bIsLast);
+    if (pTradingAccount)
+        positions_.setAccount(*pTradingAccount);
+    for (int caller : callers) {
+        if (caller != account_sync_req_)
+            continue;
+        // Internal sync, no client is waiting for it.
+        if (pRspInfo && pRspInfo->ErrorID != 0)
+            warn("Account sync failed: "_s + u8(pRspInfo->ErrorMsg));
+        if (bIsLast)
+            account_sync_req_ = 0;
+    }
+    json data = pTradingAccount? ToJson(*pTradingAccount): json::object();
+    data["req_id"] = nRequestID;
+    data["is_last"] = bIsLast;
+    reply(TradeMsgCode::TRADING_ACCOUNT, pRspInfo, std::move(data), callers, nRequestID);
+}
+
+void TraderHandler::OnRspQryInvestorPosition(
+    CThostFtdcInvestorPositionField *pInvestorPosition, 
+    CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
+    if (pRspInfo && pRspInfo->ErrorID != 0) {
+        auto callers = queryCallers(nRequestID, true);
+        onQueryFailed(callers, {
+            {"code", pRspInfo->ErrorID},
+            {"msg", u8(pRspInfo->ErrorMsg)}
+        });
+        return;
+    }
+    auto callers = queryCallers(nRequestID, bIsLast);
+    if (callers.empty())
+        return;
+    if (pInvestorPosition)
+        positions_.addSyncRecord(*pInvestorPosition);
+    if (!bIsLast)
+        return;
+    auto drift = positions_.commitSync();
+    risk_.setPositions(positions_.positions());
+    account_due_ = true;
+    positions_.revalue(state_->ticks);
+    if (!drift.empty()) {
+        json list = json::array();
+        for (const auto& d : drift) {
+            warn("Position drift detected: "_s + d.instrument + (d.direction == PositionDirection::LONG ? " LONG" : " SHORT")
+                + " local " + std::to_string(d.local) + " remote " + std::to_string(d.remote));
+            list.push_back({
+                {"instrument_id", d.instrument},
+                {"direction", d.direction},
+                {"local", d.local},
+                {"remote", d.remote}
+            });
         }
-    );
+        send(TradeMsgCode::POSITION_DRIFT, json(), {{"drift", std::move(list)}});
+    }
+    for (int caller : callers) {
+        if (caller == position_sync_req_) {
+            position_sync_req_ = 0;
+            continue;
+        }
+        string instrument;
+        {
+            std::lock_guard<std::mutex> lock(position_mutex_);
+            auto it = position_waiters_.find(caller);
+            if (it == position_waiters_.end())
+                continue;
+            instrument = std::move(it->second);
+            position_waiters_.erase(it);
+        }
+        sendPositions(TradeMsgCode::QUERY_POSITION, caller, instrument);
+    }
+    if (position_push_)
+        sendPositions(TradeMsgCode::POSITION_UPDATE, 0);
 }
 
 void TraderHandler::OnRspOrderInsert(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
@@ -233,14 +374,19 @@ void TraderHandler::OnRspOrderInsert(CThostFtdcInputOrderField *pInputOrder, CTh
                 {"req_id", nRequestID},
                 {"is_last", bIsLast}
             });
-            logger_->error("tabxx::TraderHandler::OnRspOrderInsert(): what(): "_s + e.what());
+            static constexpr LogFormat kWhat {"tabxx::TraderHandler::OnRspOrderInsert(): what(): {}"};
+            error(kWhat, e.what());
         }
     }
     else {
         logger_->error("tabxx::TraderHandler::OnRspOrderInsert(): pInputOrder is nullptr");
     }
-    send(TradeMsgCode::ORDER_INSERT_ERROR, pRspInfo,
-        pInputOrder? json {
+    std::optional<TrackedOrder> tracked;
+    if (pInputOrder) {
+        risk_.onRejected(orderKey(pInputOrder->OrderRef));
+        tracked = orders_.onRejected(pInputOrder->OrderRef);
+    }
+    json data = pInputOrder? json {
             {"account_id", pInputOrder->AccountID},
             {"user_id", pInputOrder->UserID},
             {"investor_id", pInputOrder->InvestorID},
@@ -270,8 +416,10 @@ void TraderHandler::OnRspOrderInsert(CThostFtdcInputOrderField *pInputOrder, CTh
         }: json {
             {"req_id", nRequestID},
             {"is_last", bIsLast}
-        }
-    );
+        };
+    AddTracking(data, tracked);
+    toAlgos(tracked, pInputOrder ? pInputOrder->OrderRef : nullptr);
+    send(TradeMsgCode::ORDER_INSERT_ERROR, pRspInfo, data);
 }
 
 void TraderHandler::OnErrRtnOrderInsert(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo) {
@@ -293,14 +441,19 @@ void TraderHandler::OnErrRtnOrderInsert(CThostFtdcInputOrderField *pInputOrder,
             send(TradeMsgCode::ERROR_UNKNOWN_VALUE, pRspInfo, {
                 {"info", e.what()},
             });
-            logger_->error("tabxx::TraderHandler::OnErrRtnOrderInsert(): what(): "_s + e.what());
+            static constexpr LogFormat kWhat {"tabxx::TraderHandler::OnErrRtnOrderInsert(): what(): {}"};
+            error(kWhat, e.what());
         }
     }
     else {
         logger_->error("tabxx::TraderHandler::OnErrRtnOrderInsert(): pInputOrder is nullptr");
     }
-    send(TradeMsgCode::ORDER_INSERT_RETURN_ERROR, pRspInfo,
-        pInputOrder? json {
+    std::optional<TrackedOrder> tracked;
+    if (pInputOrder) {
+        risk_.onRejected(orderKey(pInputOrder->OrderRef));
+        tracked = orders_.onRejected(pInputOrder->OrderRef);
+    }
+    json data = pInputOrder? json {
             {"account_id", pInputOrder->AccountID},
             {"user_id", pInputOrder->UserID},
             {"investor_id", pInputOrder->InvestorID},
@@ -325,35 +478,21 @@ void TraderHandler::OnErrRtnOrderInsert(CThostFtdcInputOrderField *pInputOrder,
             {"price_type", opt},
             {"hedge", hedge},
             {"time_condition", tc}
-        }: json()
-    );
+        }: json();
+    AddTracking(data, tracked);
+    toAlgos(tracked, pInputOrder ? pInputOrder->OrderRef : nullptr);
+    send(TradeMsgCode::ORDER_INSERT_RETURN_ERROR, pRspInfo, data, tracked ? tracked->req_id : kBroadcast);
 }
 
 void TraderHandler::OnRtnOrder(CThostFtdcOrderField *pOrder) {
-    OrderSubmitStatus submitStatus;
-    OrderStatus status;
-    Direction direction;
-    OrderOffset of;
-    OrderPriceType opt;
-    Hedge hedge;
-    TimeCondition tc;
-    string report = "ACCEPTED: ";
-    report += pOrder->InstrumentID;
-    report += " in ";
-    report += pOrder->ExchangeID;
-    report += " with ref '";
-    report += pOrder->OrderRef;
-    report += "' ";
-    report += direction == Direction::BUY ? "BUY" : "SELL";
-    report += " ";
-    report += of == OrderOffset::OPEN ? "OPEN" : "CLOSE";
-    report += " ";
-    report += std::to_string(pOrder->VolumeTotal);
-    report += opt == OrderPriceType::LIMITED ? "LIMITED" : "MARKET";
-    report += " at ";
-    report += std::to_string(pOrder->LimitPrice);
-    report += " ";
-    report += tc == TimeCondition::IMMEDIATE ? "IMMEDIATELY" : "ONE_DAY";
+    OrderSubmitStatus submitStatus = OrderSubmitStatus::INSERT_SUBMITTED;
+    OrderStatus status = OrderStatus::UNKNOWN;
+    Direction direction = Direction::BUY;
+    OrderOffset of = OrderOffset::OPEN;
+    OrderPriceType opt = OrderPriceType::LIMITED;
+    Hedge hedge = Hedge::SPECULATION;
+    TimeCondition tc = TimeCondition::ONE_DAY;
+    string report;
     if (pOrder) {
         try {
             submitStatus = GetOrderSubmitStatus(pOrder->OrderSubmitStatus);
@@ -369,18 +508,38 @@ void TraderHandler::OnRtnOrder(CThostFtdcOrderField *pOrder) {
             send(TradeMsgCode::ERROR_UNKNOWN_VALUE, {}, {
                 {"info", e.what()}
             });
-            logger_->error("tabxx::TraderHandler::OnRtnOrder(): what(): "_s + e.what());
+            static constexpr LogFormat kWhat {"tabxx::TraderHandler::OnRtnOrder(): what(): {}"};
+            error(kWhat, e.what());
         }
+        report = "ACCEPTED: ";
+        report += pOrder->InstrumentID;
+        report += " in ";
+        report += pOrder->ExchangeID;
+        report += " with ref '";
+        report += pOrder->OrderRef;
+        report += "' ";
+        report += direction == Direction::BUY ? "BUY" : "SELL";
+        report += " ";
+        report += of == OrderOffset::OPEN ? "OPEN" : "CLOSE";
+        report += " ";
+        report += std::to_string(pOrder->VolumeTotal);
+        report += opt == OrderPriceType::LIMITED ? " LIMITED" : " MARKET";
+        report += " at ";
+        report += std::to_string(pOrder->LimitPrice);
+        report += " ";
+        report += tc == TimeCondition::IMMEDIATE ? "IMMEDIATELY" : "ONE_DAY";
     }
     else {
         logger_->error("tabxx::TraderHandler::OnRtnOrder(): Parameter 'pOrder' is nullptr!");
     }
-    send(status == OrderStatus::CANCELED ? TradeMsgCode::ORDER_DELETED: TradeMsgCode::ORDER_INSERTED,
-        {
-            {"code", 0},
-            {"msg", report}
-        },
-        pOrder? json {
+    std::optional<TrackedOrder> tracked;
+    if (pOrder)
+        tracked = orders_.onOrder(*pOrder);
+    if (pOrder)
+        risk_.onOrder(*pOrder);
+    if (pOrder && positions_.onOrder(*pOrder) && position_push_)
+        sendPositions(TradeMsgCode::POSITION_UPDATE, 0, pOrder->InstrumentID);
+    json data = pOrder? json {
             {"broker_id", pOrder->BrokerID},
             {"investor_id", pOrder->InvestorID},
             {"user_id", pOrder->UserID},
@@ -407,7 +566,16 @@ void TraderHandler::OnRtnOrder(CThostFtdcOrderField *pOrder) {
             {"price_type", opt},
             {"hedge", hedge},
             {"time_condition", tc}
-        }: json()
+        }: json();
+    AddTracking(data, tracked);
+    toAlgos(tracked, pOrder && pOrder->FrontID == front_id_ && pOrder->SessionID == session_id_ ? pOrder->OrderRef : nullptr);
+    send(status == OrderStatus::CANCELED ? TradeMsgCode::ORDER_DELETED: TradeMsgCode::ORDER_INSERTED,
+        {
+            {"code", 0},
+            {"msg", report}
+        },
+        data,
+        tracked ? tracked->req_id : kBroadcast
     );
 }
 
@@ -426,18 +594,24 @@ void TraderHandler::OnRtnTrade(CThostFtdcTradeField *pTrade) {
             send(TradeMsgCode::ERROR_UNKNOWN_VALUE, {}, {
                 {"info", e.what()}
             });
-            logger_->error("tabxx::TraderHandler::OnRtnTrade(): what(): "_s + e.what());
+            static constexpr LogFormat kWhat {"tabxx::TraderHandler::OnRtnTrade(): what(): {}"};
+            error(kWhat, e.what());
         }
     }
     else {
         logger_->error("tabxx::TraderHandler::OnRtnTrade(): Parameter 'pTrade' is nullptr!");
     }
-    send(TradeMsgCode::ORDER_TRADED,
-        {
-            {"code", 0},
-            {"msg", ""}
-        },
-        pTrade? json {
+    std::optional<TrackedOrder> tracked;
+    if (pTrade) {
+        risk_.onTrade(*pTrade);
+        tracked = orders_.onTrade(*pTrade);
+    }
+    if (pTrade && positions_.onTrade(*pTrade)) {
+        positions_.revalue(state_->ticks);
+        if (position_push_)
+            sendPositions(TradeMsgCode::POSITION_UPDATE, 0, pTrade->InstrumentID);
+    }
+    json data = pTrade? json {
             {"broker_id", pTrade->BrokerID},
             {"investor_id", pTrade->InvestorID},
             {"user_id", pTrade->UserID},
@@ -452,9 +626,17 @@ void TraderHandler::OnRtnTrade(CThostFtdcTradeField *pTrade) {
             {"direction", direction},
             {"offset", of},
             {"hedge", hedge}
-        }: json()
+        }: json();
+    AddTracking(data, tracked);
+    toAlgos(tracked);
+    send(TradeMsgCode::ORDER_TRADED,
+        {
+            {"code", 0},
+            {"msg", ""}
+        },
+        data,
+        tracked ? tracked->req_id : kBroadcast
     );
-
 }
 
 void TraderHandler::OnRspQryOrder(
@@ -485,7 +667,7 @@ void TraderHandler::OnRspQryOrder(
             logger_->error((std::string)"tabxx::TraderHandler::OnRspQryOrder(): what(): " + e.what());
         }
     }
-    send(TradeMsgCode::QUERY_ORDER, pRspInfo,
+    reply(TradeMsgCode::QUERY_ORDER, pRspInfo,
         pOrder? json {
             {"broker_id", pOrder->BrokerID},
             {"investor_id", pOrder->InvestorID},
@@ -519,7 +701,8 @@ void TraderHandler::OnRspQryOrder(
         }: json {
             {"req_id", nRequestID},
             {"is_last", bIsLast}
-        }
+        },
+        nRequestID, bIsLast
     );
 }
 
@@ -596,46 +779,37 @@ void TraderHandler::OnErrRtnOrderAction(CThostFtdcOrderActionField *pOrderAction
 void TraderHandler::OnRspQryInstrument(
     CThostFtdcInstrumentField *pInstrument, 
     CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) {
-    send(TradeMsgCode::QUERY_INSTRUMENT, pRspInfo,
-        pInstrument? json {
-            {"req_id", nRequestID},
-            {"is_last", bIsLast},
-            {"exchange_id", pInstrument->ExchangeID},
-            {"instrument_name", u8(pInstrument->InstrumentName)},
-            {"product_class", pInstrument->ProductClass},
-            {"delivery_year", pInstrument->DeliveryYear},
-            {"delivery_month", pInstrument->DeliveryMonth},
-            {"max_market_order_volume", pInstrument->MaxMarketOrderVolume},
-            {"min_market_order_volume", pInstrument->MinMarketOrderVolume},
-            {"max_limit_order_volume", pInstrument->MaxLimitOrderVolume},
-            {"min_limit_order_volume", pInstrument->MinLimitOrderVolume},
-            {"volume_multiple", pInstrument->VolumeMultiple},
-            {"price_tick", pInstrument->PriceTick},
-            {"create_date", pInstrument->CreateDate},
-            {"open_date", pInstrument->OpenDate},
-            {"expire_date", pInstrument->ExpireDate},
-            {"start_deliv_date", pInstrument->StartDelivDate},
-            {"end_deliv_date", pInstrument->EndDelivDate},
-            {"inst_life_phase", pInstrument->InstLifePhase},
-            {"is_trading", pInstrument->IsTrading},
-            {"position_type", pInstrument->PositionType},
-            {"position_date_type", pInstrument->PositionDateType},
-            {"long_margin_ratio", pInstrument->LongMarginRatio},
-            {"short_margin_ratio", pInstrument->ShortMarginRatio},
-            {"max_margin_side_algorithm", pInstrument->MaxMarginSideAlgorithm},
-            {"strike_price", pInstrument->StrikePrice},
-            {"options_type", pInstrument->OptionsType},
-            {"underlying_multiple", pInstrument->UnderlyingMultiple},
-            {"combination_type", pInstrument->CombinationType},
-            {"instrument_id", pInstrument->InstrumentID},
-            {"exchange_inst_id", pInstrument->ExchangeInstID},
-            {"product_id", pInstrument->ProductID},
-            {"underlying_instr_id", pInstrument->UnderlyingInstrID}
-        }: json {
-            {"req_id", nRequestID},
-            {"is_last", bIsLast}
+    auto callers = queryCallers(nRequestID, bIsLast);
+    const bool catalog = std::find(callers.begin(), callers.end(), catalog_req_.load()) != callers.end();
+    json data = json::object();
+    if (pInstrument) {
+        auto record = ToRecord(*pInstrument);
+        positions_.setMultiplier(pInstrument->InstrumentID, pInstrument->VolumeMultiple);
+        if (catalog) {
+            std::lock_guard<std::mutex> lock(catalog_mutex_);
+            catalog_records_.push_back(record);
         }
-    );
+        data = ToJson(record);
+    }
+    if (catalog && bIsLast) {
+        std::lock_guard<std::mutex> lock(catalog_mutex_);
+        if (pRspInfo && pRspInfo->ErrorID != 0) {
+            warn("Instrument catalog fetch failed: "_s + u8(pRspInfo->ErrorMsg));
+            state_->instruments.release();
+        }
+        else if (state_->instruments.store(catalog_day_, catalog_records_)) {
+            info("Instrument catalog of "_s + catalog_day_ + " stored, " + std::to_string(catalog_records_.size()) + " instruments.");
+        }
+        else {
+            warn("Instrument catalog of "_s + catalog_day_ + " could not be stored.");
+        }
+        catalog_records_.clear();
+        catalog_records_.shrink_to_fit();
+        catalog_req_ = 0;
+    }
+    data["req_id"] = nRequestID;
+    data["is_last"] = bIsLast;
+    reply(TradeMsgCode::QUERY_INSTRUMENT, pRspInfo, std::move(data), callers, nRequestID);
 }
 
 } // namespace tabxx
\ No newline at end of file
@@ -1,32 +1,81 @@
 #ifndef TABXX_TRADER_HANDLER_HPP_
 #define TABXX_TRADER_HANDLER_HPP_
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <climits>
 #include <cstring>
 #include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include <ThostFtdcTraderApi.h>
 
+#include "../Backoff.hpp"
+#include "../Correlation.hpp"
 #include "../Logger.hpp"
 #include "../Types.hpp"
 #include "../Encoding.hpp"
+#include "../SharedState.hpp"
+#include "../Timer.hpp"
 #include "MessageCode.hpp"
 #include "Flags.hpp"
+#include "ExecutionEngine.hpp"
+#include "InstrumentCatalog.hpp"
+#include "OrderTracker.hpp"
+#include "Position.hpp"
+#include "QueryScheduler.hpp"
+#include "RiskEngine.hpp"
 
 namespace tabxx {
-class TraderHandler final: public CThostFtdcTraderSpi {
+// One CTP trader session. Any number of WebSocket clients may be attached:
+// replies go to the client that sent the request, order events to the client
+// that sent the order (and to clients that asked for all of them), other
+// pushes to every client. Once logged in, the session is put in the
+// account's TraderPool entry so later clients can attach without logging in.
+class TraderHandler final: public CThostFtdcTraderSpi, public std::enable_shared_from_this<TraderHandler> {
     using string = std::string;
 
 public:
-    TraderHandler(WebSocket* ws, uWS::Loop* loop, Logger* log, const string& flow): 
-        logger_(log), 
+    // Pooled sessions without clients are dropped after this long.
+    static constexpr int kLingerSeconds = 300;
+    // Milliseconds between CTP queries while no client asked otherwise.
+    static constexpr int kQueryInterval = 1000;
+    // Failed steps of a session restore are retried this many times.
+    static constexpr int kRestoreAttempts = 10;
+
+    TraderHandler(uWS::Loop* loop, Logger* log, const string& flow, SharedState* state): 
+        logger_(log), log_scope_(log ? &log->scope("trade") : nullptr),
         api_(CThostFtdcTraderApi::CreateFtdcTraderApi(flow.c_str())), 
-        ws_(ws), loop_(loop), req_id_(1) {
+        loop_(loop), loop_thread_(std::this_thread::get_id()), state_(state), req_id_(1),
+        orders_(&state->latency),
+        queries_(loop, [this] (const std::vector<int>& callers, int code) {
+            onQueryFailed(callers, {{"code", code}, {"msg", "Query could not be sent"}});
+        }),
+        timer_(loop),
+        restore_timer_(loop),
+        algos_(loop,
+            [this] (const ParentOrder& p, int volume, string& ref) { return sendChild(p, volume, ref); },
+            [this] (const ParentOrder& p, const string& ref) { cancelOrder(p.req_id, ref, p.instrument, p.exchange); },
+            [this] (const ParentOrder& p) {
+                auto data = ToJson(p);
+                data["req_id"] = p.req_id;
+                data["is_last"] = true;
+                send(TradeMsgCode::ALGO_ORDER, json(), data);
+            }) {
         api_->RegisterSpi(this);
+        timer_.every(1000, [this] () { onTimer(); });
     }
     
     ~TraderHandler() {
+        state_->triggers.removeAll(this);
         api_->Release();
         logger_->info("Trade API Released", "destructor");
     }
@@ -39,6 +88,35 @@ public:
 
     void setBrokerID(const std::string& broker_id);
     void setInvestorID(const std::string& investor_id);
+    void setReconcileInterval(int seconds);
+    // Per client; the session spaces its queries by the longest interval
+    // any of its clients asked for.
+    void setQueryInterval(int ms);
+    // Per client: multi-record query replies (instruments, orders,
+    // settlement info) are sent as one message with a `records` array, split
+    // every `chunk_size` bytes when that is non-zero.
+    void setAggregate(bool enable);
+    void setChunkSize(int bytes);
+    // Overrides the client setting for the next query only.
+    void aggregateNext(std::optional<bool> enable);
+    // Per client: attach per-order stage latencies to the events of the
+    // orders it sends.
+    void setLatencyReplies(bool enable);
+    // Answer repeated settlement queries of a trading day from memory.
+    void setSettlementCache(bool enable);
+    // Arrival and parse time of the message being handled, taken by the next
+    // insertOrder(). Loop thread only.
+    inline void stamp(LatencyClock::time_point received, LatencyClock::time_point parsed) noexcept {
+        received_ = received;
+        parsed_ = parsed;
+    }
+    // Client correlation id of the message being handled, null if none; it
+    // is echoed in every reply to the requests the message makes. Loop
+    // thread only.
+    inline void correlate(json cid) {
+        cids_.handle(std::move(cid));
+    }
+    void queryStats();
 
     void getTradingDay();
 
@@ -57,6 +135,7 @@ public:
         CThostFtdcUserLogoutField *pUserLogout, 
         CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
 
+    // The statement is sent as a single SETTLEMENT_INFO once all chunks are in.
     void querySettlementInfo(
         const string& trading_day,
         const string& account_id = "", 
@@ -79,10 +158,21 @@ public:
         const string& account_id = "",
         const string& currency_id = "CNY",
         char biz_type = THOST_FTDC_BZTP_Future);
+    void queryCachedTradingAccount();
     void OnRspQryTradingAccount(
         CThostFtdcTradingAccountField *pTradingAccount, 
         CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
 
+    // Served from the position book; `refresh` forces a query to CTP first.
+    void queryPosition(const string& instrument = "", bool refresh = false);
+    // Per client: POSITION_UPDATE pushes.
+    void subscribePosition(bool enable);
+    void OnRspQryInvestorPosition(
+        CThostFtdcInvestorPositionField *pInvestorPosition, 
+        CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
+
+    // An empty `ref` is allocated by the handler; the ref used is returned
+    // in the PERFORMED reply together with the client's `tag`.
     void insertOrder(
         const string& instrument, const string& exchange,
         const string& ref,
@@ -90,11 +180,34 @@ public:
         OrderOffset offset, int volume, 
         OrderPriceType price_type, TimeCondition time_condition,
         const string& memo = "",
+        const string& tag = "",
         Hedge hedge = Hedge::SPECULATION);
     void OnRspOrderInsert(CThostFtdcInputOrderField*, CThostFtdcRspInfoField*, int, bool) override;
     void OnErrRtnOrderInsert(CThostFtdcInputOrderField*, CThostFtdcRspInfoField*) override;
     void OnRtnOrder(CThostFtdcOrderField*) override;
     void OnRtnTrade(CThostFtdcTradeField*) override;
+    // Updates the pre-trade limits; `limits` holds only the fields to change,
+    // or the per-instrument overrides when it names an instrument.
+    void setRisk(const json& limits);
+    // Orders sent by this session, optionally only those with `tag`.
+    void queryLocalOrders(const string& tag = "");
+    // Conditional orders, held in the server's TriggerBook and sent from the
+    // market data thread once their trigger price is reached.
+    void insertConditional(ConditionalOrder order);
+    void cancelConditional(int id);
+    void queryConditional();
+    // Market data thread, called by the TriggerBook.
+    void fireConditional(const ConditionalOrder& order, double seen, LatencyClock::time_point tick);
+    // Lets go of `session` on its loop thread, where it must be destroyed if
+    // this was the last reference. Any thread.
+    static void ReleaseOnLoop(std::shared_ptr<TraderHandler> session) {
+        auto* loop = session->loop_;
+        loop->defer([session=std::move(session)] () {});
+    }
+    // Parent orders worked by the session's ExecutionEngine.
+    void startAlgo(ParentOrder order);
+    void cancelAlgo(int id);
+    void queryAlgos();
 
     void queryOrder();
     void queryOrderByID(const string& sysID);
@@ -105,6 +218,9 @@ public:
         CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
 
     void deleteOrder(const string& exchange, const string& instrument, int delRef, const string& sysID);
+    // Cancels every working order of the account matching the filters, empty
+    // meaning any, and acknowledges them in a single CANCEL_ALL message.
+    void cancelAll(const string& instrument, const string& exchange, std::optional<Direction> direction);
     void OnRspOrderAction(CThostFtdcInputOrderActionField*, CThostFtdcRspInfoField*, int, bool) override;
     void OnErrRtnOrderAction(CThostFtdcOrderActionField*, CThostFtdcRspInfoField*) override;
     // OnRtnOrder() is defined
@@ -115,7 +231,14 @@ public:
         CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast) override;
 
 public:
-    inline void onClosed() noexcept { ws_ = nullptr; }
+    // Client management, loop thread only.
+    void attach(WebSocket* ws);
+    void detach(WebSocket* ws);
+    // The client whose message is being handled, nullptr when done.
+    void serve(WebSocket* ws) noexcept;
+    // Order events of every client of the session, or only the caller's own.
+    void setOrderEvents(bool all);
+    inline bool loggedIn() const noexcept { return logged_in_; }
         
 private:
     template <typename T>
@@ -135,49 +258,193 @@ private:
 
     inline void info(const string& s) {
         if (logger_) {
-            logger_->info(s, "trade");
+            logger_->info(s, *log_scope_);
         }
     }
 
     inline void warn(const string& s) {
         if (logger_) {
-            logger_->warn(s, "trade");
+            logger_->warn(s, *log_scope_);
         }
     }
 
     inline void error(const string& s) {
         if (logger_) {
-            logger_->error(s, "trade");
+            logger_->error(s, *log_scope_);
+        }
+    }
+
+    // Deferred: the message is put together by the logger's worker.
+    template <typename... Args>
+    inline void debug(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->debug(format, *log_scope_, args...);
+        }
+    }
+
+    template <typename... Args>
+    inline void info(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->info(format, *log_scope_, args...);
+        }
+    }
+
+    template <typename... Args>
+    inline void warn(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->warn(format, *log_scope_, args...);
+        }
+    }
+
+    template <typename... Args>
+    inline void error(const LogFormat& format, const Args&... args) {
+        if (logger_) {
+            logger_->error(format, *log_scope_, args...);
         }
     }
 
+    // Queues a ReqQry* through the scheduler and acknowledges `req_id`.
+    void enqueue(const string& key, int req_id, const string& what, QueryScheduler::Issue issue, bool aggregate = false);
+    // Client callers of upstream request `nRequestID`; on the last response
+    // the query is retired and the next one may go out.
+    std::vector<int> queryCallers(int nRequestID, bool bIsLast);
+    void onQueryFailed(const std::vector<int>& callers, const json& err);
+    bool takeAggregate();
+    // Collects the records of `req_id` into aggregated replies, chunked as
+    // the client being served asked for.
+    void aggregate(int req_id);
+    // Adds `record` to the aggregated reply of `req_id` and sends it when
+    // complete or full. Returns false when `req_id` is not aggregated.
+    bool collect(TradeMsgCode code, int req_id, const CThostFtdcRspInfoField* pRspInfo, const json& record, bool is_last);
+    // Sends a query response to every client caller of `nRequestID`.
+    void reply(TradeMsgCode code, const CThostFtdcRspInfoField* pRspInfo, json&& data, int nRequestID, bool bIsLast);
+    void reply(TradeMsgCode code, const CThostFtdcRspInfoField* pRspInfo, json&& data, const std::vector<int>& callers, int nRequestID);
+
+    void syncPositions();
+    void syncAccount();
+    int reqQryPosition(int req_id);
+    // Fetches the instrument catalog unless it is on hand for this trading day.
+    void fetchCatalog();
+    void onTimer();
+    // Session restore after the front reconnected, loop thread only:
+    // authenticate, login and confirm again as the client did.
+    void restoreStep();
+    void onRestoreStep(bool ok, const string& msg);
+    void retryRestore(const string& msg);
+    // Reply to a step sent by restoreStep(); the client is not told.
+    inline bool isRestoreReply(int nRequestID) const noexcept {
+        return nRequestID < 0 && nRequestID == restore_req_;
+    }
+    int reqAuthenticate(const string& user_id, const string& app_id, const string& auth_code, int req_id);
+    int reqUserLogin(const string& user_id, const string& password, int req_id);
+    // Sends an order as `req_id`, replies with PERFORMED and returns the
+    // CTP return code (-4 if the risk check rejected it). Any thread.
+    int placeOrder(int req_id, OrderTiming timing,
+        const string& instrument, const string& exchange,
+        const string& ref,
+        double price, Direction direction, 
+        OrderOffset offset, int volume, 
+        OrderPriceType price_type, TimeCondition time_condition,
+        const string& memo, const string& tag, Hedge hedge, bool latency,
+        string& ref_used);
+    int sendChild(const ParentOrder& parent, int volume, string& ref);
+    // Cancels an order of this session by its ref.
+    int cancelOrder(int req_id, const string& ref, const string& instrument, const string& exchange);
+    // Hands an order event to the execution engine on the loop thread.
+    // `ref` is set when the event is about an order of this session, which
+    // is tracked from before it is sent: if `order` is empty anyway, the
+    // tracker lost it and a parent order waiting on it would never end.
+    inline void toAlgos(const std::optional<TrackedOrder>& order, const char* ref = nullptr) {
+        if (order)
+            post([this, o=*order] () { algos_.onOrder(o); });
+        else if (ref && *ref)
+            post([this, r=string(ref)] () { algos_.onUntracked(r); });
+    }
+    void sendPositions(TradeMsgCode code, int req_id, const string& instrument = "");
+
+    // Key of an order of this session, as used by the risk engine.
+    inline string orderKey(const char* ref) const {
+        return std::to_string(front_id_.load()) + ":" + std::to_string(session_id_.load()) + ":" + ref;
+    }
+
     inline void performed(int req_id, int err, const string& msg = "") {
-        send(TradeMsgCode::PERFORMED, {{"code", err}}, {{"req_id", req_id}, {"msg", msg}});
-    }
-
-    inline void send(json&& data) {
-        if (ws_) {
-            try {
-                loop_->defer([d=std::move(data), ws=ws_] () {
-                    if (ws) {
-                        ws->send(d.dump(), uWS::OpCode::TEXT);
-                    }
-                });
-            } catch (const std::exception& e) {
-                logger_->error("tabxx::TraderHandler::send(): Exception caught. what(): "_s + e.what());
-            }
+        json info {{"req_id", req_id}, {"msg", msg}};
+        correlated(req_id, info);
+        send(TradeMsgCode::PERFORMED, {{"code", err}}, info);
+    }
+
+    inline void queued(int req_id, size_t depth) {
+        json info {{"req_id", req_id}, {"msg", ""}, {"queue_depth", depth}};
+        correlated(req_id, info);
+        send(TradeMsgCode::PERFORMED, {{"code", 0}}, info);
+    }
+
+    // Binds the cid of the client message being handled to `req_id` and
+    // echoes it in `info`. Acknowledgements sent from other threads (a
+    // conditional order firing) belong to no client message.
+    inline void correlated(int req_id, json& info) {
+        if (std::this_thread::get_id() != loop_thread_ || cids_.current().is_null())
+            return;
+        cids_.bind(req_id);
+        info["cid"] = cids_.current();
+    }
+
+    // Runs `f` on the loop thread unless this handler is gone by then.
+    template <typename F>
+    inline void post(F&& f) {
+        loop_->defer([alive=std::weak_ptr<int>(alive_), f=std::forward<F>(f)] () {
+            if (alive.lock())
+                f();
+        });
+    }
+
+    // Routes to the owner of `route` (a client req_id), by default the
+    // req_id in `info`; kBroadcast sends to every client.
+    static constexpr int kBroadcast = INT_MIN;
+
+    inline void send(json&& data, int route = 0) {
+        if (route == 0 && data.contains("info") && data["info"].is_object())
+            route = data["info"].value("req_id", 0);
+        if (route != 0 && route != kBroadcast)
+            cids_.tag(data, route);
+        const int origin = std::this_thread::get_id() == loop_thread_ ? current_ : 0;
+        const int code = data.value("msg", 0);
+        try {
+            post([this, origin, route, code, d=std::move(data)] () {
+                Frame frame(d);
+                deliver(origin, route, code, frame);
+            });
+        } catch (const std::exception& e) {
+            logger_->error("tabxx::TraderHandler::send(): Exception caught. what(): "_s + e.what());
         }
     }
 
-    inline void send(TradeMsgCode code, const json& err, const json& info) {
+    // Sends an already serialized message.
+    inline void sendFrame(string&& frame, TradeMsgCode code, int route) {
+        const int origin = std::this_thread::get_id() == loop_thread_ ? current_ : 0;
+        try {
+            post([this, origin, route, code, f=std::move(frame)] () {
+                Frame text {std::string_view(f)};
+                deliver(origin, route, static_cast<int>(code), text);
+            });
+        } catch (const std::exception& e) {
+            logger_->error("tabxx::TraderHandler::sendFrame(): Exception caught. what(): "_s + e.what());
+        }
+    }
+
+    // Loop thread. `origin` is the client being served when the message was
+    // produced, 0 if none. Each client gets the frame in its own encoding.
+    void deliver(int origin, int route, int code, Frame& frame);
+
+    inline void send(TradeMsgCode code, const json& err, const json& info, int route = 0) {
         send({
             {"msg", code},
             {"err", err},
             {"info", info}
-        });
+        }, route);
     }
 
-    inline void send(TradeMsgCode code, const CThostFtdcRspInfoField *pRspInfo, const json& info) {
+    inline void send(TradeMsgCode code, const CThostFtdcRspInfoField *pRspInfo, const json& info, int route = 0) {
         send({
             {"msg", code},
             {"err", pRspInfo? json {
@@ -185,18 +452,106 @@ private:
                 {"msg", u8(pRspInfo->ErrorMsg)}
             }: json()},
             {"info", info}
-        });
+        }, route);
     }
 
 private:
     Logger* logger_;
+    const LogScope* log_scope_;
     CThostFtdcTraderApi* api_;
-    WebSocket* ws_;
     uWS::Loop* loop_;
+    std::thread::id loop_thread_;
+    SharedState* state_;
     std::atomic<int> req_id_;
     string broker_id_;
     string investor_id_;
 
+    PositionBook positions_;
+    std::mutex position_mutex_;
+    std::unordered_map<int, string> position_waiters_;  // req_id -> instrument filter
+    std::atomic<int> position_sync_req_ {0};
+    std::atomic<int> account_sync_req_ {0};
+    std::atomic<bool> position_due_ {false};
+    std::atomic<bool> account_due_ {false};
+    std::atomic<bool> position_push_ {false};     // any client subscribed
+    std::atomic<bool> logged_in_ {false};
+    std::atomic<int> front_id_ {0};
+    std::atomic<int> session_id_ {0};
+    std::atomic<int> reconcile_interval_ {60};
+    std::atomic<int> internal_req_id_ {-1};  // internal queries count down, never clash with clients
+    std::atomic<int> catalog_req_ {0};
+    string catalog_applied_;   // trading day whose multipliers are in the position book
+    std::mutex catalog_mutex_;  // set up on the loop, filled on the CTP thread
+    string catalog_day_;
+    std::vector<InstrumentRecord> catalog_records_;
+    std::optional<bool> next_aggregate_;
+    struct Aggregate {
+        string records;     // serialized so far
+        size_t chunk;
+    };
+    std::mutex aggregate_mutex_;
+    std::unordered_map<int, Aggregate> aggregates_;  // req_id -> reply so far
+    RiskEngine risk_;
+    OrderTracker orders_;
+    struct Settlement {
+        json head;          // the first record, without its content
+        string content;     // raw GBK chunks
+    };
+    std::unordered_map<int, Settlement> settlement_parts_;  // CTP thread only, upstream ReqID -> statement so far
+    std::atomic<bool> settlement_cache_enabled_ {true};
+    std::mutex settlement_mutex_;
+    std::unordered_map<int, string> settlement_keys_;   // upstream ReqID -> cache key
+    string settlement_day_;                             // trading day of the cached statements
+    std::unordered_map<string, json> settlements_;      // cache key -> statement
+    // Loop thread only.
+    struct Client {
+        int id;
+        WebSocket* ws;
+        bool all_orders;
+        Wire wire;
+        bool aggregate = false;
+        size_t chunk_size = 0;
+        bool latency = false;
+        bool positions = false;     // POSITION_UPDATE pushes
+        int query_interval = -1;    // ms, -1 when not set
+    };
+    // The client being served, nullptr if none.
+    Client* client();
+    // Applies what the clients' options add up to for the session.
+    void applyClientOptions();
+    std::vector<Client> clients_;
+    int next_client_ = 1;
+    int current_ = 0;
+    std::map<int, int> owners_;     // client req_id -> client id
+    Correlation cids_;
+    int idle_seconds_ = 0;
+    string login_user_;
+    string login_password_;
+    // What the client set the session up with, replayed by restoreStep().
+    enum class RestoreStep { AUTH, LOGIN, CONFIRM };
+    struct Restore {
+        string auth_user;
+        string app_id;
+        string auth_code;
+        string user_id;
+        string password;
+    };
+    Restore restore_;
+    RestoreStep restore_step_ = RestoreStep::LOGIN;
+    Backoff restore_backoff_ {500, 30000};
+    std::atomic<bool> restore_wanted_ {false};      // logged in and not logged out
+    std::atomic<bool> restore_confirm_ {false};     // settlement was confirmed
+    std::atomic<bool> restoring_ {false};
+    std::atomic<int> restore_req_ {0};
+    LatencyClock::time_point received_;
+    LatencyClock::time_point parsed_;
+    int seconds_since_sync_ = 0;
+    std::shared_ptr<int> alive_ = std::make_shared<int>(0);
+    QueryScheduler queries_;
+    Timer timer_;
+    Timer restore_timer_;
+    ExecutionEngine algos_;
+
 }; // class TraderHandler
 
 } // namespace tabxx
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../Encoding.hpp"
+#include "InstrumentCatalog.hpp"
+
+namespace tabxx {
+namespace {
+
+namespace fs = std::filesystem;
+
+const char* kPrefix = "instruments_";
+const char* kSuffix = ".bin";
+
+template <size_t N>
+void Copy(char (&dst)[N], const char* src) {
+    size_t n = strnlen(src, N - 1);
+    // Do not cut a UTF-8 sequence in half.
+    if (src[n] != '\0') {
+        while (n > 0 && (static_cast<unsigned char>(src[n]) & 0xC0) == 0x80)
+            --n;
+    }
+    std::memcpy(dst, src, n);
+    std::memset(dst + n, 0, N - n);
+}
+
+template <size_t N>
+std::string_view View(const char (&s)[N]) {
+    return std::string_view(s, strnlen(s, N));
+}
+
+} // namespace
+
+InstrumentRecord ToRecord(const CThostFtdcInstrumentField& f) {
+    InstrumentRecord r;
+    std::memset(&r, 0, sizeof(r));
+    Copy(r.instrument_id, f.InstrumentID);
+    Copy(r.exchange_id, f.ExchangeID);
+    Copy(r.exchange_inst_id, f.ExchangeInstID);
+    Copy(r.product_id, f.ProductID);
+    Copy(r.underlying_instr_id, f.UnderlyingInstrID);
+    Copy(r.instrument_name, u8(f.InstrumentName).c_str());
+    Copy(r.create_date, f.CreateDate);
+    Copy(r.open_date, f.OpenDate);
+    Copy(r.expire_date, f.ExpireDate);
+    Copy(r.start_deliv_date, f.StartDelivDate);
+    Copy(r.end_deliv_date, f.EndDelivDate);
+    r.product_class = f.ProductClass;
+    r.inst_life_phase = f.InstLifePhase;
+    r.position_type = f.PositionType;
+    r.position_date_type = f.PositionDateType;
+    r.max_margin_side_algorithm = f.MaxMarginSideAlgorithm;
+    r.options_type = f.OptionsType;
+    r.combination_type = f.CombinationType;
+    r.is_trading = f.IsTrading;
+    r.delivery_year = f.DeliveryYear;
+    r.delivery_month = f.DeliveryMonth;
+    r.max_market_order_volume = f.MaxMarketOrderVolume;
+    r.min_market_order_volume = f.MinMarketOrderVolume;
+    r.max_limit_order_volume = f.MaxLimitOrderVolume;
+    r.min_limit_order_volume = f.MinLimitOrderVolume;
+    r.volume_multiple = f.VolumeMultiple;
+    r.price_tick = f.PriceTick;
+    r.long_margin_ratio = f.LongMarginRatio;
+    r.short_margin_ratio = f.ShortMarginRatio;
+    r.strike_price = f.StrikePrice;
+    r.underlying_multiple = f.UnderlyingMultiple;
+    return r;
+}
+
+nlohmann::json ToJson(const InstrumentRecord& r) {
+    return nlohmann::json {
+        {"exchange_id", View(r.exchange_id)},
+        {"instrument_name", View(r.instrument_name)},
+        {"product_class", r.product_class},
+        {"delivery_year", r.delivery_year},
+        {"delivery_month", r.delivery_month},
+        {"max_market_order_volume", r.max_market_order_volume},
+        {"min_market_order_volume", r.min_market_order_volume},
+        {"max_limit_order_volume", r.max_limit_order_volume},
+        {"min_limit_order_volume", r.min_limit_order_volume},
+        {"volume_multiple", r.volume_multiple},
+        {"price_tick", r.price_tick},
+        {"create_date", View(r.create_date)},
+        {"open_date", View(r.open_date)},
+        {"expire_date", View(r.expire_date)},
+        {"start_deliv_date", View(r.start_deliv_date)},
+        {"end_deliv_date", View(r.end_deliv_date)},
+        {"inst_life_phase", r.inst_life_phase},
+        {"is_trading", r.is_trading},
+        {"position_type", r.position_type},
+        {"position_date_type", r.position_date_type},
+        {"long_margin_ratio", r.long_margin_ratio},
+        {"short_margin_ratio", r.short_margin_ratio},
+        {"max_margin_side_algorithm", r.max_margin_side_algorithm},
+        {"strike_price", r.strike_price},
+        {"options_type", r.options_type},
+        {"underlying_multiple", r.underlying_multiple},
+        {"combination_type", r.combination_type},
+        {"instrument_id", View(r.instrument_id)},
+        {"exchange_inst_id", View(r.exchange_inst_id)},
+        {"product_id", View(r.product_id)},
+        {"underlying_instr_id", View(r.underlying_instr_id)}
+    };
+}
+
+InstrumentCatalog::Snapshot::~Snapshot() {
+    if (map_)
+        munmap(map_, map_size_);
+}
+
+const InstrumentRecord* InstrumentCatalog::Snapshot::find(std::string_view instrument) const {
+    auto it = by_instrument_.find(instrument);
+    return it == by_instrument_.end() ? nullptr : records_ + it->second;
+}
+
+std::vector<const InstrumentRecord*> InstrumentCatalog::Snapshot::select(
+    const string& exchange, const string& instrument,
+    const string& exchange_inst_id, const string& product) const {
+    auto match = [&] (const InstrumentRecord& r) {
+        return (exchange.empty() || View(r.exchange_id) == exchange)
+            && (instrument.empty() || View(r.instrument_id) == instrument)
+            && (exchange_inst_id.empty() || View(r.exchange_inst_id) == exchange_inst_id)
+            && (product.empty() || View(r.product_id) == product);
+    };
+    std::vector<const InstrumentRecord*> out;
+    if (!instrument.empty()) {
+        auto r = find(instrument);
+        if (r && match(*r))
+            out.push_back(r);
+        return out;
+    }
+    // Start from the narrowest index available.
+    const std::vector<uint32_t>* candidates = nullptr;
+    if (!product.empty()) {
+        auto it = by_product_.find(product);
+        if (it == by_product_.end())
+            return out;
+        candidates = &it->second;
+    }
+    else if (!exchange.empty()) {
+        auto it = by_exchange_.find(exchange);
+        if (it == by_exchange_.end())
+            return out;
+        candidates = &it->second;
+    }
+    if (candidates) {
+        for (auto i : *candidates) {
+            if (match(records_[i]))
+                out.push_back(records_ + i);
+        }
+        return out;
+    }
+    out.reserve(count_);
+    for (const auto& r : *this) {
+        if (match(r))
+            out.push_back(&r);
+    }
+    return out;
+}
+
+void InstrumentCatalog::open(const string& dir) {
+    string newest;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dir_ = dir;
+    }
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(kPrefix, 0) != 0 || name.size() <= std::strlen(kSuffix)
+            || name.compare(name.size() - std::strlen(kSuffix), string::npos, kSuffix) != 0)
+            continue;
+        // Trading days are yyyymmdd, so names sort by date.
+        newest = std::max(newest, name);
+    }
+    if (newest.empty())
+        return;
+    auto snapshot = load((fs::path(dir) / newest).string());
+    std::lock_guard<std::mutex> lock(mutex_);
+    current_ = std::move(snapshot);
+}
+
+std::shared_ptr<const InstrumentCatalog::Snapshot> InstrumentCatalog::snapshot() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return current_;
+}
+
+std::shared_ptr<const InstrumentCatalog::Snapshot> InstrumentCatalog::get(const string& trading_day) {
+    if (trading_day.empty())
+        return nullptr;
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (current_ && current_->tradingDay() == trading_day)
+        return current_;
+    if (dir_.empty())
+        return nullptr;
+    auto file = path(trading_day);
+    lock.unlock();
+    auto snapshot = load(file);
+    if (!snapshot || snapshot->tradingDay() != trading_day)
+        return nullptr;
+    lock.lock();
+    current_ = snapshot;
+    return snapshot;
+}
+
+bool InstrumentCatalog::claim(const string& trading_day) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (trading_day.empty() || !fetching_.empty())
+        return false;
+    if (current_ && current_->tradingDay() == trading_day)
+        return false;
+    fetching_ = trading_day;
+    return true;
+}
+
+void InstrumentCatalog::release() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    fetching_.clear();
+}
+
+bool InstrumentCatalog::store(const string& trading_day, const std::vector<InstrumentRecord>& records) {
+    string dir, file;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        fetching_.clear();
+        dir = dir_;
+        file = path(trading_day);
+    }
+    if (dir.empty() || trading_day.empty())
+        return false;
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    FileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.record_size = sizeof(InstrumentRecord);
+    header.count = records.size();
+    std::memcpy(header.trading_day, trading_day.data(), std::min(trading_day.size(), sizeof(header.trading_day) - 1));
+    // Write aside and rename, a reader never sees a partial file.
+    const string tmp = file + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(InstrumentRecord));
+        if (!out)
+            return false;
+    }
+    fs::rename(tmp, file, ec);
+    if (ec)
+        return false;
+    auto snapshot = load(file);
+    if (!snapshot)
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_ = snapshot;
+    }
+    // Older trading days are of no further use.
+    for (const auto& entry : fs::directory_iterator(dir, ec)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind(kPrefix, 0) == 0 && entry.path() != fs::path(file))
+            fs::remove(entry.path(), ec);
+    }
+    return true;
+}
+
+std::string InstrumentCatalog::path(const string& trading_day) const {
+    return (fs::path(dir_) / (kPrefix + trading_day + kSuffix)).string();
+}
+
+std::shared_ptr<const InstrumentCatalog::Snapshot> InstrumentCatalog::load(const string& file) const {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FileHeader)) {
+        ::close(fd);
+        return nullptr;
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return nullptr;
+    std::shared_ptr<Snapshot> s(new Snapshot());
+    s->map_ = map;
+    s->map_size_ = size;
+    const auto* header = static_cast<const FileHeader*>(map);
+    if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0
+        || header->version != kVersion
+        || header->record_size != sizeof(InstrumentRecord)
+        || size != sizeof(FileHeader) + header->count * sizeof(InstrumentRecord))
+        return nullptr;
+    s->records_ = reinterpret_cast<const InstrumentRecord*>(static_cast<const char*>(map) + sizeof(FileHeader));
+    s->count_ = header->count;
+    s->trading_day_ = string(View(header->trading_day));
+    s->by_instrument_.reserve(s->count_);
+    for (uint32_t i = 0; i < s->count_; ++i) {
+        const auto& r = s->records_[i];
+        s->by_instrument_.emplace(View(r.instrument_id), i);
+        s->by_exchange_[View(r.exchange_id)].push_back(i);
+        s->by_product_[View(r.product_id)].push_back(i);
+    }
+    return s;
+}
+
+} // namespace tabxx
@@ -0,0 +1,141 @@
+#ifndef TABXX_TRADE_INSTRUMENT_CATALOG_HPP_
+#define TABXX_TRADE_INSTRUMENT_CATALOG_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include <ThostFtdcTraderApi.h>
+#include <json.hpp>
+
+namespace tabxx {
+
+// Compact, fixed-layout copy of CThostFtdcInstrumentField.
+// Written to disk as is, so only append fields and bump the file version.
+struct InstrumentRecord {
+    char instrument_id[32];
+    char exchange_id[12];
+    char exchange_inst_id[32];
+    char product_id[32];
+    char underlying_instr_id[32];
+    char instrument_name[64];   // UTF-8
+    char create_date[9];
+    char open_date[9];
+    char expire_date[9];
+    char start_deliv_date[9];
+    char end_deliv_date[9];
+    char product_class;
+    char inst_life_phase;
+    char position_type;
+    char position_date_type;
+    char max_margin_side_algorithm;
+    char options_type;
+    char combination_type;
+    int32_t is_trading;
+    int32_t delivery_year;
+    int32_t delivery_month;
+    int32_t max_market_order_volume;
+    int32_t min_market_order_volume;
+    int32_t max_limit_order_volume;
+    int32_t min_limit_order_volume;
+    int32_t volume_multiple;
+    double price_tick;
+    double long_margin_ratio;
+    double short_margin_ratio;
+    double strike_price;
+    double underlying_multiple;
+};
+
+static_assert(std::is_trivially_copyable_v<InstrumentRecord>, "InstrumentRecord is stored raw");
+
+InstrumentRecord ToRecord(const CThostFtdcInstrumentField& f);
+nlohmann::json ToJson(const InstrumentRecord& r);
+
+// Instrument list of one trading day, shared by every trade session.
+//
+// The first session that logs in on a new trading day fetches the full list
+// from CTP and stores it as `<dir>/instruments_<trading day>.bin`; the file is
+// memory-mapped and indexed, later sessions (and restarts on the same day)
+// are answered from memory.
+class InstrumentCatalog {
+    using string = std::string;
+public:
+    // An immutable, loaded catalog. Records point into the mapped file.
+    class Snapshot {
+    public:
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        ~Snapshot();
+
+        const string& tradingDay() const noexcept { return trading_day_; }
+        size_t size() const noexcept { return count_; }
+        const InstrumentRecord* begin() const noexcept { return records_; }
+        const InstrumentRecord* end() const noexcept { return records_ + count_; }
+
+        const InstrumentRecord* find(std::string_view instrument) const;
+        // Same filters as ReqQryInstrument, empty matches everything.
+        std::vector<const InstrumentRecord*> select(
+            const string& exchange, const string& instrument,
+            const string& exchange_inst_id, const string& product) const;
+
+    private:
+        friend class InstrumentCatalog;
+        Snapshot() = default;
+
+        void* map_ = nullptr;
+        size_t map_size_ = 0;
+        const InstrumentRecord* records_ = nullptr;
+        size_t count_ = 0;
+        string trading_day_;
+        std::unordered_map<std::string_view, uint32_t> by_instrument_;
+        std::unordered_map<std::string_view, std::vector<uint32_t>> by_exchange_;
+        std::unordered_map<std::string_view, std::vector<uint32_t>> by_product_;
+    };
+
+    // Sets the directory for catalog files and loads the newest one found.
+    void open(const string& dir);
+
+    // The loaded catalog, nullptr if none.
+    std::shared_ptr<const Snapshot> snapshot() const;
+    // The loaded catalog if it belongs to `trading_day`, loading it from disk when present.
+    std::shared_ptr<const Snapshot> get(const string& trading_day);
+
+    // Returns true when the caller should fetch `trading_day` from CTP;
+    // only one session does. release() gives the claim back after a failure.
+    bool claim(const string& trading_day);
+    void release();
+
+    // Persists the fetched records and makes them the loaded catalog.
+    bool store(const string& trading_day, const std::vector<InstrumentRecord>& records);
+
+private:
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t count;
+        char trading_day[16];
+    };
+
+    static constexpr char kMagic[8] = {'W', 'C', 'T', 'P', 'I', 'N', 'S', 'T'};
+    static constexpr uint32_t kVersion = 1;
+
+    string path(const string& trading_day) const;
+    std::shared_ptr<const Snapshot> load(const string& file) const;
+
+private:
+    mutable std::mutex mutex_;
+    string dir_;
+    std::shared_ptr<const Snapshot> current_;
+    string fetching_;   // trading day being fetched, empty if none
+
+}; // class InstrumentCatalog
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_INSTRUMENT_CATALOG_HPP_
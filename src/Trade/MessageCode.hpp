@@ -25,7 +25,20 @@ enum class TradeMsgCode {
     ORDER_DELETE_ERROR,
     ORDER_DELETE_RETURN_ERROR,
     ORDER_DELETED,
-    QUERY_INSTRUMENT
+    QUERY_INSTRUMENT,
+    QUERY_POSITION,
+    POSITION_UPDATE,
+    POSITION_DRIFT,
+    QUERY_STATS,
+    RISK_LIMITS,
+    LOCAL_ORDERS,
+    ATTACHED,
+    CANCEL_ALL,
+    RESTORED,
+    CONDITIONAL_ORDER,
+    CONDITIONAL_ORDERS,
+    ALGO_ORDER,
+    ALGO_ORDERS
 };
 
 } // namespace tabxx
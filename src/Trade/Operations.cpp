@@ -34,6 +34,143 @@ void TraderHandler::setInvestorID(const std::string& investor_id) {
     performed(req, 0);
 }
 
+void TraderHandler::setReconcileInterval(int seconds) {
+    int req = req_id_++;
+    if (seconds < 0) {
+        performed(req, -1);
+        return;
+    }
+    reconcile_interval_ = seconds;
+    info("Client set position reconcile interval to: "_s + std::to_string(seconds) + "s");
+    performed(req, 0);
+}
+
+void TraderHandler::setQueryInterval(int ms) {
+    int req = req_id_++;
+    if (ms < 0) {
+        performed(req, -1);
+        return;
+    }
+    if (auto* c = client())
+        c->query_interval = ms;
+    applyClientOptions();
+    info("Client set query interval to: "_s + std::to_string(ms) + "ms");
+    performed(req, 0);
+}
+
+void TraderHandler::setAggregate(bool enable) {
+    int req = req_id_++;
+    if (auto* c = client())
+        c->aggregate = enable;
+    info("Client "_s + (enable ? "enabled" : "disabled") + " aggregated query replies.");
+    performed(req, 0);
+}
+
+void TraderHandler::setLatencyReplies(bool enable) {
+    int req = req_id_++;
+    if (auto* c = client())
+        c->latency = enable;
+    info("Client "_s + (enable ? "enabled" : "disabled") + " latency in order replies.");
+    performed(req, 0);
+}
+
+void TraderHandler::setSettlementCache(bool enable) {
+    int req = req_id_++;
+    settlement_cache_enabled_ = enable;
+    if (!enable) {
+        std::lock_guard<std::mutex> lock(settlement_mutex_);
+        settlements_.clear();
+    }
+    info("Client "_s + (enable ? "enabled" : "disabled") + " the settlement info cache.");
+    performed(req, 0);
+}
+
+void TraderHandler::setChunkSize(int bytes) {
+    int req = req_id_++;
+    if (bytes < 0) {
+        performed(req, -1);
+        return;
+    }
+    if (auto* c = client())
+        c->chunk_size = static_cast<size_t>(bytes);
+    info("Client set aggregated reply chunk size to: "_s + std::to_string(bytes));
+    performed(req, 0);
+}
+
+void TraderHandler::aggregateNext(std::optional<bool> enable) {
+    next_aggregate_ = enable;
+}
+
+bool TraderHandler::takeAggregate() {
+    const auto* c = client();
+    bool aggregate = next_aggregate_.value_or(c && c->aggregate);
+    next_aggregate_.reset();
+    return aggregate;
+}
+
+void TraderHandler::aggregate(int req_id) {
+    const auto* c = client();
+    std::lock_guard<std::mutex> lock(aggregate_mutex_);
+    aggregates_[req_id] = Aggregate {"", c ? c->chunk_size : 0};
+}
+
+bool TraderHandler::collect(TradeMsgCode code, int req_id, const CThostFtdcRspInfoField* pRspInfo, const json& record, bool is_last) {
+    std::unique_lock<std::mutex> lock(aggregate_mutex_);
+    auto it = aggregates_.find(req_id);
+    if (it == aggregates_.end())
+        return false;
+    auto& records = it->second.records;
+    if (!record.empty()) {
+        if (!records.empty())
+            records += ',';
+        records += record.dump();
+    }
+    const size_t chunk = it->second.chunk;
+    if (!is_last && (chunk == 0 || records.size() < chunk))
+        return true;
+    // Assembled by hand so the records are serialized once; keys in the
+    // order json::dump() would give them.
+    json err = pRspInfo && is_last ? json {
+        {"code", pRspInfo->ErrorID},
+        {"msg", u8(pRspInfo->ErrorMsg)}
+    }: json();
+    const json cid = cids_.find(req_id);
+    string frame = "{\"err\":" + err.dump()
+        + ",\"info\":{" + (cid.is_null() ? "" : "\"cid\":" + cid.dump() + ",")
+        + "\"is_last\":" + (is_last ? "true" : "false")
+        + ",\"records\":[" + records
+        + "],\"req_id\":" + std::to_string(req_id)
+        + "},\"msg\":" + std::to_string(static_cast<int>(code)) + "}";
+    if (is_last)
+        aggregates_.erase(it);
+    else
+        records.clear();
+    lock.unlock();
+    sendFrame(std::move(frame), code, req_id);
+    return true;
+}
+
+void TraderHandler::queryStats() {
+    int req_id = req_id_++;
+    auto s = queries_.stats();
+    const auto text = u8_cache_stats();
+    performed(req_id, 0);
+    send(TradeMsgCode::QUERY_STATS, json(), {
+        {"req_id", req_id},
+        {"is_last", true},
+        {"queue_depth", s.queue_depth},
+        {"in_flight", s.in_flight},
+        {"issued", s.issued},
+        {"coalesced", s.coalesced},
+        {"retries", s.retries},
+        {"failed", s.failed},
+        {"avg_wait_ms", s.avg_wait_ms},
+        {"max_wait_ms", s.max_wait_ms},
+        {"text_cache_hits", text.hits},
+        {"text_cache_misses", text.misses}
+    });
+}
+
 void TraderHandler::getTradingDay() {
     auto trading_day = api_->GetTradingDay();
     info("Client query TradingDay. Trading Day: "_s + std::string(trading_day));
@@ -42,31 +179,126 @@ void TraderHandler::getTradingDay() {
     });
 }
 
-void TraderHandler::auth(const string& user_id, const string& app_id, const string& auth_code) {
+int TraderHandler::reqAuthenticate(const string& user_id, const string& app_id, const string& auth_code, int req_id) {
     CThostFtdcReqAuthenticateField f;
     clear(&f);
     copy(f.BrokerID, broker_id_);
     copy(f.AppID, app_id);
     copy(f.AuthCode, auth_code);
     copy(f.UserID, user_id);
-    int req_id = req_id_++;
-    int err = api_->ReqAuthenticate(&f, req_id);
-    info("Client sent authentication request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(err));
-    performed(req_id, err);
+    return api_->ReqAuthenticate(&f, req_id);
 }
 
-void TraderHandler::login(const std::string& user_id, const std::string& password) {
+int TraderHandler::reqUserLogin(const string& user_id, const string& password, int req_id) {
     CThostFtdcReqUserLoginField f;
     clear(&f);
     copy(f.BrokerID, broker_id_);
     copy(f.UserID, user_id);
     copy(f.Password, password);
+    // Kept until the response, a successful login puts the session in the pool.
+    login_user_ = user_id;
+    login_password_ = password;
+    return api_->ReqUserLogin(&f, req_id);
+}
+
+void TraderHandler::auth(const string& user_id, const string& app_id, const string& auth_code) {
+    restore_.auth_user = user_id;
+    restore_.app_id = app_id;
+    restore_.auth_code = auth_code;
+    int req_id = req_id_++;
+    int err = reqAuthenticate(user_id, app_id, auth_code, req_id);
+    info("Client sent authentication request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(err));
+    performed(req_id, err);
+}
+
+void TraderHandler::login(const std::string& user_id, const std::string& password) {
     int req_id = req_id_ ++;
-    auto ret = api_->ReqUserLogin(&f, req_id);
+    auto ret = reqUserLogin(user_id, password, req_id);
     info("Client sent login request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
     performed(req_id, ret);
 }
 
+void TraderHandler::restoreStep() {
+    if (!restoring_)
+        return;
+    int req_id = internal_req_id_--;
+    restore_req_ = req_id;
+    int ret = 0;
+    string step;
+    switch (restore_step_) {
+    case RestoreStep::AUTH:
+        step = "authentication";
+        ret = reqAuthenticate(restore_.auth_user, restore_.app_id, restore_.auth_code, req_id);
+        break;
+    case RestoreStep::LOGIN:
+        step = "login";
+        ret = reqUserLogin(restore_.user_id, restore_.password, req_id);
+        break;
+    case RestoreStep::CONFIRM: {
+        step = "settlement info confirm";
+        CThostFtdcSettlementInfoConfirmField f;
+        clear(&f);
+        copy(f.BrokerID, broker_id_);
+        copy(f.InvestorID, investor_id_);
+        ret = api_->ReqSettlementInfoConfirm(&f, req_id);
+        break;
+    }
+    }
+    info("Restoring session, sent "_s + step + " request. ReqID: " + std::to_string(req_id) + "; Return: " + std::to_string(ret));
+    if (ret != 0)
+        retryRestore(step + " request could not be sent (" + std::to_string(ret) + ")");
+}
+
+void TraderHandler::onRestoreStep(bool ok, const string& msg) {
+    if (!restoring_)
+        return;
+    restore_req_ = 0;
+    if (!ok) {
+        retryRestore(msg);
+        return;
+    }
+    switch (restore_step_) {
+    case RestoreStep::AUTH:
+        restore_step_ = RestoreStep::LOGIN;
+        restoreStep();
+        return;
+    case RestoreStep::LOGIN:
+        if (restore_confirm_) {
+            restore_step_ = RestoreStep::CONFIRM;
+            restoreStep();
+            return;
+        }
+        break;
+    case RestoreStep::CONFIRM:
+        break;
+    }
+    restoring_ = false;
+    info("Session restored after "_s + std::to_string(restore_backoff_.attempts()) + " attempt(s).");
+    send(TradeMsgCode::RESTORED, json(), {
+        {"trading_day", api_->GetTradingDay()},
+        {"front_id", front_id_.load()},
+        {"session_id", session_id_.load()},
+        {"attempts", restore_backoff_.attempts()}
+    }, kBroadcast);
+    restore_backoff_.reset();
+}
+
+void TraderHandler::retryRestore(const string& msg) {
+    if (restore_backoff_.attempts() >= kRestoreAttempts) {
+        restoring_ = false;
+        restore_wanted_ = false;
+        error("Session restore given up: "_s + msg);
+        send(TradeMsgCode::RESTORED, {{"code", -1}, {"msg", msg}}, {
+            {"attempts", restore_backoff_.attempts()}
+        }, kBroadcast);
+        restore_backoff_.reset();
+        return;
+    }
+    const int ms = restore_backoff_.next();
+    warn("Session restore step failed: "_s + msg + "; Retrying in " + std::to_string(ms) + "ms");
+    restore_timer_.once(ms, [this] () { restoreStep(); });
+}
+
 void TraderHandler::logout(const std::string& user_id) {
     CThostFtdcUserLogoutField f;
     clear(&f);
@@ -89,10 +321,43 @@ void TraderHandler::querySettlementInfo(
     copy(f.AccountID, account_id);
     copy(f.CurrencyID, currency_id);
     copy(f.TradingDay, trading_day);
-    int req_id = req_id_++;
-    auto ret = api_->ReqQrySettlementInfo(&f, req_id);
-    info("Client sent settlement info query request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    const string key = "settlement|" + trading_day + "|" + account_id + "|" + currency_id;
+    if (settlement_cache_enabled_) {
+        const string day = api_->GetTradingDay();
+        json cached;
+        {
+            std::lock_guard<std::mutex> lock(settlement_mutex_);
+            if (settlement_day_ != day) {
+                settlements_.clear();
+                settlement_day_ = day;
+            }
+            auto it = settlements_.find(key);
+            if (it != settlements_.end())
+                cached = it->second;
+        }
+        if (!cached.is_null()) {
+            int req_id = req_id_++;
+            info("Client settlement info query answered from the cache of "_s + day + ". ReqID: " + std::to_string(req_id));
+            if (takeAggregate())
+                aggregate(req_id);
+            performed(req_id, 0);
+            if (collect(TradeMsgCode::SETTLEMENT_INFO, req_id, nullptr, cached, true))
+                return;
+            cached["req_id"] = req_id;
+            cached["is_last"] = true;
+            send(TradeMsgCode::SETTLEMENT_INFO, json(), cached);
+            return;
+        }
+    }
+    enqueue(key, req_id_++, "settlement info query",
+        [this, f, key] (int id) mutable {
+            {
+                std::lock_guard<std::mutex> lock(settlement_mutex_);
+                settlement_keys_[id] = key;
+            }
+            return api_->ReqQrySettlementInfo(&f, id);
+        },
+        takeAggregate());
 }
 
 void TraderHandler::confirmSettlementInfo(
@@ -127,10 +392,363 @@ void TraderHandler::queryTradingAccount(
     copy(f.AccountID, account_id);
     copy(f.CurrencyID, currency_id);
     f.BizType = biz_type;
+    // Same key as the internal account sync, so a client query rides along with it.
+    enqueue("account|" + account_id + "|" + currency_id + "|" + biz_type, req_id_++, "trading account query",
+        [this, f] (int id) mutable { return api_->ReqQryTradingAccount(&f, id); });
+}
+
+void TraderHandler::queryCachedTradingAccount() {
     int req_id = req_id_++;
-    auto ret = api_->ReqQryTradingAccount(&f, req_id);
-    info("Client sent trading account query request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    if (!positions_.accountSeeded()) {
+        // Nothing cached yet, fall back to CTP.
+        queryTradingAccount();
+        return;
+    }
+    auto account = ToJson(positions_.account());
+    account["req_id"] = req_id;
+    account["is_last"] = true;
+    account["cached"] = true;
+    performed(req_id, 0);
+    send(TradeMsgCode::TRADING_ACCOUNT, json(), account);
+}
+
+void TraderHandler::queryPosition(const string& instrument, bool refresh) {
+    int req_id = req_id_++;
+    if (!refresh && positions_.seeded()) {
+        performed(req_id, 0);
+        sendPositions(TradeMsgCode::QUERY_POSITION, req_id, instrument);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(position_mutex_);
+        position_waiters_[req_id] = instrument;
+    }
+    enqueue("position", req_id, "position query", [this] (int id) { return reqQryPosition(id); });
+}
+
+void TraderHandler::subscribePosition(bool enable) {
+    int req_id = req_id_++;
+    if (auto* c = client())
+        c->positions = enable;
+    applyClientOptions();
+    info("Client "_s + (enable ? "subscribed to" : "unsubscribed from") + " position updates.");
+    performed(req_id, 0);
+}
+
+void TraderHandler::syncPositions() {
+    int req_id = internal_req_id_--;
+    position_sync_req_ = req_id;
+    queries_.submit("position", req_id, [this] (int id) {
+        auto ret = reqQryPosition(id);
+        static constexpr LogFormat kSent {"Position sync request sent. ReqID: {}; Return: {}"};
+        debug(kSent, id, ret);
+        return ret;
+    });
+}
+
+void TraderHandler::fetchCatalog() {
+    string day = api_->GetTradingDay();
+    if (state_->instruments.get(day) || !state_->instruments.claim(day))
+        return;
+    int req_id = internal_req_id_--;
+    {
+        std::lock_guard<std::mutex> lock(catalog_mutex_);
+        catalog_day_ = day;
+    }
+    catalog_req_ = req_id;
+    // Same key as an unfiltered client query, which then shares the fetch.
+    queries_.submit("instrument||||", req_id, [this] (int id) {
+        CThostFtdcQryInstrumentField f;
+        clear(&f);
+        {
+            // A resend starts over.
+            std::lock_guard<std::mutex> lock(catalog_mutex_);
+            catalog_records_.clear();
+        }
+        auto ret = api_->ReqQryInstrument(&f, id);
+        info("Instrument catalog request sent. ReqID: "_s + std::to_string(id) + "; Return: " + std::to_string(ret));
+        return ret;
+    });
+}
+
+int TraderHandler::reqQryPosition(int req_id) {
+    CThostFtdcQryInvestorPositionField f;
+    clear(&f);
+    copy(f.BrokerID, broker_id_);
+    copy(f.InvestorID, investor_id_);
+    positions_.beginSync();
+    return api_->ReqQryInvestorPosition(&f, req_id);
+}
+
+void TraderHandler::syncAccount() {
+    int req_id = internal_req_id_--;
+    account_sync_req_ = req_id;
+    queries_.submit("account||CNY|"_s + THOST_FTDC_BZTP_Future, req_id, [this] (int id) {
+        CThostFtdcQryTradingAccountField f;
+        clear(&f);
+        copy(f.BrokerID, broker_id_);
+        copy(f.InvestorID, investor_id_);
+        copy(f.CurrencyID, "CNY");
+        f.BizType = THOST_FTDC_BZTP_Future;
+        auto ret = api_->ReqQryTradingAccount(&f, id);
+        static constexpr LogFormat kSent {"Account sync request sent. ReqID: {}; Return: {}"};
+        debug(kSent, id, ret);
+        return ret;
+    });
+}
+
+void TraderHandler::onTimer() {
+    // Also expires a query whose response never came.
+    queries_.pump();
+    if (!clients_.empty()) {
+        idle_seconds_ = 0;
+    }
+    else if (++idle_seconds_ == kLingerSeconds) {
+        // Only the pool may still hold us; this is our last callback then.
+        info("Releasing the trade session, no client attached for "_s + std::to_string(kLingerSeconds) + "s");
+        post([this] () { state_->traders.remove(this); });
+        return;
+    }
+    if (!logged_in_)
+        return;
+    int interval = reconcile_interval_;
+    if (interval > 0 && ++seconds_since_sync_ >= interval)
+        position_due_ = true;
+    if (position_due_ && position_sync_req_ == 0) {
+        position_due_ = false;
+        seconds_since_sync_ = 0;
+        syncPositions();
+    }
+    if (account_due_ && account_sync_req_ == 0) {
+        account_due_ = false;
+        syncAccount();
+    }
+    auto catalog = state_->instruments.snapshot();
+    if (catalog && catalog->tradingDay() != catalog_applied_) {
+        for (const auto& r : *catalog)
+            positions_.setMultiplier(r.instrument_id, r.volume_multiple);
+        catalog_applied_ = catalog->tradingDay();
+    }
+    if (positions_.revalue(state_->ticks) && position_push_)
+        sendPositions(TradeMsgCode::POSITION_UPDATE, 0);
+}
+
+void TraderHandler::attach(WebSocket* ws) {
+    const int id = next_client_++;
+    clients_.push_back({id, ws, false, ws->getUserData()->wire});
+    idle_seconds_ = 0;
+    info("Client "_s + std::to_string(id) + " attached, " + std::to_string(clients_.size()) + " client(s) on the session.");
+    if (!logged_in_)
+        return;
+    // Joined a live session: tell the client which one.
+    const json message {
+        {"msg", TradeMsgCode::ATTACHED},
+        {"err", {{"code", 0}}},
+        {"info", {
+            {"broker_id", broker_id_},
+            {"user_id", login_user_},
+            {"trading_day", api_->GetTradingDay()},
+            {"front_id", front_id_.load()},
+            {"session_id", session_id_.load()},
+            {"clients", clients_.size()}
+        }}
+    };
+    Frame frame(message);
+    deliver(id, 0, static_cast<int>(TradeMsgCode::ATTACHED), frame);
+}
+
+void TraderHandler::detach(WebSocket* ws) {
+    auto it = std::find_if(clients_.begin(), clients_.end(), [ws] (const Client& c) { return c.ws == ws; });
+    if (it == clients_.end())
+        return;
+    const int id = it->id;
+    clients_.erase(it);
+    if (current_ == id)
+        current_ = 0;
+    for (auto o = owners_.begin(); o != owners_.end(); ) {
+        if (o->second == id)
+            o = owners_.erase(o);
+        else
+            ++o;
+    }
+    applyClientOptions();
+    info("Client "_s + std::to_string(id) + " detached, " + std::to_string(clients_.size()) + " client(s) left on the session.");
+}
+
+void TraderHandler::serve(WebSocket* ws) noexcept {
+    current_ = 0;
+    for (const auto& c : clients_) {
+        if (c.ws == ws)
+            current_ = c.id;
+    }
+}
+
+void TraderHandler::setOrderEvents(bool all) {
+    int req = req_id_++;
+    if (auto* c = client())
+        c->all_orders = all;
+    performed(req, 0);
+}
+
+TraderHandler::Client* TraderHandler::client() {
+    for (auto& c : clients_) {
+        if (c.id == current_)
+            return &c;
+    }
+    return nullptr;
+}
+
+void TraderHandler::applyClientOptions() {
+    bool positions = false;
+    int interval = -1;
+    for (const auto& c : clients_) {
+        positions |= c.positions;
+        interval = std::max(interval, c.query_interval);
+    }
+    position_push_ = positions;
+    // CTP paces the session as a whole: the most patient client wins.
+    queries_.setInterval(std::chrono::milliseconds(interval >= 0 ? interval : kQueryInterval));
+}
+
+void TraderHandler::deliver(int origin, int route, int code, Frame& frame) {
+    // Bounded: old requests are long answered by the time they fall out.
+    constexpr size_t kMaxOwners = 65536;
+    auto sendTo = [&frame] (const Client& c) {
+        c.ws->send(frame.encoded(c.wire), OpCodeOf(c.wire));
+    };
+    if (origin != 0) {
+        if (route != 0 && route != kBroadcast) {
+            owners_[route] = origin;
+            if (owners_.size() > kMaxOwners)
+                owners_.erase(owners_.begin());
+        }
+        for (const auto& c : clients_) {
+            if (c.id == origin)
+                sendTo(c);
+        }
+        return;
+    }
+    int owner = 0;
+    if (route != 0 && route != kBroadcast) {
+        auto it = owners_.find(route);
+        if (it != owners_.end())
+            owner = it->second;
+    }
+    if (owner == 0) {
+        // A push, or a reply no client claimed. Position updates only go to
+        // the clients that subscribed.
+        const bool positions = code == static_cast<int>(TradeMsgCode::POSITION_UPDATE);
+        for (const auto& c : clients_) {
+            if (!positions || c.positions)
+                sendTo(c);
+        }
+        return;
+    }
+    const bool order_event = code == static_cast<int>(TradeMsgCode::ORDER_INSERT_ERROR)
+        || code == static_cast<int>(TradeMsgCode::ORDER_INSERT_RETURN_ERROR)
+        || code == static_cast<int>(TradeMsgCode::ORDER_INSERTED)
+        || code == static_cast<int>(TradeMsgCode::ORDER_TRADED)
+        || code == static_cast<int>(TradeMsgCode::ORDER_DELETED);
+    for (const auto& c : clients_) {
+        if (c.id == owner || (order_event && c.all_orders))
+            sendTo(c);
+    }
+}
+
+void TraderHandler::enqueue(const string& key, int req_id, const string& what, QueryScheduler::Issue issue, bool aggregated) {
+    if (aggregated)
+        aggregate(req_id);
+    auto depth = queries_.submit(key, req_id, [this, req_id, what, issue=std::move(issue)] (int id) {
+        auto ret = issue(id);
+        info("Client sent "_s + what + " request. ReqID: " + std::to_string(req_id) + "; Upstream ReqID: " + std::to_string(id) + "; Return: " + std::to_string(ret));
+        return ret;
+    });
+    queued(req_id, depth);
+}
+
+std::vector<int> TraderHandler::queryCallers(int nRequestID, bool bIsLast) {
+    if (!bIsLast)
+        return queries_.callers(nRequestID);
+    auto callers = queries_.complete(nRequestID);
+    if (!callers.empty())
+        post([this] () { queries_.pump(); });
+    return callers;
+}
+
+void TraderHandler::onQueryFailed(const std::vector<int>& callers, const json& err) {
+    for (int caller : callers) {
+        if (caller == position_sync_req_) {
+            warn("Position sync failed: "_s + err.dump());
+            position_sync_req_ = 0;
+        }
+        else if (caller == account_sync_req_) {
+            warn("Account sync failed: "_s + err.dump());
+            account_sync_req_ = 0;
+        }
+        else if (caller == catalog_req_) {
+            warn("Instrument catalog fetch failed: "_s + err.dump());
+            state_->instruments.release();
+            catalog_req_ = 0;
+        }
+        else if (caller > 0) {
+            {
+                std::lock_guard<std::mutex> lock(position_mutex_);
+                position_waiters_.erase(caller);
+            }
+            {
+                std::lock_guard<std::mutex> lock(aggregate_mutex_);
+                aggregates_.erase(caller);
+            }
+            send(TradeMsgCode::ERROR, err, {
+                {"req_id", caller},
+                {"is_last", true}
+            });
+        }
+    }
+}
+
+void TraderHandler::reply(TradeMsgCode code, const CThostFtdcRspInfoField* pRspInfo, json&& data, int nRequestID, bool bIsLast) {
+    reply(code, pRspInfo, std::move(data), queryCallers(nRequestID, bIsLast), nRequestID);
+}
+
+void TraderHandler::reply(TradeMsgCode code, const CThostFtdcRspInfoField* pRspInfo, json&& data, const std::vector<int>& callers, int nRequestID) {
+    if (callers.empty()) {
+        // Not issued by the scheduler (or already expired there).
+        if (nRequestID > 0)
+            send(code, pRspInfo, data);
+        return;
+    }
+    json record;
+    bool is_last = data.value("is_last", true);
+    for (int caller : callers) {
+        if (caller <= 0)
+            continue;
+        if (record.is_null()) {
+            record = data;
+            record.erase("req_id");
+            record.erase("is_last");
+        }
+        if (collect(code, caller, pRspInfo, record, is_last))
+            continue;
+        data["req_id"] = caller;
+        send(code, pRspInfo, data);
+    }
+}
+
+void TraderHandler::sendPositions(TradeMsgCode code, int req_id, const string& instrument) {
+    json list = json::array();
+    for (const auto& p : positions_.positions(instrument))
+        list.push_back(ToJson(p));
+    json data {
+        {"positions", std::move(list)}
+    };
+    if (req_id != 0) {
+        data["req_id"] = req_id;
+        data["is_last"] = true;
+    }
+    if (positions_.accountSeeded())
+        data["account"] = ToJson(positions_.account());
+    send(code, json(), data);
 }
 
 void TraderHandler::insertOrder(
@@ -140,8 +758,34 @@ void TraderHandler::insertOrder(
     OrderOffset offset, int volume, 
     OrderPriceType price_type, TimeCondition time_condition,
     const string& memo,
+    const string& tag,
     Hedge hedge) {
-    string report = "RECEIVED: " + instrument + " in " + exchange + " with ref '" + ref + "'";
+    OrderTiming timing;
+    if (std::this_thread::get_id() == loop_thread_) {
+        timing.received = received_;
+        timing.parsed = parsed_;
+        received_ = parsed_ = LatencyClock::time_point();
+    }
+    string ref_used;
+    const auto* c = client();
+    placeOrder(req_id_++, timing, instrument, exchange, ref, price, direction, offset, volume,
+        price_type, time_condition, memo, tag, hedge, c && c->latency, ref_used);
+}
+
+int TraderHandler::placeOrder(int req_id, OrderTiming timing,
+    const string& instrument, const string& exchange,
+    const string& ref,
+    double price, Direction direction, 
+    OrderOffset offset, int volume, 
+    OrderPriceType price_type, TimeCondition time_condition,
+    const string& memo, const string& tag, Hedge hedge, bool latency,
+    string& ref_used) {
+    string order_ref = ref;
+    if (order_ref.empty())
+        order_ref = orders_.allocate();
+    else
+        orders_.reserve(order_ref);
+    string report = "RECEIVED: " + instrument + " in " + exchange + " with ref '" + order_ref + "'";
     CThostFtdcInputOrderField f;
     clear(&f);
     switch (direction) {
@@ -226,14 +870,207 @@ void TraderHandler::insertOrder(
     copy(f.BrokerID, broker_id_);
     copy(f.InvestorID, investor_id_);
     copy(f.InstrumentID, instrument);
-    copy(f.OrderRef, ref);
+    copy(f.OrderRef, order_ref);
     copy(f.OrderMemo, memo);
-    int req_id = req_id_++;
     f.RequestID = req_id;
+    ref_used = order_ref;
+    const RiskOrder order {instrument, risk_.resolve(instrument), f.Direction, f.CombOffsetFlag[0], f.OrderPriceType, price, volume};
+    // Checked and registered in one step: conditional orders are placed
+    // from the market data thread, concurrently with the loop's.
+    const auto key = orderKey(f.OrderRef);
+    auto rejected = risk_.reserve(key, order, state_->ticks);
+    if (!rejected.empty()) {
+        static constexpr LogFormat kRejected {"Order rejected by risk check. ReqID: {}; Reason: {}; Details: {}"};
+        warn(kRejected, req_id, rejected, report);
+        performed(req_id, -4, "Risk: " + rejected);
+        return -4;
+    }
+    // Tracked first: the CTP thread may report on the order before
+    // ReqOrderInsert returns.
+    timing.sending = LatencyClock::now();
+    orders_.track(f.OrderRef, tag, req_id, instrument, exchange, volume, timing, latency);
     auto ret = api_->ReqOrderInsert(&f, req_id);
+    if (ret == 0) {
+        orders_.sent(f.OrderRef, LatencyClock::now());
+    }
+    else {
+        orders_.erase(f.OrderRef);
+        risk_.onUnsent(key);
+    }
     report += " returned " + std::to_string(ret);
-    info("Client sent order insert request. ReqID: "_s + std::to_string(req_id) + "; Details: " + report);
-    performed(req_id, ret, report);
+    static constexpr LogFormat kInserted {"Client sent order insert request. ReqID: {}; Details: {}"};
+    info(kInserted, req_id, report);
+    json ack {
+        {"req_id", req_id},
+        {"msg", report},
+        {"ref", f.OrderRef},
+        {"tag", tag}
+    };
+    // The order's events are routed by req_id and carry the cid from here.
+    correlated(req_id, ack);
+    send(TradeMsgCode::PERFORMED, {{"code", ret}}, ack);
+    return ret;
+}
+
+void TraderHandler::insertConditional(ConditionalOrder order) {
+    int req_id = req_id_++;
+    // Reserved now and answered here, so that the order and its events go
+    // to this client when it fires.
+    order.req_id = req_id_++;
+    if (const auto* c = client())
+        order.latency = c->latency;
+    order.id = state_->triggers.add(order, shared_from_this());
+    info("Client armed conditional order "_s + std::to_string(order.id) + ": " + order.instrument
+        + (order.above ? " >= " : " <= ") + std::to_string(order.level) + ". ReqID: " + std::to_string(req_id));
+    performed(req_id, 0);
+    auto data = ToJson(order);
+    data["req_id"] = order.req_id;
+    data["is_last"] = true;
+    data["state"] = "armed";
+    send(TradeMsgCode::CONDITIONAL_ORDER, json(), data);
+}
+
+void TraderHandler::cancelConditional(int id) {
+    int req_id = req_id_++;
+    const bool removed = state_->triggers.remove(id, this);
+    info("Client canceled conditional order "_s + std::to_string(id) + ". ReqID: " + std::to_string(req_id) + "; Found: " + (removed ? "yes" : "no"));
+    performed(req_id, removed ? 0 : -1, removed ? "" : "Unknown conditional order");
+}
+
+void TraderHandler::queryConditional() {
+    int req_id = req_id_++;
+    json list = json::array();
+    for (const auto& o : state_->triggers.orders(this))
+        list.push_back(ToJson(o));
+    performed(req_id, 0);
+    send(TradeMsgCode::CONDITIONAL_ORDERS, json(), {
+        {"req_id", req_id},
+        {"is_last", true},
+        {"orders", std::move(list)}
+    });
+}
+
+void TraderHandler::startAlgo(ParentOrder order) {
+    int req_id = req_id_++;
+    // Reserved like a conditional order's, children are sent with it.
+    order.req_id = req_id_++;
+    if (const auto* c = client())
+        order.latency = c->latency;
+    performed(req_id, 0);
+    const int id = algos_.start(std::move(order));
+    info("Client started parent order "_s + std::to_string(id) + ". ReqID: " + std::to_string(req_id));
+}
+
+void TraderHandler::cancelAlgo(int id) {
+    int req_id = req_id_++;
+    const bool canceled = algos_.cancel(id);
+    info("Client canceled parent order "_s + std::to_string(id) + ". ReqID: " + std::to_string(req_id) + "; Found: " + (canceled ? "yes" : "no"));
+    performed(req_id, canceled ? 0 : -1, canceled ? "" : "Unknown or finished parent order");
+}
+
+void TraderHandler::queryAlgos() {
+    int req_id = req_id_++;
+    json list = json::array();
+    for (const auto& o : algos_.parents())
+        list.push_back(ToJson(o));
+    performed(req_id, 0);
+    send(TradeMsgCode::ALGO_ORDERS, json(), {
+        {"req_id", req_id},
+        {"is_last", true},
+        {"orders", std::move(list)}
+    });
+}
+
+int TraderHandler::sendChild(const ParentOrder& parent, int volume, string& ref) {
+    try {
+        return placeOrder(parent.req_id, OrderTiming(), parent.instrument, parent.exchange, "", parent.price,
+            parent.direction, parent.offset, volume, parent.price_type, parent.time_condition,
+            "", parent.tag, Hedge::SPECULATION, parent.latency, ref);
+    }
+    catch (const std::exception& e) {
+        error("Child of parent order "_s + std::to_string(parent.id) + " could not be sent: " + e.what());
+        return -1;
+    }
+}
+
+int TraderHandler::cancelOrder(int req_id, const string& ref, const string& instrument, const string& exchange) {
+    CThostFtdcInputOrderActionField f;
+    clear(&f);
+    f.ActionFlag = THOST_FTDC_AF_Delete;
+    copy(f.BrokerID, broker_id_);
+    copy(f.InvestorID, investor_id_);
+    copy(f.UserID, investor_id_);
+    copy(f.ExchangeID, exchange);
+    copy(f.InstrumentID, instrument);
+    f.FrontID = front_id_;
+    f.SessionID = session_id_;
+    copy(f.OrderRef, ref);
+    f.RequestID = req_id;
+    auto ret = api_->ReqOrderAction(&f, req_id);
+    static constexpr LogFormat kDeleted {"Sent order delete request. OrderRef: {}; ReqID: {}; Return: {}"};
+    info(kDeleted, ref, req_id, ret);
+    return ret;
+}
+
+void TraderHandler::fireConditional(const ConditionalOrder& order, double seen, LatencyClock::time_point tick) {
+    OrderTiming timing;
+    timing.received = timing.parsed = tick;
+    string ref;
+    int ret = -1;
+    try {
+        ret = placeOrder(order.req_id, timing, order.instrument, order.exchange, "", order.price,
+            order.direction, order.offset, order.volume, order.price_type, order.time_condition,
+            order.memo, order.tag, Hedge::SPECULATION, order.latency, ref);
+    }
+    catch (const std::exception& e) {
+        error("Conditional order "_s + std::to_string(order.id) + " could not be sent: " + e.what());
+    }
+    info("Conditional order "_s + std::to_string(order.id) + " triggered at " + std::to_string(seen)
+        + ". ReqID: " + std::to_string(order.req_id) + "; Return: " + std::to_string(ret));
+    auto data = ToJson(order);
+    data["req_id"] = order.req_id;
+    data["is_last"] = true;
+    data["state"] = ret == 0 ? "triggered" : "failed";
+    data["seen_price"] = seen;
+    data["ref"] = ref;
+    send(TradeMsgCode::CONDITIONAL_ORDER, ret == 0 ? json() : json {{"code", ret}}, data);
+}
+
+void TraderHandler::queryLocalOrders(const string& tag) {
+    int req_id = req_id_++;
+    json list = json::array();
+    for (const auto& o : orders_.orders(tag))
+        list.push_back(ToJson(o));
+    performed(req_id, 0);
+    send(TradeMsgCode::LOCAL_ORDERS, json(), {
+        {"req_id", req_id},
+        {"is_last", true},
+        {"orders", std::move(list)}
+    });
+}
+
+void TraderHandler::setRisk(const json& limits) {
+    // Validated by the message handler.
+    int req_id = req_id_++;
+    if (limits.contains("instrument")) {
+        risk_.setInstrumentLimits(limits["instrument"].get<string>(),
+            limits.value("max_order_volume", -1),
+            limits.value("max_position", -1));
+    }
+    else {
+        auto l = risk_.limits();
+        l.max_order_volume = limits.value("max_order_volume", l.max_order_volume);
+        l.max_position = limits.value("max_position", l.max_position);
+        l.max_orders_per_second = limits.value("max_orders_per_second", l.max_orders_per_second);
+        l.price_band = limits.value("price_band", l.price_band);
+        l.self_cross = limits.value("self_cross", l.self_cross);
+        risk_.setLimits(l);
+    }
+    performed(req_id, 0);
+    auto data = risk_.toJson();
+    data["req_id"] = req_id;
+    data["is_last"] = true;
+    send(TradeMsgCode::RISK_LIMITS, json(), data);
 }
     
 void TraderHandler::queryOrder() {
@@ -241,10 +1078,9 @@ void TraderHandler::queryOrder() {
     clear(&f);
     copy(f.BrokerID, broker_id_);
     copy(f.InvestorID, investor_id_);
-    int req_id = req_id_++;
-    auto ret = api_->ReqQryOrder(&f, req_id);
-    info("Client sent order query request. ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    enqueue("order", req_id_++, "order query",
+        [this, f] (int id) mutable { return api_->ReqQryOrder(&f, id); },
+        takeAggregate());
 }
 
 void TraderHandler::queryOrderByID(const string& sysID) {
@@ -253,10 +1089,9 @@ void TraderHandler::queryOrderByID(const string& sysID) {
     copy(f.BrokerID, broker_id_);
     copy(f.InvestorID, investor_id_);
     copy(f.OrderSysID, sysID);
-    int req_id = req_id_++;
-    auto ret = api_->ReqQryOrder(&f, req_id);
-    info("Client sent order query by ID request. OrderSysID: " + sysID + "; ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    enqueue("order|id|" + sysID, req_id_++, "order query by ID (OrderSysID: " + sysID + ")",
+        [this, f] (int id) mutable { return api_->ReqQryOrder(&f, id); },
+        takeAggregate());
 }
 
 void TraderHandler::queryOrderByExchange(const string& ex) {
@@ -265,10 +1100,9 @@ void TraderHandler::queryOrderByExchange(const string& ex) {
     copy(f.BrokerID, broker_id_);
     copy(f.InvestorID, investor_id_);
     copy(f.ExchangeID, ex);
-    int req_id = req_id_++;
-    auto ret = api_->ReqQryOrder(&f, req_id);
-    info("Client sent order query by Exchange request. ExchangeID: " + ex + "; ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    enqueue("order|exchange|" + ex, req_id_++, "order query by Exchange (ExchangeID: " + ex + ")",
+        [this, f] (int id) mutable { return api_->ReqQryOrder(&f, id); },
+        takeAggregate());
 }
 
 void TraderHandler::queryOrderByRange(const string& from, const string& to) {
@@ -278,10 +1112,9 @@ void TraderHandler::queryOrderByRange(const string& from, const string& to) {
     copy(f.InvestorID, investor_id_);
     copy(f.InsertTimeStart, from);
     copy(f.InsertTimeEnd, to);
-    int req_id = req_id_++;
-    auto ret = api_->ReqQryOrder(&f, req_id);
-    info("Client sent order query by Range request. From: " + from + "; To: " + to + "; ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    enqueue("order|range|" + from + "|" + to, req_id_++, "order query by Range (From: " + from + "; To: " + to + ")",
+        [this, f] (int id) mutable { return api_->ReqQryOrder(&f, id); },
+        takeAggregate());
 }
 
 void TraderHandler::deleteOrder(const string& exchange, const string& instrument, int delRef, const string& sysID) {
@@ -298,10 +1131,86 @@ void TraderHandler::deleteOrder(const string& exchange, const string& instrument
     copy(f.OrderSysID, sysID);
     f.RequestID = req_id;
     auto ret = api_->ReqOrderAction(&f, req_id);
-    info("Client sent order delete request. OrderActionRef: " + delRef + "; ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
+    static constexpr LogFormat kDeleted {"Client sent order delete request. OrderActionRef: {}; ReqID: {}; Return: {}"};
+    info(kDeleted, delRef, req_id, ret);
     performed(req_id, ret);
 }
 
+void TraderHandler::cancelAll(const string& instrument, const string& exchange, std::optional<Direction> direction) {
+    int req_id = req_id_++;
+    char d = 0;
+    if (direction)
+        d = *direction == Direction::BUY ? THOST_FTDC_D_Buy : THOST_FTDC_D_Sell;
+    auto working = orders_.working(instrument, exchange, d);
+    // Parent orders on them stop first and cancel their own children, also
+    // those not acknowledged yet, so those are not cancelled twice.
+    const int algos = algos_.cancelAll(instrument, exchange, direction);
+    if (algos > 0) {
+        const int front_id = front_id_, session_id = session_id_;
+        working.erase(std::remove_if(working.begin(), working.end(), [&] (const WorkingOrder& o) {
+            return o.front_id == front_id && o.session_id == session_id && algos_.isChild(o.ref);
+        }), working.end());
+    }
+    // All actions share `req_id`, so that their errors reach the caller.
+    CThostFtdcInputOrderActionField f;
+    clear(&f);
+    f.ActionFlag = THOST_FTDC_AF_Delete;
+    copy(f.BrokerID, broker_id_);
+    copy(f.InvestorID, investor_id_);
+    copy(f.UserID, investor_id_);
+    f.RequestID = req_id;
+    std::vector<int> results(working.size());
+    for (size_t i = 0; i < working.size(); ++i) {
+        const auto& o = working[i];
+        copy(f.ExchangeID, o.exchange);
+        copy(f.InstrumentID, o.instrument);
+        if (!o.order_sys_id.empty()) {
+            copy(f.OrderSysID, o.order_sys_id);
+            f.FrontID = 0;
+            f.SessionID = 0;
+            f.OrderRef[0] = '\0';
+        }
+        else {
+            // Not at the exchange yet, addressed by its session instead.
+            f.OrderSysID[0] = '\0';
+            f.FrontID = o.front_id;
+            f.SessionID = o.session_id;
+            copy(f.OrderRef, o.ref);
+        }
+        results[i] = api_->ReqOrderAction(&f, req_id);
+    }
+    int sent = 0;
+    json list = json::array();
+    for (size_t i = 0; i < working.size(); ++i) {
+        const auto& o = working[i];
+        sent += results[i] == 0;
+        list.push_back({
+            {"front_id", o.front_id},
+            {"session_id", o.session_id},
+            {"ref", o.ref},
+            {"instrument_id", o.instrument},
+            {"exchange_id", o.exchange},
+            {"order_sys_id", o.order_sys_id},
+            {"ret", results[i]}
+        });
+    }
+    info("Client sent mass cancel request. Instrument: "_s + (instrument.empty()? "ALL": instrument)
+        + "; Exchange: " + (exchange.empty()? "ALL": exchange)
+        + "; ReqID: " + std::to_string(req_id)
+        + "; Sent: " + std::to_string(sent) + "/" + std::to_string(working.size())
+        + "; Parent orders: " + std::to_string(algos));
+    performed(req_id, 0);
+    send(TradeMsgCode::CANCEL_ALL, json(), {
+        {"req_id", req_id},
+        {"is_last", true},
+        {"requested", working.size()},
+        {"sent", sent},
+        {"failed", static_cast<int>(working.size()) - sent},
+        {"algo_orders", algos},
+        {"orders", std::move(list)}
+    });
+}
+
 void TraderHandler::queryInstrument(const string& exchange, const string& instrument, const string& exchange_inst_id, const string& product_id) {
     CThostFtdcQryInstrumentField f;
     clear(&f);
@@ -309,10 +1218,30 @@ void TraderHandler::queryInstrument(const string& exchange, const string& instru
     copy(f.InstrumentID, instrument);
     copy(f.ExchangeInstID, exchange_inst_id);
     copy(f.ProductID, product_id);
-    int req_id = req_id_++;
-    auto ret = api_->ReqQryInstrument(&f, req_id);
-    info("Client sent instrument query request. Exchange: "_s + (exchange.empty()? "ALL": exchange) + "; Instrument: " + (instrument.empty()? "ALL": instrument) + "; ReqID: "_s + std::to_string(req_id) + "; Return: " + std::to_string(ret));
-    performed(req_id, ret);
+    auto catalog = state_->instruments.get(api_->GetTradingDay());
+    if (catalog) {
+        int req_id = req_id_++;
+        auto records = catalog->select(exchange, instrument, exchange_inst_id, product_id);
+        info("Client instrument query answered from the catalog of "_s + catalog->tradingDay() + ". ReqID: " + std::to_string(req_id) + "; Records: " + std::to_string(records.size()));
+        if (takeAggregate())
+            aggregate(req_id);
+        performed(req_id, 0);
+        for (size_t i = 0; i < records.size(); ++i) {
+            auto data = ToJson(*records[i]);
+            if (collect(TradeMsgCode::QUERY_INSTRUMENT, req_id, nullptr, data, i + 1 == records.size()))
+                continue;
+            data["req_id"] = req_id;
+            data["is_last"] = i + 1 == records.size();
+            send(TradeMsgCode::QUERY_INSTRUMENT, json(), data);
+        }
+        if (records.empty() && !collect(TradeMsgCode::QUERY_INSTRUMENT, req_id, nullptr, json(), true))
+            send(TradeMsgCode::QUERY_INSTRUMENT, json(), {{"req_id", req_id}, {"is_last", true}});
+        return;
+    }
+    enqueue("instrument|" + exchange + "|" + instrument + "|" + exchange_inst_id + "|" + product_id, req_id_++,
+        "instrument query (Exchange: "_s + (exchange.empty()? "ALL": exchange) + "; Instrument: " + (instrument.empty()? "ALL": instrument) + ")",
+        [this, f] (int id) mutable { return api_->ReqQryInstrument(&f, id); },
+        takeAggregate());
 }
 
 } // namespace tabxx
\ No newline at end of file
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstdlib>
+
+#include "OrderTracker.hpp"
+
+namespace tabxx {
+namespace {
+
+OrderLifecycle StateOf(const CThostFtdcOrderField& f, OrderLifecycle current) {
+    if (f.OrderSubmitStatus == THOST_FTDC_OSS_InsertRejected)
+        return OrderLifecycle::REJECTED;
+    switch (f.OrderStatus) {
+    case THOST_FTDC_OST_AllTraded:
+        return OrderLifecycle::TRADED;
+    case THOST_FTDC_OST_PartTradedQueueing:
+    case THOST_FTDC_OST_PartTradedNotQueueing:
+        return OrderLifecycle::PART_TRADED;
+    case THOST_FTDC_OST_Canceled:
+    case THOST_FTDC_OST_NoTradeNotQueueing:
+        return OrderLifecycle::CANCELED;
+    case THOST_FTDC_OST_Unknown:
+        // Accepted by CTP, not yet by the exchange.
+        return current;
+    default:
+        return OrderLifecycle::ACCEPTED;
+    }
+}
+
+} // namespace
+
+nlohmann::json ToJson(const TrackedOrder& o) {
+    return nlohmann::json {
+        {"ref", o.ref},
+        {"tag", o.tag},
+        {"req_id", o.req_id},
+        {"instrument_id", o.instrument},
+        {"exchange_id", o.exchange},
+        {"order_sys_id", o.order_sys_id},
+        {"volume", o.volume},
+        {"volume_traded", o.traded},
+        {"lifecycle", o.state},
+        {"latency", ToJson(o.timing)}
+    };
+}
+
+void OrderTracker::seed(int front_id, int session_id, const char* max_order_ref) {
+    const int64_t max_ref = std::strtoll(max_order_ref, nullptr, 10);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (front_id != front_id_ || session_id != session_id_) {
+        orders_.clear();
+        by_sys_id_.clear();
+        front_id_ = front_id;
+        session_id_ = session_id;
+    }
+    next_ref_ = max_ref + 1;
+}
+
+std::string OrderTracker::allocate() {
+    return std::to_string(next_ref_++);
+}
+
+void OrderTracker::reserve(const string& ref) {
+    char* end = nullptr;
+    const int64_t n = std::strtoll(ref.c_str(), &end, 10);
+    if (end == ref.c_str() || *end != '\0')
+        return;
+    auto next = next_ref_.load();
+    while (next <= n && !next_ref_.compare_exchange_weak(next, n + 1))
+        ;
+}
+
+void OrderTracker::track(const string& ref, const string& tag, int req_id,
+    const string& instrument, const string& exchange, int volume,
+    const OrderTiming& timing, bool latency) {
+    record(LatencyStage::PARSE, timing.received, timing.parsed);
+    record(LatencyStage::HANDLE, timing.parsed, timing.sending);
+    Entry e;
+    e.order.ref = ref;
+    e.order.tag = tag;
+    e.order.req_id = req_id;
+    e.order.instrument = instrument;
+    e.order.exchange = exchange;
+    e.order.volume = volume;
+    e.order.timing = timing;
+    e.order.latency = latency;
+    std::lock_guard<std::mutex> lock(mutex_);
+    orders_[ref] = std::move(e);
+}
+
+void OrderTracker::sent(const string& ref, LatencyClock::time_point at) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = orders_.find(ref);
+    if (it == orders_.end())
+        return;
+    auto& timing = it->second.order.timing;
+    timing.sent = at;
+    record(LatencyStage::REQ_INSERT, timing.sending, at);
+}
+
+void OrderTracker::erase(const string& ref) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    orders_.erase(ref);
+}
+
+std::optional<TrackedOrder> OrderTracker::onOrder(const CThostFtdcOrderField& f) {
+    const auto key = std::to_string(f.FrontID) + ":" + std::to_string(f.SessionID) + ":" + f.OrderRef;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (IsWorking(f)) {
+        auto& w = working_[key];
+        w.front_id = f.FrontID;
+        w.session_id = f.SessionID;
+        w.ref = f.OrderRef;
+        w.instrument = f.InstrumentID;
+        w.exchange = f.ExchangeID;
+        w.order_sys_id = f.OrderSysID;
+        w.direction = f.Direction;
+    }
+    else {
+        working_.erase(key);
+    }
+    if (f.FrontID != front_id_ || f.SessionID != session_id_)
+        return std::nullopt;
+    auto it = orders_.find(f.OrderRef);
+    if (it == orders_.end())
+        return std::nullopt;
+    auto& o = it->second.order;
+    const auto now = LatencyClock::now();
+    if (o.timing.ctp_ack == LatencyClock::time_point()) {
+        o.timing.ctp_ack = now;
+        // Before ReqOrderInsert returned, if it beat sent().
+        record(LatencyStage::CTP_ACK, o.timing.sent == LatencyClock::time_point() ? o.timing.sending : o.timing.sent, now);
+    }
+    if (f.OrderSysID[0] != '\0' && o.timing.exchange_ack == LatencyClock::time_point()) {
+        o.timing.exchange_ack = now;
+        record(LatencyStage::EXCHANGE_ACK, o.timing.ctp_ack, now);
+        record(LatencyStage::TO_EXCHANGE, o.timing.received, now);
+    }
+    o.state = StateOf(f, o.state);
+    o.traded = std::max(f.VolumeTraded, it->second.trade_volume);
+    if (f.OrderSysID[0] != '\0' && o.order_sys_id.empty()) {
+        o.order_sys_id = f.OrderSysID;
+        by_sys_id_[string(f.ExchangeID) + ":" + o.order_sys_id] = o.ref;
+    }
+    return o;
+}
+
+std::optional<TrackedOrder> OrderTracker::onTrade(const CThostFtdcTradeField& f) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto ref = by_sys_id_.find(string(f.ExchangeID) + ":" + f.OrderSysID);
+    if (ref == by_sys_id_.end())
+        return std::nullopt;
+    auto it = orders_.find(ref->second);
+    if (it == orders_.end())
+        return std::nullopt;
+    auto& o = it->second.order;
+    if (o.timing.first_trade == LatencyClock::time_point()) {
+        o.timing.first_trade = LatencyClock::now();
+        record(LatencyStage::FIRST_TRADE, o.timing.exchange_ack, o.timing.first_trade);
+    }
+    it->second.trade_volume += f.Volume;
+    o.traded = std::max(o.traded, it->second.trade_volume);
+    if (o.state != OrderLifecycle::CANCELED)
+        o.state = o.traded >= o.volume ? OrderLifecycle::TRADED : OrderLifecycle::PART_TRADED;
+    return o;
+}
+
+std::optional<TrackedOrder> OrderTracker::onRejected(const string& ref) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = orders_.find(ref);
+    if (it == orders_.end())
+        return std::nullopt;
+    it->second.order.state = OrderLifecycle::REJECTED;
+    return it->second.order;
+}
+
+std::optional<TrackedOrder> OrderTracker::find(const string& ref) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = orders_.find(ref);
+    if (it == orders_.end())
+        return std::nullopt;
+    return it->second.order;
+}
+
+void OrderTracker::record(LatencyStage stage, LatencyClock::time_point from, LatencyClock::time_point to) {
+    if (latency_)
+        latency_->record(stage, from, to);
+}
+
+std::vector<TrackedOrder> OrderTracker::orders(const string& tag) const {
+    std::vector<TrackedOrder> out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    out.reserve(orders_.size());
+    for (const auto& [ref, e] : orders_) {
+        if (tag.empty() || e.order.tag == tag)
+            out.push_back(e.order);
+    }
+    std::sort(out.begin(), out.end(), [] (const TrackedOrder& a, const TrackedOrder& b) {
+        return a.req_id < b.req_id;
+    });
+    return out;
+}
+
+std::vector<WorkingOrder> OrderTracker::working(const string& instrument,
+    const string& exchange, char direction) const {
+    std::vector<WorkingOrder> out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [key, w] : working_) {
+        if ((instrument.empty() || w.instrument == instrument)
+            && (exchange.empty() || w.exchange == exchange)
+            && (direction == 0 || w.direction == direction))
+            out.push_back(w);
+    }
+    return out;
+}
+
+} // namespace tabxx
@@ -0,0 +1,119 @@
+#ifndef TABXX_TRADE_ORDER_TRACKER_HPP_
+#define TABXX_TRADE_ORDER_TRACKER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ThostFtdcTraderApi.h>
+#include <json.hpp>
+
+#include "../Latency.hpp"
+#include "Flags.hpp"
+
+namespace tabxx {
+
+// Where an order of this session is, as far as the gateway knows.
+enum class OrderLifecycle {
+    SENT = 0,       // ReqOrderInsert returned 0, nothing heard back yet
+    ACCEPTED = 1,   // working at the exchange
+    PART_TRADED = 2,
+    TRADED = 3,
+    CANCELED = 4,
+    REJECTED = 5
+};
+
+struct TrackedOrder {
+    std::string ref;
+    std::string tag;            // client tag given with insert_order
+    int req_id = 0;
+    std::string instrument;
+    std::string exchange;
+    std::string order_sys_id;
+    int volume = 0;
+    int traded = 0;
+    OrderLifecycle state = OrderLifecycle::SENT;
+    OrderTiming timing;
+    bool latency = false;       // timing is attached to its events
+};
+
+nlohmann::json ToJson(const TrackedOrder& o);
+
+// An order of the account, from any session, still working at the exchange.
+struct WorkingOrder {
+    int front_id = 0;
+    int session_id = 0;
+    std::string ref;
+    std::string instrument;
+    std::string exchange;
+    std::string order_sys_id;
+    char direction = 0;
+};
+
+// OrderRef allocation and the lifecycle of the orders sent by one trader
+// session. Refs are handed out from an atomic counter seeded with the
+// MaxOrderRef of the login reply, so clients never need to coordinate them.
+class OrderTracker {
+    using string = std::string;
+public:
+    // Stage latencies of tracked orders are recorded into `latency` if given.
+    explicit OrderTracker(LatencyStats* latency = nullptr): latency_(latency) {}
+
+    // Starts a new CTP session: refs continue after `max_order_ref`,
+    // orders of the previous session are forgotten.
+    void seed(int front_id, int session_id, const char* max_order_ref);
+    string allocate();
+    // Keeps allocation ahead of a ref chosen by the client.
+    void reserve(const string& ref);
+
+    // Called before ReqOrderInsert, whose replies may come back on the CTP
+    // thread before it returns; `timing.sending` is set.
+    void track(const string& ref, const string& tag, int req_id,
+        const string& instrument, const string& exchange, int volume,
+        const OrderTiming& timing, bool latency);
+    // ReqOrderInsert returned 0 at `at`.
+    void sent(const string& ref, LatencyClock::time_point at);
+    // ReqOrderInsert failed: the order was never sent.
+    void erase(const string& ref);
+
+    // The updated order, nullopt when it was not sent by this session.
+    std::optional<TrackedOrder> onOrder(const CThostFtdcOrderField& f);
+    std::optional<TrackedOrder> onTrade(const CThostFtdcTradeField& f);
+    std::optional<TrackedOrder> onRejected(const string& ref);
+
+    std::optional<TrackedOrder> find(const string& ref) const;
+    // All tracked orders, or those carrying `tag`.
+    std::vector<TrackedOrder> orders(const string& tag = "") const;
+    // Working orders of the account seen through OnRtnOrder, optionally
+    // filtered; an empty string or a zero `direction` matches everything.
+    std::vector<WorkingOrder> working(const string& instrument = "",
+        const string& exchange = "", char direction = 0) const;
+
+private:
+    struct Entry {
+        TrackedOrder order;
+        int trade_volume = 0;   // sum of OnRtnTrade, may run ahead of OnRtnOrder
+    };
+
+private:
+    void record(LatencyStage stage, LatencyClock::time_point from, LatencyClock::time_point to);
+
+private:
+    LatencyStats* latency_;
+    std::atomic<int64_t> next_ref_ {1};
+    mutable std::mutex mutex_;
+    int front_id_ = 0;
+    int session_id_ = 0;
+    std::unordered_map<string, Entry> orders_;          // OrderRef -> order
+    std::unordered_map<string, string> by_sys_id_;      // ExchangeID:OrderSysID -> OrderRef
+    std::unordered_map<string, WorkingOrder> working_;  // FrontID:SessionID:OrderRef -> order
+
+}; // class OrderTracker
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_ORDER_TRACKER_HPP_
@@ -0,0 +1,367 @@
+#include <algorithm>
+#include <cmath>
+
+#include "Position.hpp"
+
+namespace tabxx {
+namespace {
+
+bool IsClose(char offset) {
+    return offset != THOST_FTDC_OF_Open;
+}
+
+// The position an order or trade acts on: opens add to their own side,
+// closes reduce the opposite side.
+PositionDirection Side(char direction, char offset) {
+    bool buy = direction == THOST_FTDC_D_Buy;
+    if (IsClose(offset))
+        buy = !buy;
+    return buy ? PositionDirection::LONG : PositionDirection::SHORT;
+}
+
+std::string OrderKey(const CThostFtdcOrderField& f) {
+    return std::to_string(f.FrontID) + ":" + std::to_string(f.SessionID) + ":" + f.OrderRef;
+}
+
+} // namespace
+
+void PositionBook::beginSync() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sync_.clear();
+    traded_in_sync_.clear();
+    syncing_ = true;
+}
+
+void PositionBook::addSyncRecord(const CThostFtdcInvestorPositionField& f) {
+    PositionDirection direction;
+    try {
+        direction = GetPositionDirection(f.PosiDirection);
+    } catch (const std::exception&) {
+        return; // net positions are not tracked
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!syncing_)
+        return;
+    // SHFE/INE report today and history in separate records, merge them.
+    auto& p = sync_[{f.InstrumentID, direction}];
+    p.instrument = f.InstrumentID;
+    p.exchange = f.ExchangeID;
+    p.direction = direction;
+    p.position += f.Position;
+    p.today_position += f.TodayPosition;
+    p.frozen += direction == PositionDirection::LONG ? f.ShortFrozen : f.LongFrozen;
+    p.position_cost += f.PositionCost;
+    p.position_profit += f.PositionProfit;
+    // Historical cost is marked at pre-settlement, which gives us the multiplier
+    // until the instrument itself has been seen.
+    if (f.PositionDate == THOST_FTDC_PSD_History && f.Position > 0 && f.PreSettlementPrice > 0
+        && multipliers_.find(f.InstrumentID) == multipliers_.end()) {
+        auto m = std::lround(f.PositionCost / (f.Position * f.PreSettlementPrice));
+        if (m > 0)
+            multipliers_[f.InstrumentID] = static_cast<int>(m);
+    }
+}
+
+std::vector<PositionDrift> PositionBook::commitSync() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<PositionDrift> drift;
+    if (!syncing_)
+        return drift;
+    for (auto& [key, p] : sync_)
+        p.multiplier = multiplierOf(key.first);
+    // The snapshot may or may not include trades that came in while the
+    // query was out: those positions keep their local state until the next
+    // sync, and are not reported as drift.
+    for (const auto& key : traded_in_sync_) {
+        auto local = positions_.find(key);
+        if (local != positions_.end())
+            sync_[key] = local->second;
+        else
+            sync_.erase(key);
+    }
+    // Realized profit stays until the next account snapshot, also for
+    // positions closed since.
+    for (const auto& [key, p] : positions_) {
+        if (traded_in_sync_.count(key) != 0 || (p.close_profit == 0 && p.unpriced_close_profit == 0))
+            continue;
+        auto it = sync_.find(key);
+        if (it == sync_.end()) {
+            it = sync_.emplace(key, Position()).first;
+            it->second.instrument = p.instrument;
+            it->second.exchange = p.exchange;
+            it->second.direction = p.direction;
+            it->second.multiplier = p.multiplier;
+        }
+        it->second.close_profit = p.close_profit;
+        it->second.unpriced_close_profit = p.unpriced_close_profit;
+    }
+    if (seeded_) {
+        for (const auto& [key, p] : positions_) {
+            auto it = sync_.find(key);
+            int remote = it == sync_.end() ? 0 : it->second.position;
+            if (remote != p.position)
+                drift.push_back({key.first, key.second, p.position, remote});
+        }
+        for (const auto& [key, p] : sync_) {
+            if (positions_.find(key) == positions_.end() && p.position != 0)
+                drift.push_back({key.first, key.second, 0, p.position});
+        }
+    }
+    positions_.swap(sync_);
+    sync_.clear();
+    traded_in_sync_.clear();
+    syncing_ = false;
+    seeded_ = true;
+    return drift;
+}
+
+bool PositionBook::seeded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return seeded_;
+}
+
+void PositionBook::setAccount(const CThostFtdcTradingAccountField& f) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    account_.base = f;
+    account_.close_profit = 0;
+    account_.position_profit = f.PositionProfit;
+    account_.valid = true;
+    for (auto& [key, p] : positions_)
+        p.close_profit = p.unpriced_close_profit = 0;
+}
+
+bool PositionBook::accountSeeded() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return account_.valid;
+}
+
+void PositionBook::setMultiplier(const string& instrument, int multiplier) {
+    if (multiplier <= 0)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    multipliers_[instrument] = multiplier;
+    for (auto direction : {PositionDirection::LONG, PositionDirection::SHORT}) {
+        auto it = positions_.find({instrument, direction});
+        if (it == positions_.end())
+            continue;
+        auto& p = it->second;
+        p.multiplier = multiplier;
+        p.position_cost += p.unpriced_cost * multiplier;
+        const double profit = p.unpriced_close_profit * multiplier;
+        p.close_profit += profit;
+        account_.close_profit += profit;
+        p.unpriced_cost = p.unpriced_close_profit = 0;
+    }
+}
+
+bool PositionBook::onOrder(const CThostFtdcOrderField& f) {
+    if (!IsClose(f.CombOffsetFlag[0]))
+        return false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto key = OrderKey(f);
+    int remaining = IsWorking(f) ? f.VolumeTotal : 0;
+    auto it = frozen_orders_.find(key);
+    int before = it == frozen_orders_.end() ? 0 : it->second;
+    if (remaining == before)
+        return false;
+    if (remaining == 0)
+        frozen_orders_.erase(key);
+    else
+        frozen_orders_[key] = remaining;
+    auto& p = positions_[{f.InstrumentID, Side(f.Direction, f.CombOffsetFlag[0])}];
+    if (p.instrument.empty()) {
+        p.instrument = f.InstrumentID;
+        p.exchange = f.ExchangeID;
+        p.direction = Side(f.Direction, f.CombOffsetFlag[0]);
+        p.multiplier = multiplierOf(p.instrument);
+    }
+    p.frozen = std::max(0, p.frozen + remaining - before);
+    return true;
+}
+
+bool PositionBook::onTrade(const CThostFtdcTradeField& f) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto direction = Side(f.Direction, f.OffsetFlag);
+    auto& p = positions_[{f.InstrumentID, direction}];
+    if (p.instrument.empty()) {
+        p.instrument = f.InstrumentID;
+        p.exchange = f.ExchangeID;
+        p.direction = direction;
+        p.multiplier = multiplierOf(p.instrument);
+    }
+    if (syncing_)
+        traded_in_sync_.insert({f.InstrumentID, direction});
+    // Without the multiplier, the money part of the cost is kept apart.
+    const double amount = f.Price * f.Volume;
+    if (!IsClose(f.OffsetFlag)) {
+        p.position += f.Volume;
+        p.today_position += f.Volume;
+        if (p.multiplier > 0)
+            p.position_cost += amount * p.multiplier;
+        else
+            p.unpriced_cost += amount;
+        return true;
+    }
+    const int volume = std::min(f.Volume, p.position);
+    const int yesterday = p.position - p.today_position;
+    if (f.OffsetFlag == THOST_FTDC_OF_CloseToday)
+        p.today_position -= std::min(volume, p.today_position);
+    else if (volume > yesterday)
+        p.today_position -= volume - yesterday;
+    if (p.position > 0 && volume > 0) {
+        // Money profit is proceeds * multiplier - cost, split into the part
+        // known in money and the part still waiting for the multiplier.
+        const double cost = p.position_cost * volume / p.position;
+        const double unpriced_cost = p.unpriced_cost * volume / p.position;
+        const double proceeds = amount * volume / f.Volume;
+        const double sign = direction == PositionDirection::LONG ? 1 : -1;
+        double profit = -sign * cost;
+        double unpriced_profit = sign * (proceeds - unpriced_cost);
+        if (p.multiplier > 0) {
+            profit += unpriced_profit * p.multiplier;
+            unpriced_profit = 0;
+        }
+        p.position_cost -= cost;
+        p.unpriced_cost -= unpriced_cost;
+        p.close_profit += profit;
+        p.unpriced_close_profit += unpriced_profit;
+        account_.close_profit += profit;
+    }
+    p.position -= volume;
+    if (p.position == 0)
+        p.position_cost = p.unpriced_cost = 0;
+    return true;
+}
+
+bool PositionBook::revalue(const TickStore& ticks) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool changed = false;
+    double total = 0;
+    for (auto& [key, p] : positions_) {
+        double before = p.position_profit;
+        revalue(p, ticks);
+        changed |= before != p.position_profit;
+        total += p.position_profit;
+    }
+    if (seeded_)
+        account_.position_profit = total;
+    return changed;
+}
+
+std::vector<Position> PositionBook::positions(const string& instrument) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Position> out;
+    for (const auto& [key, p] : positions_) {
+        if (instrument.empty() || key.first == instrument)
+            out.push_back(p);
+    }
+    return out;
+}
+
+AccountState PositionBook::account() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return account_;
+}
+
+int PositionBook::multiplierOf(const string& instrument) const {
+    auto it = multipliers_.find(instrument);
+    return it == multipliers_.end() ? 0 : it->second;
+}
+
+void PositionBook::revalue(Position& p, const TickStore& ticks) const {
+    Tick t;
+    if (p.multiplier <= 0 || !ticks.get(p.instrument, t))
+        return;
+    double price = t.last_price > 0 ? t.last_price : t.pre_settlement_price;
+    if (price <= 0)
+        return;
+    const double value = price * p.position * p.multiplier;
+    p.last_price = price;
+    p.position_profit = p.direction == PositionDirection::LONG ? value - p.position_cost : p.position_cost - value;
+}
+
+nlohmann::json ToJson(const Position& p) {
+    return nlohmann::json {
+        {"instrument_id", p.instrument},
+        {"exchange_id", p.exchange},
+        {"direction", p.direction},
+        {"position", p.position},
+        {"today_position", p.today_position},
+        {"yd_position", p.position - p.today_position},
+        {"frozen", p.frozen},
+        {"available", std::max(0, p.position - p.frozen)},
+        {"multiplier", p.multiplier},
+        {"position_cost", p.position_cost},
+        {"avg_price", p.position > 0 && p.multiplier > 0 ? p.position_cost / (p.position * p.multiplier) : 0.0},
+        {"last_price", p.last_price},
+        {"position_profit", p.position_profit},
+        {"close_profit", p.close_profit}
+    };
+}
+
+nlohmann::json ToJson(const CThostFtdcTradingAccountField& f) {
+    return nlohmann::json {
+        {"broker_id", f.BrokerID},
+        {"account_id", f.AccountID},
+        {"pre_mortgage", f.PreMortgage},
+        {"pre_credit", f.PreCredit},
+        {"pre_deposit", f.PreDeposit},
+        {"pre_balance", f.PreBalance},
+        {"pre_margin", f.PreMargin},
+        {"interest_base", f.InterestBase},
+        {"interest", f.Interest},
+        {"deposit", f.Deposit},
+        {"withdraw", f.Withdraw},
+        {"frozen_margin", f.FrozenMargin},
+        {"frozen_cash", f.FrozenCash},
+        {"frozen_commission", f.FrozenCommission},
+        {"current_margin", f.CurrMargin},
+        {"cash_in", f.CashIn},
+        {"commission", f.Commission},
+        {"close_profit", f.CloseProfit},
+        {"position_profit", f.PositionProfit},
+        {"available", f.Available},
+        {"withdraw_quota", f.WithdrawQuota},
+        // {"reserve", f.Reserve},
+        {"trading_day", f.TradingDay},
+        {"settlement_id", f.SettlementID},
+        {"credit", f.Credit},
+        {"mortgage", f.Mortgage},
+        {"exchange_margin", f.ExchangeMargin},
+        {"delivery_margin", f.DeliveryMargin},
+        {"exchange_delivery_margin", f.ExchangeDeliveryMargin},
+        {"reserve_balance", f.ReserveBalance},
+        {"currency_id", f.CurrencyID},
+        {"pre_fund_mortgage_in", f.PreFundMortgageIn},
+        {"pre_fund_mortgage_out", f.PreFundMortgageOut},
+        {"fund_mortgage_in", f.FundMortgageIn},
+        {"fund_mortgage_out", f.FundMortgageOut},
+        {"fund_mortgage_available", f.FundMortgageAvailable},
+        {"mortgageable_fund", f.MortgageableFund},
+        {"spec_product_margin", f.SpecProductMargin},
+        {"spec_product_frozen_margin", f.SpecProductFrozenMargin},
+        {"spec_product_commission", f.SpecProductCommission},
+        {"spec_product_frozen_commission", f.SpecProductFrozenCommission},
+        {"spec_product_position_profit", f.SpecProductPositionProfit},
+        {"spec_product_close_profit", f.SpecProductCloseProfit},
+        {"spec_product_position_profit_by_alg", f.SpecProductPositionProfitByAlg},
+        {"spec_product_exchange_margin", f.SpecProductExchangeMargin},
+        {"biz_type", f.BizType},
+        {"frozen_swap", f.FrozenSwap},
+        {"remain_swap", f.RemainSwap},
+        {"option_value", f.OptionValue}
+    };
+}
+
+nlohmann::json ToJson(const AccountState& a) {
+    auto j = ToJson(a.base);
+    // Deltas since the snapshot are applied on top of the values CTP reported.
+    const double profit_change = a.close_profit + a.position_profit - a.base.PositionProfit;
+    j["close_profit"] = a.base.CloseProfit + a.close_profit;
+    j["position_profit"] = a.position_profit;
+    j["available"] = a.base.Available + profit_change;
+    j["balance"] = a.base.Balance + profit_change;
+    return j;
+}
+
+} // namespace tabxx
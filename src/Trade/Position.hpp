@@ -0,0 +1,105 @@
+#ifndef TABXX_TRADE_POSITION_HPP_
+#define TABXX_TRADE_POSITION_HPP_
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <ThostFtdcTraderApi.h>
+#include <json.hpp>
+
+#include "../MarketData/TickStore.hpp"
+#include "Flags.hpp"
+
+namespace tabxx {
+
+struct Position {
+    std::string instrument;
+    std::string exchange;
+    PositionDirection direction = PositionDirection::LONG;
+    int position = 0;
+    int today_position = 0;
+    int frozen = 0;              // volume locked by working close orders
+    int multiplier = 0;          // 0 while unknown, valuation is skipped
+    double position_cost = 0;    // money, multiplier included
+    double close_profit = 0;     // realized since the last account snapshot
+    double position_profit = 0;
+    double last_price = 0;       // price of the latest valuation
+    // Parts of position_cost and close_profit traded while the multiplier was
+    // unknown, in price x volume; setMultiplier() turns them into money.
+    double unpriced_cost = 0;
+    double unpriced_close_profit = 0;
+};
+
+struct PositionDrift {
+    std::string instrument;
+    PositionDirection direction;
+    int local;
+    int remote;
+};
+
+struct AccountState {
+    CThostFtdcTradingAccountField base;  // last snapshot queried from CTP
+    double close_profit = 0;             // realized locally since that snapshot
+    double position_profit = 0;          // current valuation of all positions
+    bool valid = false;
+};
+
+// Positions and account state of one trader session. Seeded and reconciled
+// from ReqQryInvestorPosition / ReqQryTradingAccount, kept current from
+// OnRtnOrder / OnRtnTrade and valued against the TickStore.
+// Thread-safe: updated on the CTP thread, read on the loop thread.
+class PositionBook {
+    using string = std::string;
+    using Key = std::pair<string, PositionDirection>;
+public:
+    // Collects records of one position query; commitSync() swaps them in,
+    // except for positions traded while the query was out.
+    void beginSync();
+    void addSyncRecord(const CThostFtdcInvestorPositionField& f);
+    std::vector<PositionDrift> commitSync();
+    bool seeded() const;
+
+    void setAccount(const CThostFtdcTradingAccountField& f);
+    bool accountSeeded() const;
+
+    void setMultiplier(const string& instrument, int multiplier);
+
+    // Return true when a position has changed.
+    bool onOrder(const CThostFtdcOrderField& f);
+    bool onTrade(const CThostFtdcTradeField& f);
+
+    // Returns true when any valuation has changed.
+    bool revalue(const TickStore& ticks);
+
+    std::vector<Position> positions(const string& instrument = "") const;
+    AccountState account() const;
+
+private:
+    int multiplierOf(const string& instrument) const;
+    void revalue(Position& p, const TickStore& ticks) const;
+
+private:
+    mutable std::mutex mutex_;
+    std::map<Key, Position> positions_;
+    std::map<Key, Position> sync_;
+    std::set<Key> traded_in_sync_;
+    std::unordered_map<string, int> multipliers_;
+    std::unordered_map<string, int> frozen_orders_;   // order key -> volume frozen so far
+    AccountState account_;
+    bool seeded_ = false;
+    bool syncing_ = false;
+
+}; // class PositionBook
+
+nlohmann::json ToJson(const Position& p);
+nlohmann::json ToJson(const CThostFtdcTradingAccountField& f);
+nlohmann::json ToJson(const AccountState& a);
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_POSITION_HPP_
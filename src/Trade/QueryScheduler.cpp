@@ -0,0 +1,149 @@
+#include <algorithm>
+
+#include "QueryScheduler.hpp"
+
+namespace tabxx {
+
+size_t QueryScheduler::submit(const std::string& key, int caller, Issue issue) {
+    size_t ahead = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (in_flight_ && in_flight_->key == key && !in_flight_->delivered) {
+            in_flight_->callers.push_back(caller);
+            ++stats_.coalesced;
+            return 0;
+        }
+        auto it = std::find_if(queue_.begin(), queue_.end(), [&key] (const auto& e) { return e->key == key; });
+        if (it != queue_.end()) {
+            (*it)->callers.push_back(caller);
+            ++stats_.coalesced;
+            return static_cast<size_t>(it - queue_.begin()) + (in_flight_ ? 1 : 0);
+        }
+        ahead = queue_.size() + (in_flight_ ? 1 : 0);
+        auto e = std::make_shared<Entry>();
+        e->key = key;
+        e->callers.push_back(caller);
+        e->issue = std::move(issue);
+        e->enqueued = clock::now();
+        queue_.push_back(std::move(e));
+    }
+    pump();
+    return ahead;
+}
+
+std::vector<int> QueryScheduler::callers(int req_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!in_flight_ || in_flight_->callers.front() != req_id)
+        return {};
+    in_flight_->delivered = true;
+    return in_flight_->callers;
+}
+
+std::vector<int> QueryScheduler::complete(int req_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!in_flight_ || in_flight_->callers.front() != req_id)
+        return {};
+    auto callers = std::move(in_flight_->callers);
+    in_flight_.reset();
+    return callers;
+}
+
+void QueryScheduler::pump() {
+    std::shared_ptr<Entry> timed_out, e;
+    int req_id = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = clock::now();
+        if (in_flight_ && now - in_flight_since_ >= kTimeout) {
+            // The response is not coming (lost, or the front went away).
+            timed_out = std::move(in_flight_);
+            ++stats_.failed;
+        }
+        if (!in_flight_ && !queue_.empty()) {
+            if (now < next_allowed_) {
+                schedule(next_allowed_ - now);
+            }
+            else {
+                e = queue_.front();
+                queue_.pop_front();
+                req_id = e->callers.front();
+                // Set before issuing, the response may arrive before ReqQry* returns.
+                in_flight_ = e;
+                in_flight_since_ = now;
+                next_allowed_ = now + interval_;
+            }
+        }
+    }
+    if (timed_out)
+        on_failed_(timed_out->callers, -1);
+    if (!e)
+        return;
+
+    int ret = e->issue(req_id);
+    std::vector<int> failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = clock::now();
+        if (ret == 0) {
+            double wait = std::chrono::duration<double, std::milli>(now - e->enqueued).count();
+            ++stats_.issued;
+            total_wait_ms_ += wait;
+            stats_.max_wait_ms = std::max(stats_.max_wait_ms, wait);
+            // Fails the query by itself if no response comes and nothing
+            // else pumps; a later issue re-arms it for its own query.
+            if (in_flight_ == e)
+                schedule(kTimeout);
+            return;
+        }
+        if (in_flight_ == e)
+            in_flight_.reset();
+        if ((ret == -2 || ret == -3) && ++e->attempts < kMaxAttempts) {
+            // Flow control rejected it, back off and keep its place at the head.
+            ++stats_.retries;
+            queue_.push_front(e);
+            next_allowed_ = now + interval_ * e->attempts;
+            schedule(next_allowed_ - now);
+            return;
+        }
+        ++stats_.failed;
+        failed = e->callers;
+    }
+    on_failed_(failed, ret);
+    pump();
+}
+
+void QueryScheduler::abort(int code) {
+    std::vector<int> failed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!in_flight_)
+            return;
+        failed = std::move(in_flight_->callers);
+        in_flight_.reset();
+        ++stats_.failed;
+    }
+    on_failed_(failed, code);
+    pump();
+}
+
+void QueryScheduler::setInterval(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    interval_ = interval;
+}
+
+QueryScheduler::Stats QueryScheduler::stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Stats s = stats_;
+    s.queue_depth = queue_.size();
+    s.in_flight = in_flight_ != nullptr;
+    s.avg_wait_ms = stats_.issued ? total_wait_ms_ / stats_.issued : 0;
+    return s;
+}
+
+// Requires the lock, runs on the loop thread.
+void QueryScheduler::schedule(clock::duration delay) {
+    auto ms = std::chrono::ceil<std::chrono::milliseconds>(delay).count();
+    timer_.once(static_cast<int>(ms), [this] () { pump(); });
+}
+
+} // namespace tabxx
@@ -0,0 +1,102 @@
+#ifndef TABXX_TRADE_QUERY_SCHEDULER_HPP_
+#define TABXX_TRADE_QUERY_SCHEDULER_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <uWebSockets/App.h>
+
+#include "../Timer.hpp"
+
+namespace tabxx {
+
+// Per-session queue in front of the CTP ReqQry* calls.
+//
+// CTP accepts one query in flight and roughly one query per second; calls
+// beyond that return -2 (too many pending) or -3 (rate exceeded). Queries are
+// issued one at a time, paced by `interval`, and rejected ones are retried.
+// A query whose key matches one that is queued (or in flight with no records
+// delivered yet) is coalesced into it: the upstream request uses the first
+// caller's id and every caller receives the results.
+//
+// submit(), pump() and abort() run on the loop thread; callers() and
+// complete() are called from CTP callbacks.
+class QueryScheduler {
+    using clock = std::chrono::steady_clock;
+public:
+    // Issues the upstream request with the given id, returns the CTP code.
+    using Issue = std::function<int(int req_id)>;
+    // Receives the callers of a query that could not be issued.
+    using Failed = std::function<void(const std::vector<int>& callers, int code)>;
+
+    struct Stats {
+        size_t queue_depth = 0;
+        bool in_flight = false;
+        uint64_t issued = 0;
+        uint64_t coalesced = 0;
+        uint64_t retries = 0;
+        uint64_t failed = 0;
+        double avg_wait_ms = 0;
+        double max_wait_ms = 0;
+    };
+
+    QueryScheduler(uWS::Loop* loop, Failed on_failed):
+        timer_(loop), on_failed_(std::move(on_failed)) {}
+
+    // Queues a query and returns the number of queries ahead of it.
+    size_t submit(const std::string& key, int caller, Issue issue);
+
+    // Callers waiting for records of upstream request `req_id`.
+    std::vector<int> callers(int req_id);
+
+    // Marks upstream request `req_id` done and returns its callers.
+    // The caller must arrange for pump() to run on the loop thread.
+    std::vector<int> complete(int req_id);
+
+    // Issues the next query when allowed.
+    void pump();
+
+    // Drops the in-flight query, e.g. after the front disconnected.
+    void abort(int code);
+
+    void setInterval(std::chrono::milliseconds interval);
+    Stats stats() const;
+
+private:
+    struct Entry {
+        std::string key;
+        std::vector<int> callers;
+        Issue issue;
+        clock::time_point enqueued;
+        int attempts = 0;
+        bool delivered = false;
+    };
+
+    static constexpr int kMaxAttempts = 10;
+    static constexpr auto kTimeout = std::chrono::seconds(30);   // armed on the timer when a query is issued
+
+    void schedule(clock::duration delay);
+
+private:
+    mutable std::mutex mutex_;
+    std::deque<std::shared_ptr<Entry>> queue_;
+    std::shared_ptr<Entry> in_flight_;
+    clock::time_point in_flight_since_;
+    clock::time_point next_allowed_;
+    std::chrono::milliseconds interval_ {1000};
+    Stats stats_;
+    double total_wait_ms_ = 0;
+    Timer timer_;
+    Failed on_failed_;
+
+}; // class QueryScheduler
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_QUERY_SCHEDULER_HPP_
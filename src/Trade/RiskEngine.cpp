@@ -0,0 +1,282 @@
+#include <algorithm>
+
+#include "RiskEngine.hpp"
+
+namespace tabxx {
+namespace {
+
+int Side(char direction) {
+    return direction == THOST_FTDC_D_Buy ? 0 : 1;
+}
+
+template <typename Levels>
+void Release(Levels& levels, double price) {
+    auto it = levels.find(price);
+    if (it != levels.end() && --it->second == 0)
+        levels.erase(it);
+}
+
+} // namespace
+
+void RiskEngine::setLimits(const RiskLimits& limits) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    limits_ = limits;
+}
+
+void RiskEngine::setInstrumentLimits(const string& instrument, int max_order_volume, int max_position) {
+    const auto i = resolve(instrument);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& s = slots_[i];
+    s.max_order_volume = max_order_volume;
+    s.max_position = max_position;
+}
+
+RiskLimits RiskEngine::limits() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return limits_;
+}
+
+uint32_t RiskEngine::resolve(const string& instrument) {
+    {
+        std::shared_lock<std::shared_mutex> lock(index_mutex_);
+        auto it = index_.find(instrument);
+        if (it != index_.end())
+            return it->second;
+    }
+    std::unique_lock<std::shared_mutex> index_lock(index_mutex_);
+    auto it = index_.find(instrument);
+    if (it != index_.end())
+        return it->second;
+    std::lock_guard<std::mutex> lock(mutex_);
+    const auto i = static_cast<uint32_t>(slots_.size());
+    slots_.emplace_back();
+    index_.emplace(instrument, i);
+    return i;
+}
+
+std::string RiskEngine::check(const RiskOrder& order, const TickStore& ticks) {
+    // Read before taking our lock, TickStore has its own.
+    Tick tick;
+    const bool have_tick = order.price_type == THOST_FTDC_OPT_LimitPrice && ticks.get(order.instrument, tick);
+    std::lock_guard<std::mutex> lock(mutex_);
+    return verdict(order, tick, have_tick);
+}
+
+std::string RiskEngine::reserve(const string& key, const RiskOrder& order, const TickStore& ticks) {
+    Tick tick;
+    const bool have_tick = order.price_type == THOST_FTDC_OPT_LimitPrice && ticks.get(order.instrument, tick);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto rejected = verdict(order, tick, have_tick);
+    if (!rejected.empty())
+        return rejected;
+    WorkingOrder o {
+        order.slot,
+        order.direction,
+        order.offset == THOST_FTDC_OF_Open,
+        order.price_type == THOST_FTDC_OPT_LimitPrice ? order.price : 0,
+        order.volume,
+        clock::time_point()
+    };
+    if (limits_.max_orders_per_second > 0) {
+        // verdict() rolled the window.
+        ++orders_this_second_;
+        o.second = second_;
+    }
+    if (working_.emplace(key, o).second)
+        add(o);
+    return "";
+}
+
+// Requires the lock.
+std::string RiskEngine::verdict(const RiskOrder& order, const Tick& tick, bool have_tick) {
+    const bool market = order.price_type != THOST_FTDC_OPT_LimitPrice;
+    const auto& s = slots_[order.slot];
+
+    const int max_volume = s.max_order_volume >= 0 ? s.max_order_volume : limits_.max_order_volume;
+    if (max_volume > 0 && order.volume > max_volume)
+        return "max order volume " + std::to_string(max_volume) + " exceeded";
+
+    if (order.offset == THOST_FTDC_OF_Open) {
+        const int max_position = s.max_position >= 0 ? s.max_position : limits_.max_position;
+        const int side = Side(order.direction);
+        if (max_position > 0 && s.position[side] + s.working_open[side] + order.volume > max_position)
+            return "max position " + std::to_string(max_position) + " exceeded";
+    }
+
+    if (limits_.price_band && have_tick) {
+        if (tick.upper_limit_price > 0 && order.price > tick.upper_limit_price)
+            return "price above upper limit " + std::to_string(tick.upper_limit_price);
+        if (tick.lower_limit_price > 0 && order.price < tick.lower_limit_price)
+            return "price below lower limit " + std::to_string(tick.lower_limit_price);
+    }
+
+    if (limits_.self_cross) {
+        if (order.direction == THOST_FTDC_D_Buy && !s.sells.empty()) {
+            const double best_sell = s.sells.begin()->first;
+            if (market || order.price >= best_sell)
+                return "crosses own resting sell at " + std::to_string(best_sell);
+        }
+        if (order.direction == THOST_FTDC_D_Sell && !s.buys.empty()) {
+            const double best_buy = s.buys.begin()->first;
+            if (market || order.price <= best_buy)
+                return "crosses own resting buy at " + std::to_string(best_buy);
+        }
+    }
+
+    if (limits_.max_orders_per_second > 0) {
+        roll(clock::now());
+        if (orders_this_second_ >= limits_.max_orders_per_second)
+            return "max " + std::to_string(limits_.max_orders_per_second) + " orders per second exceeded";
+    }
+    return "";
+}
+
+void RiskEngine::onOrder(const CThostFtdcOrderField& f) {
+    const string key = std::to_string(f.FrontID) + ":" + std::to_string(f.SessionID) + ":" + f.OrderRef;
+    const int remaining = IsWorking(f) ? f.VolumeTotal : 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = working_.find(key);
+        if (it != working_.end()) {
+            auto& o = it->second;
+            if (o.remaining == remaining)
+                return;
+            if (remaining > 0) {
+                // Partly traded, still resting at the same price.
+                if (o.open) {
+                    auto& w = slots_[o.slot].working_open[Side(o.direction)];
+                    w = std::max(0, w + remaining - o.remaining);
+                }
+                o.remaining = remaining;
+                return;
+            }
+            auto done = o;
+            working_.erase(it);
+            remove(done);
+            return;
+        }
+    }
+    // Orders from other sessions of the account, or from before a restart.
+    if (remaining == 0)
+        return;
+    WorkingOrder o {
+        resolve(f.InstrumentID),
+        f.Direction,
+        f.CombOffsetFlag[0] == THOST_FTDC_OF_Open,
+        f.OrderPriceType == THOST_FTDC_OPT_LimitPrice ? f.LimitPrice : 0,
+        remaining,
+        clock::time_point()
+    };
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (working_.emplace(key, o).second)
+        add(o);
+}
+
+void RiskEngine::onRejected(const string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = working_.find(key);
+    if (it == working_.end())
+        return;
+    auto done = it->second;
+    working_.erase(it);
+    remove(done);
+}
+
+void RiskEngine::onUnsent(const string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = working_.find(key);
+    if (it == working_.end())
+        return;
+    auto done = it->second;
+    working_.erase(it);
+    remove(done);
+    if (done.second == second_ && done.second != clock::time_point() && orders_this_second_ > 0)
+        --orders_this_second_;
+}
+
+void RiskEngine::onTrade(const CThostFtdcTradeField& f) {
+    const auto i = resolve(f.InstrumentID);
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& s = slots_[i];
+    if (f.OffsetFlag == THOST_FTDC_OF_Open) {
+        s.position[Side(f.Direction)] += f.Volume;
+    }
+    else {
+        // Closing a buy reduces the short side and vice versa.
+        auto& p = s.position[1 - Side(f.Direction)];
+        p = std::max(0, p - f.Volume);
+    }
+}
+
+void RiskEngine::setPositions(const std::vector<Position>& positions) {
+    std::vector<uint32_t> slots;
+    slots.reserve(positions.size());
+    for (const auto& p : positions)
+        slots.push_back(resolve(p.instrument));
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& s : slots_)
+        s.position[0] = s.position[1] = 0;
+    for (size_t i = 0; i < positions.size(); ++i)
+        slots_[slots[i]].position[positions[i].direction == PositionDirection::LONG ? 0 : 1] = positions[i].position;
+}
+
+nlohmann::json RiskEngine::toJson() const {
+    std::shared_lock<std::shared_mutex> index_lock(index_mutex_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    nlohmann::json instruments = nlohmann::json::object();
+    for (const auto& [instrument, i] : index_) {
+        const auto& s = slots_[i];
+        if (s.max_order_volume < 0 && s.max_position < 0)
+            continue;
+        instruments[instrument] = {
+            {"max_order_volume", s.max_order_volume},
+            {"max_position", s.max_position}
+        };
+    }
+    return nlohmann::json {
+        {"max_order_volume", limits_.max_order_volume},
+        {"max_position", limits_.max_position},
+        {"max_orders_per_second", limits_.max_orders_per_second},
+        {"price_band", limits_.price_band},
+        {"self_cross", limits_.self_cross},
+        {"instruments", std::move(instruments)}
+    };
+}
+
+// Requires the lock.
+void RiskEngine::add(const WorkingOrder& o) {
+    auto& s = slots_[o.slot];
+    if (o.open)
+        s.working_open[Side(o.direction)] += o.remaining;
+    if (o.price <= 0)
+        return;
+    if (o.direction == THOST_FTDC_D_Buy)
+        ++s.buys[o.price];
+    else
+        ++s.sells[o.price];
+}
+
+// Requires the lock.
+void RiskEngine::remove(const WorkingOrder& o) {
+    auto& s = slots_[o.slot];
+    if (o.open) {
+        auto& w = s.working_open[Side(o.direction)];
+        w = std::max(0, w - o.remaining);
+    }
+    if (o.price <= 0)
+        return;
+    if (o.direction == THOST_FTDC_D_Buy)
+        Release(s.buys, o.price);
+    else
+        Release(s.sells, o.price);
+}
+
+// Requires the lock.
+void RiskEngine::roll(clock::time_point now) {
+    if (now - second_ >= std::chrono::seconds(1)) {
+        second_ = now;
+        orders_this_second_ = 0;
+    }
+}
+
+} // namespace tabxx
@@ -0,0 +1,126 @@
+#ifndef TABXX_TRADE_RISK_ENGINE_HPP_
+#define TABXX_TRADE_RISK_ENGINE_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ThostFtdcTraderApi.h>
+#include <json.hpp>
+
+#include "../MarketData/TickStore.hpp"
+#include "Position.hpp"
+
+namespace tabxx {
+
+// Limits of the pre-trade checks, 0 disables a check.
+struct RiskLimits {
+    int max_order_volume = 0;
+    int max_position = 0;           // per instrument and side, working opens included
+    int max_orders_per_second = 0;  // per session
+    bool price_band = false;        // limit price within the latest tick's limit prices
+    bool self_cross = false;        // no crossing our own resting orders
+};
+
+// An order about to be sent, in CTP terms.
+struct RiskOrder {
+    const std::string& instrument;
+    uint32_t slot;      // RiskEngine::resolve(instrument)
+    char direction;     // THOST_FTDC_D_*
+    char offset;        // THOST_FTDC_OF_*
+    char price_type;    // THOST_FTDC_OPT_*
+    double price;
+    int volume;
+};
+
+// Pre-trade checks of one trader session, run in insertOrder() before
+// ReqOrderInsert. Per-instrument state is kept in a flat slot array, found
+// by a handle resolved once per instrument, so a check reads a few numbers
+// and does no string work; the bookkeeping to keep it current runs on the
+// CTP thread from OnRtnOrder / OnRtnTrade.
+class RiskEngine {
+    using string = std::string;
+    using clock = std::chrono::steady_clock;
+public:
+    // Session-wide limits, and per-instrument overrides of the volume limits
+    // (a negative value falls back to the session limit).
+    void setLimits(const RiskLimits& limits);
+    void setInstrumentLimits(const string& instrument, int max_order_volume, int max_position);
+    RiskLimits limits() const;
+
+    // Slot handle of an instrument for RiskOrder::slot, stable for the life
+    // of the engine.
+    uint32_t resolve(const string& instrument);
+
+    // Returns an empty string when the order passes, the reason otherwise.
+    // Changes nothing: see reserve() for an order about to be sent.
+    string check(const RiskOrder& order, const TickStore& ticks);
+    // check(), and when the order passes, registers it as working until
+    // OnRtnOrder says otherwise and counts it against the rate limit, in one
+    // step: orders placed at once from several threads cannot all pass on
+    // the same headroom. onUnsent() takes it back if sending it fails.
+    string reserve(const string& key, const RiskOrder& order, const TickStore& ticks);
+
+    void onOrder(const CThostFtdcOrderField& f);
+    // The order was refused before reaching the exchange (no OnRtnOrder follows).
+    void onRejected(const string& key);
+    // ReqOrderInsert failed: as onRejected(), and the order no longer counts
+    // against the rate limit.
+    void onUnsent(const string& key);
+    void onTrade(const CThostFtdcTradeField& f);
+    // Replaces the positions after a reconciliation with CTP.
+    void setPositions(const std::vector<Position>& positions);
+
+    nlohmann::json toJson() const;
+
+private:
+    struct WorkingOrder {
+        uint32_t slot;
+        char direction;
+        bool open;
+        double price;       // 0 for market orders
+        int remaining;
+        clock::time_point second;   // rate window it was counted in, if any
+    };
+
+    struct Slot {
+        int max_order_volume = -1;
+        int max_position = -1;
+        int position[2] = {0, 0};       // long, short
+        int working_open[2] = {0, 0};   // volume of working opens per side
+        // Resting limit orders per price: the best of each side is at the
+        // front, and adding or removing one is a single tree update.
+        std::map<double, int, std::greater<double>> buys;
+        std::map<double, int> sells;
+    };
+
+    // check() and reserve() with the lock held.
+    string verdict(const RiskOrder& order, const Tick& tick, bool have_tick);
+    // remove() expects `o` to be out of working_ already.
+    void remove(const WorkingOrder& o);
+    void add(const WorkingOrder& o);
+    // Starts a new one-second window when the last one is over.
+    void roll(clock::time_point now);
+
+private:
+    // Lock order: index_mutex_, then mutex_.
+    mutable std::shared_mutex index_mutex_;
+    std::unordered_map<string, uint32_t> index_;
+    mutable std::mutex mutex_;
+    RiskLimits limits_;
+    std::vector<Slot> slots_;
+    std::unordered_map<string, WorkingOrder> working_;  // FrontID:SessionID:OrderRef
+    clock::time_point second_;
+    int orders_this_second_ = 0;
+
+}; // class RiskEngine
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_RISK_ENGINE_HPP_
@@ -0,0 +1,38 @@
+#include <functional>
+#include <random>
+
+#include "Handler.hpp"
+#include "TraderPool.hpp"
+
+namespace tabxx {
+
+TraderPool::TraderPool() {
+    std::random_device rd;
+    salt_ = std::to_string(rd()) + std::to_string(rd());
+}
+
+void TraderPool::add(const string& key, const string& password, std::shared_ptr<TraderHandler> session) {
+    sessions_[key] = Entry {hash(password), std::move(session)};
+}
+
+std::shared_ptr<TraderHandler> TraderPool::find(const string& key, const string& password) const {
+    auto it = sessions_.find(key);
+    if (it == sessions_.end() || it->second.secret != hash(password) || !it->second.session->loggedIn())
+        return nullptr;
+    return it->second.session;
+}
+
+void TraderPool::remove(const TraderHandler* session) {
+    for (auto it = sessions_.begin(); it != sessions_.end(); ) {
+        if (it->second.session.get() == session)
+            it = sessions_.erase(it);
+        else
+            ++it;
+    }
+}
+
+size_t TraderPool::hash(const string& password) const {
+    return std::hash<string>()(salt_ + password);
+}
+
+} // namespace tabxx
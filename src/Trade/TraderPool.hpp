@@ -0,0 +1,49 @@
+#ifndef TABXX_TRADE_TRADER_POOL_HPP_
+#define TABXX_TRADE_TRADER_POOL_HPP_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace tabxx {
+
+class TraderHandler;
+
+// Logged-in trader sessions by account ("<broker id>:<user id>"), so that
+// further clients of an account attach to the live CTP session instead of
+// running auth, login and settlement confirmation again. Loop thread only.
+class TraderPool {
+    using string = std::string;
+public:
+    TraderPool();
+
+    static string Key(const string& broker_id, const string& user_id) {
+        return broker_id + ":" + user_id;
+    }
+
+    // Registers `session` once its login succeeded with `password`,
+    // replacing an earlier session of the account.
+    void add(const string& key, const string& password, std::shared_ptr<TraderHandler> session);
+    // The session of `key` if it is logged in and `password` matches the one
+    // it logged in with.
+    std::shared_ptr<TraderHandler> find(const string& key, const string& password) const;
+    // Drops `session` from the pool; it lives on while clients hold it.
+    void remove(const TraderHandler* session);
+
+private:
+    struct Entry {
+        size_t secret;      // salted hash of the login password
+        std::shared_ptr<TraderHandler> session;
+    };
+
+    size_t hash(const string& password) const;
+
+private:
+    string salt_;
+    std::unordered_map<string, Entry> sessions_;
+
+}; // class TraderPool
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_TRADER_POOL_HPP_
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <cfloat>
+
+#include "TriggerBook.hpp"
+#include "Handler.hpp"
+
+namespace tabxx {
+namespace {
+
+// CTP leaves missing prices at DBL_MAX.
+bool Valid(double price) {
+    return price > 0 && price < DBL_MAX;
+}
+
+} // namespace
+
+nlohmann::json ToJson(const ConditionalOrder& o) {
+    static const char* const fields[] = {"last", "bid", "ask"};
+    return nlohmann::json {
+        {"id", o.id},
+        {"order_req_id", o.req_id},
+        {"instrument_id", o.instrument},
+        {"exchange_id", o.exchange},
+        {"trigger_field", fields[static_cast<int>(o.field)]},
+        {"trigger_op", o.above ? ">=" : "<="},
+        {"trigger_price", o.level},
+        {"price", o.price},
+        {"direction", o.direction},
+        {"offset", o.offset},
+        {"volume", o.volume},
+        {"price_type", o.price_type},
+        {"time_condition", o.time_condition},
+        {"memo", o.memo},
+        {"tag", o.tag}
+    };
+}
+
+int TriggerBook::add(ConditionalOrder order, const std::shared_ptr<TraderHandler>& session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    order.id = next_id_++;
+    auto& ladder = ladders_[order.instrument];
+    const int field = static_cast<int>(order.field);
+    if (order.above)
+        ladder.above[field].emplace(order.level, order.id);
+    else
+        ladder.below[field].emplace(order.level, order.id);
+    const int id = order.id;
+    entries_.emplace(id, Entry {std::move(order), session.get(), session});
+    ++count_;
+    return id;
+}
+
+bool TriggerBook::remove(int id, const TraderHandler* session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(id);
+    if (it == entries_.end() || it->second.owner != session)
+        return false;
+    erase(it->second);
+    entries_.erase(it);
+    --count_;
+    return true;
+}
+
+void TriggerBook::removeAll(const TraderHandler* session) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto it = entries_.begin(); it != entries_.end();) {
+        if (it->second.owner == session) {
+            erase(it->second);
+            it = entries_.erase(it);
+            --count_;
+        }
+        else {
+            ++it;
+        }
+    }
+}
+
+std::vector<ConditionalOrder> TriggerBook::orders(const TraderHandler* session) const {
+    std::vector<ConditionalOrder> out;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& [id, e] : entries_) {
+        if (e.owner == session)
+            out.push_back(e.order);
+    }
+    std::sort(out.begin(), out.end(), [] (const ConditionalOrder& a, const ConditionalOrder& b) {
+        return a.id < b.id;
+    });
+    return out;
+}
+
+void TriggerBook::onTick(const CThostFtdcDepthMarketDataField& f, LatencyClock::time_point received) {
+    if (count_ == 0)
+        return;
+    const double prices[kFields] = {f.LastPrice, f.BidPrice1, f.AskPrice1};
+    std::vector<Entry> fired;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto ladder = ladders_.find(f.InstrumentID);
+        if (ladder == ladders_.end())
+            return;
+        std::vector<int> ids;
+        for (int i = 0; i < kFields; ++i) {
+            if (!Valid(prices[i]))
+                continue;
+            collect(ladder->second.above[i], prices[i], ids);
+            collect(ladder->second.below[i], prices[i], ids);
+        }
+        fired.reserve(ids.size());
+        for (int id : ids) {
+            auto it = entries_.find(id);
+            if (it == entries_.end())
+                continue;
+            fired.push_back(std::move(it->second));
+            entries_.erase(it);
+            --count_;
+        }
+    }
+    // Sending takes a while and may call back into the book; the session
+    // is kept alive for the call, and destroyed on its own thread should it
+    // have been let go meanwhile.
+    for (const auto& e : fired) {
+        auto session = e.session.lock();
+        if (!session)
+            continue;
+        session->fireConditional(e.order, prices[static_cast<int>(e.order.field)], received);
+        TraderHandler::ReleaseOnLoop(std::move(session));
+    }
+}
+
+void TriggerBook::erase(const Entry& e) {
+    auto ladder = ladders_.find(e.order.instrument);
+    if (ladder == ladders_.end())
+        return;
+    const int field = static_cast<int>(e.order.field);
+    auto drop = [&e] (auto& levels) {
+        auto [first, last] = levels.equal_range(e.order.level);
+        for (auto it = first; it != last; ++it) {
+            if (it->second == e.order.id) {
+                levels.erase(it);
+                return;
+            }
+        }
+    };
+    if (e.order.above)
+        drop(ladder->second.above[field]);
+    else
+        drop(ladder->second.below[field]);
+}
+
+template <typename L>
+void TriggerBook::collect(L& ladder, double price, std::vector<int>& ids) {
+    // Levels are ordered nearest first: ascending for rising triggers,
+    // descending for falling ones.
+    auto it = ladder.begin();
+    while (it != ladder.end() && !ladder.key_comp()(price, it->first)) {
+        ids.push_back(it->second);
+        it = ladder.erase(it);
+    }
+}
+
+} // namespace tabxx
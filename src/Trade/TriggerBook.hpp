@@ -0,0 +1,103 @@
+#ifndef TABXX_TRADE_TRIGGER_BOOK_HPP_
+#define TABXX_TRADE_TRIGGER_BOOK_HPP_
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <ThostFtdcMdApi.h>
+#include <json.hpp>
+
+#include "../Latency.hpp"
+#include "Flags.hpp"
+
+namespace tabxx {
+
+class TraderHandler;
+
+// Tick price a conditional order watches.
+enum class TriggerField {
+    LAST = 0,
+    BID = 1,
+    ASK = 2
+};
+
+// An order held in the server until the watched price reaches `level`.
+struct ConditionalOrder {
+    int id = 0;
+    int req_id = 0;             // sent with this req_id, so its events reach the client that placed it
+    std::string instrument;
+    std::string exchange;
+    TriggerField field = TriggerField::LAST;
+    bool above = true;          // fires at price >= level, otherwise at price <= level
+    double level = 0;
+    double price = 0;
+    Direction direction = Direction::BUY;
+    OrderOffset offset = OrderOffset::OPEN;
+    int volume = 0;
+    OrderPriceType price_type = OrderPriceType::LIMITED;
+    TimeCondition time_condition = TimeCondition::ONE_DAY;
+    std::string memo;
+    std::string tag;
+    bool latency = false;       // the order carries its timing in its events
+};
+
+nlohmann::json ToJson(const ConditionalOrder& o);
+
+// Conditional orders of every trade session, evaluated on the market data
+// thread as ticks arrive. Each instrument keeps one ladder per price field
+// and side sorted by level, so a tick only looks at the nearest levels and
+// fires everything it crossed, O(log n) per fired order.
+class TriggerBook {
+    using string = std::string;
+public:
+    // Arms `order` for `session`, returns its id. Only a weak reference is
+    // kept: the orders of a session that is gone do not fire.
+    int add(ConditionalOrder order, const std::shared_ptr<TraderHandler>& session);
+    bool remove(int id, const TraderHandler* session);
+    // Drops every order of `session`. One that onTick() has already taken
+    // out still fires if the session is alive.
+    void removeAll(const TraderHandler* session);
+    std::vector<ConditionalOrder> orders(const TraderHandler* session) const;
+
+    // Market data thread. Sends the orders whose condition `f` meets through
+    // their session, after taking them out of the book and without holding
+    // its lock; `received` is when the tick arrived.
+    void onTick(const CThostFtdcDepthMarketDataField& f, LatencyClock::time_point received);
+
+private:
+    static constexpr int kFields = 3;
+    using Rising = std::multimap<double, int>;                          // fire at price >= level
+    using Falling = std::multimap<double, int, std::greater<double>>;   // fire at price <= level
+    struct Ladder {
+        Rising above[kFields];
+        Falling below[kFields];
+    };
+    struct Entry {
+        ConditionalOrder order;
+        const TraderHandler* owner;
+        std::weak_ptr<TraderHandler> session;
+    };
+
+    // Requires the lock.
+    void erase(const Entry& e);
+    template <typename L>
+    void collect(L& ladder, double price, std::vector<int>& ids);
+
+private:
+    mutable std::mutex mutex_;
+    std::atomic<size_t> count_ {0};
+    int next_id_ = 1;
+    std::unordered_map<int, Entry> entries_;
+    std::unordered_map<string, Ladder> ladders_;
+
+}; // class TriggerBook
+
+} // namespace tabxx
+
+#endif // TABXX_TRADE_TRIGGER_BOOK_HPP_
@@ -7,6 +7,8 @@
 #include <uWebSockets/HttpResponse.h>
 #include <json.hpp>
 
+#include "Wire.hpp"
+
 namespace tabxx {
 
 class MarketDataHandler;
@@ -14,7 +16,8 @@ class TraderHandler;
 
 struct WSContext {
     std::unique_ptr<MarketDataHandler> md;
-    std::unique_ptr<TraderHandler> trade;
+    std::shared_ptr<TraderHandler> trade;   // may be shared with other clients of the account
+    Wire wire = Wire::JSON;                 // negotiated at the upgrade
 };
 
 using WebSocket = uWS::WebSocket<false, true, WSContext>;
@@ -22,6 +25,10 @@ using HttpResponse = uWS::HttpResponse<false>;
 using HttpRequest = uWS::HttpRequest;
 using nlohmann::json;
 
+inline uWS::OpCode OpCodeOf(Wire wire) {
+    return wire == Wire::JSON ? uWS::OpCode::TEXT : uWS::OpCode::BINARY;
+}
+
 } // namespace tabxx
 
 #endif // TABXX_TYPES_HPP_
\ No newline at end of file
@@ -6,32 +6,173 @@
 #include "Trade/Handler.hpp"
 
 namespace tabxx {
+namespace {
 
-string mkmsg(const string& msg, const json& err, const json& info) {
-    return json {
+// Tells a trade session which client it is serving, and when the message
+// arrived, for the duration of one message.
+class Serving {
+public:
+    Serving(TraderHandler& trade, WebSocket* ws, LatencyClock::time_point received, LatencyClock::time_point parsed):
+        trade_(trade) {
+        trade_.serve(ws);
+        trade_.stamp(received, parsed);
+    }
+
+    ~Serving() {
+        trade_.serve(nullptr);
+        trade_.stamp({}, {});
+    }
+
+private:
+    TraderHandler& trade_;
+};
+
+// Admin routes answer only peers on this host, whatever address the server
+// listens on.
+bool FromLocalhost(HttpResponse* res) {
+    const auto peer = res->getRemoteAddressAsText();
+    if (peer == "127.0.0.1" || peer == "::1" || peer == "::ffff:127.0.0.1")
+        return true;
+    res
+    ->writeStatus("403 Forbidden")
+    ->writeHeader("Content-Type", "application/json")
+    ->end(json {{"error", "admin routes are only served to localhost"}}.dump());
+    return false;
+}
+
+// Gives a handler the client correlation id of one message.
+template <typename Handler>
+class Correlating {
+public:
+    Correlating(Handler& handler, json cid): handler_(handler) {
+        handler_.correlate(std::move(cid));
+    }
+
+    ~Correlating() {
+        handler_.correlate(json());
+    }
+
+private:
+    Handler& handler_;
+};
+
+// Error replies echo the cid too, when the message had a valid one.
+json errorInfo(const json& cid) {
+    return cid.is_null() ? json{} : json {{"cid", cid}};
+}
+
+} // namespace
+
+// Sends a server message in the encoding of the connection.
+void sendmsg(WebSocket* ws, const string& msg, const json& err, const json& info) {
+    const Wire wire = ws->getUserData()->wire;
+    ws->send(Encode(json {
         {"msg", msg},
         {"err", err},
         {"info", info}
-    }.dump();
+    }, wire), OpCodeOf(wire));
+}
+
+// Picks the connection's encoding from the offered subprotocols and
+// answers with the one chosen.
+void upgrade(HttpResponse* res, HttpRequest* req, us_socket_context_t* context) {
+    const auto wire = NegotiateWire(req->getHeader("sec-websocket-protocol"));
+    WSContext ctx;
+    ctx.wire = wire.value_or(Wire::JSON);
+    res->upgrade<WSContext>(std::move(ctx),
+        req->getHeader("sec-websocket-key"),
+        wire ? WireProtocol(*wire) : "",
+        req->getHeader("sec-websocket-extensions"),
+        context);
+}
+
+bool WebSocketApp::read(std::string_view msg, uWS::OpCode opcode, Wire wire, json& data) {
+    if (opcode == uWS::OpCode::BINARY) {
+        data = DecodeBinary(msg, wire);
+        return false;
+    }
+    // Read on demand; what JsonDocument leaves alone goes through nlohmann,
+    // which also tells invalid payloads apart.
+    if (doc_.parse(msg))
+        return true;
+    data = json::parse(msg);
+    return false;
 }
 
 void WebSocketApp::init() {
+    state_.instruments.open(flow_);
     app_.get("/health", [] (HttpResponse* res, HttpRequest* req) {
         res
         ->writeStatus("200 OK")
         ->writeHeader("Content-Type", "text/html; charset=utf-8")
         ->end("<html><body><h1>OK</h1></body></html>");
     })
+    .get("/latency", [&] (HttpResponse* res, HttpRequest* req) {
+        if (!FromLocalhost(res))
+            return;
+        auto body = state_.latency.toJson().dump();
+        if (req->getQuery("reset") == "1")
+            state_.latency.reset();
+        res
+        ->writeStatus("200 OK")
+        ->writeHeader("Content-Type", "application/json")
+        ->end(body);
+    })
+    .get("/log-levels", [&] (HttpResponse* res, HttpRequest* req) {
+        if (!FromLocalhost(res))
+            return;
+        // With `level`, sets that of `scope`, or of every scope without it.
+        const auto level_name = req->getQuery("level");
+        if (!level_name.empty()) {
+            const auto level = ParseLogLevel(level_name);
+            if (!level) {
+                res
+                ->writeStatus("400 Bad Request")
+                ->writeHeader("Content-Type", "application/json")
+                ->end(json {{"error", "level must be debug, info, warn, error or off"}}.dump());
+                return;
+            }
+            const string scope(req->getQuery("scope"));
+            if (scope.empty()) {
+                logger_.setLevel(*level);
+            }
+            else if (LogScope* found = logger_.find(scope)) {
+                found->setLevel(*level);
+            }
+            else {
+                // Not made here: the scopes are a fixed pool, see kMaxScopes.
+                res
+                ->writeStatus("404 Not Found")
+                ->writeHeader("Content-Type", "application/json")
+                ->end(json {{"error", "unknown scope " + scope}}.dump());
+                return;
+            }
+            logger_.warn("Log level of "_s + (scope.empty() ? "all scopes" : scope) + " set to " + LogLevelName(*level));
+        }
+        json scopes = json::object();
+        for (const auto& [name, level] : logger_.levels())
+            scopes[name] = LogLevelName(level);
+        const auto drops = logger_.drops();
+        res
+        ->writeStatus("200 OK")
+        ->writeHeader("Content-Type", "application/json")
+        ->end(json {
+            {"floor", LogLevelName(kLogFloor)},
+            {"scopes", scopes},
+            {"dropped", {{"newest", drops.newest}, {"oldest", drops.oldest}}}
+        }.dump());
+    })
     .ws("/market_data", uWS::App::WebSocketBehavior<WSContext> {
+        .upgrade = upgrade,
         .open = [&] (WebSocket* ws) {
-            ws->getUserData()->md = std::make_unique<MarketDataHandler>(ws, uWS::Loop::get(), &logger_, flow_);
+            ws->getUserData()->md = std::make_unique<MarketDataHandler>(ws, uWS::Loop::get(), &logger_, flow_, &state_);
             logger_.info("New MarketData connection accepted.", "ws-md");
-            ws->send(mkmsg("ready", json{}, 
+            sendmsg(ws, "ready", json{}, 
                 json {
                     {"server_version", "0.0.1"},
                     {"ctp_api_version", CThostFtdcMdApi::GetApiVersion()}
                 }
-            ));
+            );
         },
         .message = [&] (WebSocket* ws, std::string_view msg, uWS::OpCode opcode) {
             if (!ws || !ws->getUserData() || !ws->getUserData()->md) {
@@ -39,40 +180,51 @@ void WebSocketApp::init() {
                 return;
             }
             json data;
+            bool on_demand;
             try {
-                data = json::parse(msg);
+                on_demand = read(msg, opcode, ws->getUserData()->wire, data);
             }
             catch (const std::exception& e) {
                 try {
-                    ws->send(mkmsg("parse_error",
+                    sendmsg(ws, "parse_error",
                         json {
                             {"msg", "Invalid JSON payload"}
                         },
                         json{}
-                    ));
+                    );
                 } catch (...) {
                     logger_.error("Failed to send error response", "ws-md");
                 }
                 return;
             }
+            json cid;
             try {
-                auto res = HandleMarketDataMessage(data, *ws->getUserData()->md);
+                auto& md = *ws->getUserData()->md;
+                auto res = on_demand
+                    ? ReadCid(doc_.root(), cid)
+                    : ReadCid(data, cid);
+                if (res.empty()) {
+                    Correlating<MarketDataHandler> correlating(md, cid);
+                    res = on_demand
+                        ? HandleMarketDataMessage(doc_.root(), md)
+                        : HandleMarketDataMessage(data, md);
+                }
                 if (!res.empty()) {
-                    ws->send(mkmsg("error",
+                    sendmsg(ws, "error",
                         json {
                             {"msg", res}
                         },
-                        json{}
-                    ));
+                        errorInfo(cid)
+                    );
                 }
             } catch (const std::exception& e) {
                 try {
-                    ws->send(mkmsg("processing_error",
+                    sendmsg(ws, "processing_error",
                         json {
                             {"msg", "Processing error"}
                         },
-                        json{}
-                    ));
+                        errorInfo(cid)
+                    );
                 } catch (...) {
                     logger_.error("Failed to send error response", "ws-md");
                 }
@@ -87,56 +239,85 @@ void WebSocketApp::init() {
         },
     })
     .ws("/trade", uWS::App::WebSocketBehavior<WSContext> {
+        .upgrade = upgrade,
         .open = [&] (WebSocket* ws) {
-            ws->getUserData()->trade = std::make_unique<TraderHandler>(ws, uWS::Loop::get(), &logger_, flow_);
+            ws->getUserData()->trade = std::make_shared<TraderHandler>(uWS::Loop::get(), &logger_, flow_, &state_);
+            ws->getUserData()->trade->attach(ws);
             logger_.info("New Trade connection accepted.", "ws-trade");
-            ws->send(mkmsg("ready", json{},
+            sendmsg(ws, "ready", json{},
                 json {
                     {"server_version", "0.0.1"},
                     {"ctp_api_version", CThostFtdcTraderApi::GetApiVersion()}
                 }
-            ));
+            );
         },
         .message = [&] (WebSocket* ws, std::string_view msg, uWS::OpCode opcode) {
             if (!ws || !ws->getUserData() || !ws->getUserData()->trade) {
                 logger_.error("nullptr", "ws-trade");
                 return;
             }
+            const auto received = LatencyClock::now();
             json data;
+            bool on_demand;
             try {
-                data = json::parse(msg);
+                on_demand = read(msg, opcode, ws->getUserData()->wire, data);
             }
             catch (const std::exception& e) {
                 try {
-                    ws->send(mkmsg("parse_error",
+                    sendmsg(ws, "parse_error",
                         json {
                             {"msg", "Invalid JSON payload"}
                         },
                         json{}
-                    ));
+                    );
                 } catch (...) {
                     logger_.error("Failed to send error response", "ws-trade");
                 }
                 return;
             }
+            const auto parsed = LatencyClock::now();
+            json cid;
             try {
-                auto res = HandleTraderMessage(data, *ws->getUserData()->trade);
+                string res = on_demand
+                    ? ReadCid(doc_.root(), cid)
+                    : ReadCid(data, cid);
+                const auto op = on_demand ? doc_.root().find("op") : std::nullopt;
+                const bool attach = on_demand
+                    ? op && op->equals("attach")
+                    : data.is_object() && data.contains("op") && data["op"] == "attach";
                 if (!res.empty()) {
-                    ws->send(mkmsg("error",
+                    // An invalid cid, reported below.
+                }
+                else if (attach) {
+                    // Rare enough to take the DOM.
+                    if (on_demand)
+                        data = json::parse(msg);
+                    res = HandleTraderAttach(data, ws, state_.traders);
+                }
+                else {
+                    auto& trade = *ws->getUserData()->trade;
+                    Serving serving(trade, ws, received, parsed);
+                    Correlating<TraderHandler> correlating(trade, cid);
+                    res = on_demand
+                        ? HandleTraderMessage(doc_.root(), trade)
+                        : HandleTraderMessage(data, trade);
+                }
+                if (!res.empty()) {
+                    sendmsg(ws, "error",
                         json {
                             {"msg", res}
                         },
-                        json{}
-                    ));
+                        errorInfo(cid)
+                    );
                 }
             } catch (const std::exception& e) {
                 try {
-                    ws->send(mkmsg("processing_error",
+                    sendmsg(ws, "processing_error",
                         json {
                             {"msg", "Processing error"}
                         },
-                        json{}
-                    ));
+                        errorInfo(cid)
+                    );
                 } catch (...) {
                     logger_.error("Failed to send error response", "ws-trade");
                 }
@@ -145,7 +326,7 @@ void WebSocketApp::init() {
         .close = [&] (WebSocket* ws, int code, std::string_view msg) {
             if (ws && ws->getUserData()) {
                 if (ws->getUserData()->trade) {
-                    ws->getUserData()->trade->onClosed();
+                    ws->getUserData()->trade->detach(ws);
                 }
                 ws->getUserData()->trade.reset();
             }
@@ -4,15 +4,19 @@
 #include <string>
 #include <uWebSockets/App.h>
 
+#include "JsonDocument.hpp"
 #include "Logger.hpp"
+#include "SharedState.hpp"
+#include "Types.hpp"
 
 namespace tabxx {
 using std::string;
 
 class WebSocketApp {
 public:
-    WebSocketApp(const string& addr, const string& port, const string& flow, const string& log = ""):
-        logger_(makeLogger(log)), addr_(addr), port_(port), flow_(flow) {
+    WebSocketApp(const string& addr, const string& port, const string& flow, const string& log = "",
+            const LogOptions& log_options = {}):
+        logger_(makeLogger(log, log_options)), addr_(addr), port_(port), flow_(flow) {
         try {
             init();
         } catch (const std::exception& e) {
@@ -33,19 +37,24 @@ public:
     }
 
 private:
-    static Logger makeLogger(const string& log) {
+    static Logger makeLogger(const string& log, const LogOptions& options) {
         if (log.empty()) {
-            return Logger("ws-app");
+            return Logger("ws-app", options);
         } else {
-            return Logger(log, "ws-app");
+            return Logger(log, "ws-app", options);
         }
     }
     
     void init();
+    // Decodes an inbound message: true when it was read on demand into
+    // doc_, false when it is in `data`. Throws on an invalid payload.
+    bool read(std::string_view msg, uWS::OpCode opcode, Wire wire, json& data);
 
 private:
     bool flag_runnable_ = false;
     Logger logger_;
+    SharedState state_;
+    JsonDocument doc_;      // inbound message being handled, loop thread only
     uWS::App app_;
     string flow_;
     string addr_;
@@ -0,0 +1,102 @@
+#include <stdexcept>
+
+#include "Wire.hpp"
+
+namespace tabxx {
+namespace {
+
+constexpr const char* kProtocols[] = {"webctp.json", "webctp.msgpack", "webctp.cbor"};
+constexpr const char* kEnvelope[] = {"msg", "err", "info"};
+
+int EnvelopeKey(const std::string& key) {
+    for (int i = 0; i < 3; ++i) {
+        if (key == kEnvelope[i])
+            return i;
+    }
+    return -1;
+}
+
+std::string_view Trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+} // namespace
+
+std::optional<Wire> NegotiateWire(std::string_view offered) {
+    while (!offered.empty()) {
+        const auto comma = offered.find(',');
+        const auto name = Trim(offered.substr(0, comma));
+        for (int i = 0; i < 3; ++i) {
+            if (name == kProtocols[i])
+                return static_cast<Wire>(i);
+        }
+        if (comma == std::string_view::npos)
+            break;
+        offered.remove_prefix(comma + 1);
+    }
+    return std::nullopt;
+}
+
+const char* WireProtocol(Wire wire) {
+    return kProtocols[static_cast<int>(wire)];
+}
+
+std::string Encode(const nlohmann::json& message, Wire wire) {
+    if (wire == Wire::JSON)
+        return message.dump();
+    const bool cbor = wire == Wire::CBOR;
+    std::string out;
+    auto put = [&out, cbor] (const nlohmann::json& v) {
+        if (cbor)
+            nlohmann::json::to_cbor(v, out);
+        else
+            nlohmann::json::to_msgpack(v, out);
+    };
+    // Both encodings have a one byte header for maps of up to 15 entries,
+    // and keys 0..2 are one byte integers in both.
+    if (!message.is_object() || message.size() > 15) {
+        put(message);
+        return out;
+    }
+    out += static_cast<char>((cbor ? 0xA0 : 0x80) | message.size());
+    for (const auto& [key, value] : message.items()) {
+        const int k = EnvelopeKey(key);
+        if (k >= 0)
+            out += static_cast<char>(k);
+        else
+            put(key);
+        put(value);
+    }
+    return out;
+}
+
+nlohmann::json DecodeBinary(std::string_view payload, Wire wire) {
+    switch (wire) {
+    case Wire::MSGPACK:
+        return nlohmann::json::from_msgpack(payload.begin(), payload.end());
+    case Wire::CBOR:
+        return nlohmann::json::from_cbor(payload.begin(), payload.end());
+    default:
+        throw std::invalid_argument("Binary frame on a JSON connection");
+    }
+}
+
+std::string_view Frame::encoded(Wire wire) {
+    if (!message_ && wire == Wire::JSON)
+        return text_;
+    auto& slot = encoded_[static_cast<int>(wire)];
+    if (!slot) {
+        if (!message_) {
+            parsed_ = nlohmann::json::parse(text_);
+            message_ = &parsed_;
+        }
+        slot = Encode(*message_, wire);
+    }
+    return *slot;
+}
+
+} // namespace tabxx
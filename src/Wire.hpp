@@ -0,0 +1,55 @@
+#ifndef TABXX_WIRE_HPP_
+#define TABXX_WIRE_HPP_
+
+#include <array>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include <json.hpp>
+
+namespace tabxx {
+
+// Encoding a WebSocket connection speaks, picked at the upgrade from the
+// Sec-WebSocket-Protocol header: "webctp.msgpack" or "webctp.cbor" switch
+// every request, reply and push to binary frames; "webctp.json" or no
+// protocol at all keeps JSON text.
+enum class Wire {
+    JSON = 0,
+    MSGPACK = 1,
+    CBOR = 2
+};
+
+// First protocol of `offered` (the comma separated header) that we speak.
+std::optional<Wire> NegotiateWire(std::string_view offered);
+const char* WireProtocol(Wire wire);
+
+// Serializes a {msg, err, info} message. Binary encodings key the envelope
+// with integers, 0 for msg, 1 for err and 2 for info; other keys, and every
+// key inside err and info, stay strings.
+std::string Encode(const nlohmann::json& message, Wire wire);
+// A request in a binary encoding, a map with "op" and "data" like its JSON
+// form. Throws on malformed input.
+nlohmann::json DecodeBinary(std::string_view payload, Wire wire);
+
+// A message delivered to clients that may speak different encodings; each
+// one is produced once, on first use.
+// Holds on to what it is built from.
+class Frame {
+public:
+    explicit Frame(const nlohmann::json& message): message_(&message) {}
+    // Already JSON text, such as an aggregated reply assembled by hand.
+    explicit Frame(std::string_view text): text_(text) {}
+
+    std::string_view encoded(Wire wire);
+
+private:
+    const nlohmann::json* message_ = nullptr;
+    nlohmann::json parsed_;     // text_ parsed, for the binary encodings
+    std::string_view text_;
+    std::array<std::optional<std::string>, 3> encoded_;
+};
+
+} // namespace tabxx
+
+#endif // TABXX_WIRE_HPP_
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
@@ -16,6 +18,7 @@ struct Config {
     string port = "8888";
     string flow = "./flow";
     string log = "";
+    LogOptions log_options;
 };
 
 int parseArgs(int argc, char** args, Config& config);
@@ -31,7 +34,7 @@ int main(int argc, char** args) {
     }
 
     try {
-        WebSocketApp app(config.addr, config.port, config.flow, config.log);
+        WebSocketApp app(config.addr, config.port, config.flow, config.log, config.log_options);
         app.run();
         return 0;
     } catch (const std::exception& e) {
@@ -41,14 +44,24 @@ int main(int argc, char** args) {
 }
 
 const char * hint = 
-"Usage: WebCTP [-m <mode>] [-a <address>] [-p <port>] [-f <flow>] [-l <log>] [-h|-v]\n"
+"Usage: WebCTP [-m <mode>] [-a <address>] [-p <port>] [-f <flow>] [-l <log>]\n"
+"              [--log-flush <ms>] [--log-level <level>] [--log-overflow <policy>]\n"
+"              [--color <auto|always|never>] [-h|-v]\n"
 "Options:\n"
 "  -h, --help       Display this help message and exit\n"
 "  -v, --version    Display the version information and exit\n"
 "  -a, --addr       Specify the address to listen on (default: localhost)\n"
 "  -p, --port       Specify the port to listen on (default: 8888)\n"
 "  -f, --flow       Specify the flow directory (default: ./flow)\n"
-"  -l, --log        Specify the path log files (default: no file logging)";
+"  -l, --log        Specify the path log files (default: no file logging)\n"
+"  --log-flush      Hold log output up to <ms> milliseconds to write it in fewer,\n"
+"                   larger writes; errors are written at once (default: 0)\n"
+"  --log-level      Least level logged: debug, info, warn, error or off (default: info);\n"
+"                   adjustable per scope at run time through GET /log-levels\n"
+"  --log-overflow   When the log queue is full: drop-new, drop-oldest, or block-errors\n"
+"                   (ERROR waits for room, the rest is dropped) (default: block-errors)\n"
+"  --color          Color console logs: auto (when stdout is a terminal), always\n"
+"                   or never (default: auto)";
 
 
 int parseArgs(int argc, char** args, Config& config) {
@@ -84,6 +97,15 @@ int parseArgs(int argc, char** args, Config& config) {
                 return 1;
             }
         }
+        else if (arg == "-f" || arg == "--flow") {
+            if (i + 1 < argc) {
+                config.flow = args[++i];
+            } else {
+                std::cerr << "Error: Option " << arg << " requires an argument." << std::endl;
+                std::cerr << hint << std::endl;
+                return 1;
+            }
+        }
         else if (arg == "-l" || arg == "--log") {
             if (i + 1 < argc) {
                 config.log = args[++i];
@@ -93,6 +115,53 @@ int parseArgs(int argc, char** args, Config& config) {
                 return 1;
             }
         }
+        else if (arg == "--log-flush") {
+            if (i + 1 < argc) {
+                config.log_options.flush_interval = std::chrono::milliseconds(std::max(0, std::atoi(args[++i])));
+            } else {
+                std::cerr << "Error: Option " << arg << " requires an argument." << std::endl;
+                std::cerr << hint << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--log-level") {
+            auto level = i + 1 < argc ? ParseLogLevel(args[++i]) : std::nullopt;
+            if (level) {
+                config.log_options.level = *level;
+            } else {
+                std::cerr << "Error: Option " << arg << " requires debug, info, warn, error or off." << std::endl;
+                std::cerr << hint << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--log-overflow") {
+            string value = i + 1 < argc ? args[++i] : "";
+            if (value == "drop-new") {
+                config.log_options.overflow = LogOptions::Overflow::DropNew;
+            } else if (value == "drop-oldest") {
+                config.log_options.overflow = LogOptions::Overflow::DropOldest;
+            } else if (value == "block-errors") {
+                config.log_options.overflow = LogOptions::Overflow::BlockErrors;
+            } else {
+                std::cerr << "Error: Option " << arg << " requires drop-new, drop-oldest or block-errors." << std::endl;
+                std::cerr << hint << std::endl;
+                return 1;
+            }
+        }
+        else if (arg == "--color") {
+            string value = i + 1 < argc ? args[++i] : "";
+            if (value == "auto") {
+                config.log_options.color = LogOptions::Color::Auto;
+            } else if (value == "always") {
+                config.log_options.color = LogOptions::Color::Always;
+            } else if (value == "never") {
+                config.log_options.color = LogOptions::Color::Never;
+            } else {
+                std::cerr << "Error: Option " << arg << " requires auto, always or never." << std::endl;
+                std::cerr << hint << std::endl;
+                return 1;
+            }
+        }
         else {
             std::cerr << "Error: Unknown option '" << arg << "'." << std::endl;
             std::cerr << hint << std::endl;
@@ -0,0 +1,241 @@
+// Dispatch throughput of typed requests (src/Request.hpp) against the
+// string-keyed map of std::function with hand-written checks they replaced.
+// Both sides run the same two ops on a stub handler; the error messages are
+// compared first, then each side decodes and runs a mix of messages. The
+// last two lines time the whole request path from the raw text, through
+// nlohmann::json and through the on-demand JsonDocument.
+#include "../src/JsonDocument.hpp"
+#include "../src/Request.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+using nlohmann::json;
+using namespace tabxx;
+
+namespace {
+
+struct Sink {
+	int64_t n = 0;
+	void insertOrder(const std::string& instrument, double price, int direction, int volume, const std::string& tag) {
+		n += static_cast<int64_t>(instrument.size() + tag.size()) + static_cast<int64_t>(price) + direction + volume;
+	}
+	void deleteOrder(const std::string& exchange, int ref) {
+		n += static_cast<int64_t>(exchange.size()) + ref;
+	}
+	void touch() { ++n; }
+};
+
+// Hand-written checks, as the handlers used to be.
+const std::unordered_map<std::string, std::function<std::string(const json&, Sink&)>> map_ops {
+	{"insert_order", [](const json& j, Sink& s) -> std::string {
+		if (!j.contains("instrument"))
+			return "Error: Field \"instrument\" not found.";
+		if (!j["instrument"].is_string())
+			return "Error: Field \"instrument\" type error (expected string).";
+		if (!j.contains("price"))
+			return "Error: Field \"price\" not found.";
+		if (!j["price"].is_number())
+			return "Error: Field \"price\" type error (expected number).";
+		if (!j.contains("direction"))
+			return "Error: Field \"direction\" not found.";
+		if (!j["direction"].is_number_integer())
+			return "Error: Field \"direction\" type error (expected integer).";
+		if (static_cast<int>(j["direction"]) < 0 || static_cast<int>(j["direction"]) > 1)
+			return "Error: Field \"direction\" out of range (0..1).";
+		if (!j.contains("volume"))
+			return "Error: Field \"volume\" not found.";
+		if (!j["volume"].is_number())
+			return "Error: Field \"volume\" type error (expected number).";
+		if (j.contains("tag")) {
+			if (!j["tag"].is_string())
+				return "Error: Field \"tag\" type error (expected string).";
+		}
+		s.insertOrder(j["instrument"], j["price"], j["direction"], j["volume"], j.contains("tag")? j["tag"]: "");
+		return "";
+	}},
+	{"delete_order", [](const json& j, Sink& s) -> std::string {
+		if (!j.contains("exchange"))
+			return "Error: Field `exchange` not found.";
+		if (!j["exchange"].is_string())
+			return "Error: Field `exchange` type error (expected string).";
+		if (!j.contains("delete_ref"))
+			return "Error: Field `delete_ref` not found.";
+		if (!j["delete_ref"].is_number_integer())
+			return "Error: Field `delete_ref` type error (expected integer).";
+		s.deleteOrder(j["exchange"], j["delete_ref"]);
+		return "";
+	}},
+	{"query_stats", [](const json&, Sink& s) -> std::string { s.touch(); return ""; }},
+	{"query_algos", [](const json&, Sink& s) -> std::string { s.touch(); return ""; }},
+	{"query_conditional", [](const json&, Sink& s) -> std::string { s.touch(); return ""; }},
+	{"confirm_settlement_info", [](const json&, Sink& s) -> std::string { s.touch(); return ""; }},
+};
+
+struct InsertOrder {
+	static constexpr std::string_view kOp = "insert_order";
+	std::string instrument;
+	double price = 0;
+	int direction = 0;
+	int volume = 0;
+	std::string tag;
+	static constexpr auto fields() {
+		return std::make_tuple(
+			Required("instrument", &InsertOrder::instrument),
+			Required("price", &InsertOrder::price),
+			Required("direction", &InsertOrder::direction).range(0, 1),
+			Required("volume", &InsertOrder::volume).as(FieldType::NUMBER),
+			Optional("tag", &InsertOrder::tag));
+	}
+	std::string run(Sink& s) const {
+		s.insertOrder(instrument, price, direction, volume, tag);
+		return "";
+	}
+};
+
+struct DeleteOrder {
+	static constexpr std::string_view kOp = "delete_order";
+	std::string exchange;
+	int delete_ref = 0;
+	static constexpr auto fields() {
+		return std::make_tuple(
+			Required("exchange", &DeleteOrder::exchange).quoted('`'),
+			Required("delete_ref", &DeleteOrder::delete_ref).quoted('`'));
+	}
+	std::string run(Sink& s) const {
+		s.deleteOrder(exchange, delete_ref);
+		return "";
+	}
+};
+
+template <int N>
+struct Touch {
+	static constexpr std::string_view kOp = N == 0 ? "query_stats"
+		: N == 1 ? "query_algos"
+		: N == 2 ? "query_conditional"
+		: "confirm_settlement_info";
+	static constexpr auto fields() { return std::make_tuple(); }
+	std::string run(Sink& s) const { s.touch(); return ""; }
+};
+
+template <typename J>
+OpRunner<Sink, J> find_op(std::string_view op) {
+	switch (OpHash(op)) {
+	case OpHash(InsertOrder::kOp): return MatchOp<InsertOrder, Sink, J>(op);
+	case OpHash(DeleteOrder::kOp): return MatchOp<DeleteOrder, Sink, J>(op);
+	case OpHash(Touch<0>::kOp): return MatchOp<Touch<0>, Sink, J>(op);
+	case OpHash(Touch<1>::kOp): return MatchOp<Touch<1>, Sink, J>(op);
+	case OpHash(Touch<2>::kOp): return MatchOp<Touch<2>, Sink, J>(op);
+	case OpHash(Touch<3>::kOp): return MatchOp<Touch<3>, Sink, J>(op);
+	default: return nullptr;
+	}
+}
+
+std::string run_map(const json& msg, Sink& s) {
+	const std::string op = msg["op"];
+	auto it = map_ops.find(op);
+	if (it == map_ops.end())
+		return "Error: Unknown operation `" + op + "`.";
+	return it->second(msg["data"], s);
+}
+
+template <typename J>
+std::string run_typed(const J& msg, Sink& s) {
+	const auto op = request::Member(msg, "op")->template get<std::string>();
+	auto run = find_op<J>(op);
+	if (!run)
+		return "Error: Unknown operation `" + op + "`.";
+	return run(*request::Member(msg, "data"), s);
+}
+
+JsonDocument doc;
+
+std::string parse_nlohmann(const std::string& text, Sink& s) {
+	return run_typed(json::parse(text), s);
+}
+
+std::string parse_on_demand(const std::string& text, Sink& s) {
+	if (!doc.parse(text))
+		return run_typed(json::parse(text), s);
+	return run_typed(doc.root(), s);
+}
+
+json message(const char* op, json data) {
+	return json {{"op", op}, {"data", std::move(data)}};
+}
+
+template <typename F, typename M>
+double ns_per_op(F&& run, const std::vector<M>& msgs, int rounds, Sink& s) {
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rounds; ++r) {
+		for (const auto& m : msgs)
+			s.n += static_cast<int64_t>(run(m, s).size());
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (static_cast<double>(rounds) * msgs.size());
+}
+
+} // namespace
+
+int main() {
+	const json order = {{"instrument", "rb2410"}, {"price", 3500.0}, {"direction", 0}, {"volume", 1}, {"tag", "bench"}};
+	std::vector<json> bad {
+		message("insert_order", json::object()),
+		message("insert_order", {{"instrument", 1}}),
+		message("insert_order", {{"instrument", "rb2410"}, {"price", "x"}}),
+		message("insert_order", {{"instrument", "rb2410"}, {"price", 1}, {"direction", 2}}),
+		message("insert_order", {{"instrument", "rb2410"}, {"price", 1}, {"direction", 1.5}}),
+		message("insert_order", {{"instrument", "rb2410"}, {"price", 1}, {"direction", 1}, {"volume", true}}),
+		message("insert_order", {{"instrument", "rb2410"}, {"price", 1}, {"direction", 1}, {"volume", 1}, {"tag", 3}}),
+		message("delete_order", json::object()),
+		message("delete_order", {{"exchange", "SHFE"}, {"delete_ref", "1"}}),
+		message("cancel_everything", json::object()),
+	};
+	Sink sink;
+	for (const auto& m : bad) {
+		const auto expected = run_map(m, sink);
+		const auto got = run_typed(m, sink);
+		const auto text = m.dump();
+		const auto got_on_demand = parse_on_demand(text, sink);
+		if (expected != got || expected != got_on_demand || expected.empty()) {
+			std::cerr << "Error mismatch for " << text << ":\n  map:       " << expected
+				<< "\n  typed:     " << got << "\n  on demand: " << got_on_demand << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<json> msgs {
+		message("insert_order", order),
+		message("delete_order", {{"exchange", "SHFE"}, {"delete_ref", 7}}),
+		message("query_stats", json::object()),
+		message("confirm_settlement_info", json::object()),
+		message("insert_order", {{"instrument", "rb2410"}, {"price", 1}, {"direction", 3}}),
+	};
+	constexpr int rounds = 200000;
+	std::vector<std::string> texts;
+	for (const auto& m : msgs)
+		texts.push_back(m.dump());
+	// Warm up every path once.
+	ns_per_op(run_map, msgs, rounds / 10, sink);
+	ns_per_op(run_typed<json>, msgs, rounds / 10, sink);
+	ns_per_op(parse_nlohmann, texts, rounds / 10, sink);
+	ns_per_op(parse_on_demand, texts, rounds / 10, sink);
+	const double map_ns = ns_per_op(run_map, msgs, rounds, sink);
+	const double typed_ns = ns_per_op(run_typed<json>, msgs, rounds, sink);
+	const double nlohmann_ns = ns_per_op(parse_nlohmann, texts, rounds, sink);
+	const double on_demand_ns = ns_per_op(parse_on_demand, texts, rounds, sink);
+
+	std::cout << "map of std::function: " << map_ns << " ns/message" << std::endl;
+	std::cout << "typed switch:         " << typed_ns << " ns/message" << std::endl;
+	std::cout << "text, nlohmann:       " << nlohmann_ns << " ns/message" << std::endl;
+	std::cout << "text, on demand:      " << on_demand_ns << " ns/message" << std::endl;
+	std::cout << "(checksum " << sink.n << ")" << std::endl;
+	return 0;
+}
@@ -0,0 +1,152 @@
+// Producer-side latency of tabxx::Logger::info() with 8 threads logging at
+// once, in bursts as the gateway does around the open and on busy order
+// flow, against the mutex-guarded std::queue with a polling worker it
+// replaced. The time counted includes putting the message together: by the
+// caller, or only capturing its arguments for a deferred one. All write to
+// stdout, sent to /dev/null; results go to stderr.
+#include "../src/Logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kThreads = 8;
+constexpr int kBursts = 200;
+constexpr int kPerBurst = 200;
+
+// The previous implementation, for reference: the worker takes one message
+// per lock and sleeps 100 ms whenever it finds the queue empty.
+class OldLogger {
+public:
+	OldLogger() : worker_(&OldLogger::worker, this) {}
+
+	~OldLogger() {
+		stop_.store(true);
+		worker_.join();
+	}
+
+	void info(const std::string& s, const std::string& scope) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		queue_.push(Message {std::chrono::system_clock::now() + std::chrono::hours(8), 0, scope, s});
+	}
+
+private:
+	struct Message {
+		std::chrono::system_clock::time_point time;
+		int level;
+		std::string scope;
+		std::string text;
+	};
+
+	void worker() {
+		for (;;) {
+			std::unique_lock<std::mutex> lock(mutex_);
+			if (queue_.empty()) {
+				lock.unlock();
+				if (stop_.load())
+					break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				continue;
+			}
+			Message msg(queue_.front());
+			queue_.pop();
+			lock.unlock();
+			write(msg);
+		}
+	}
+
+	static void write(const Message& msg) {
+		auto time_t = std::chrono::system_clock::to_time_t(msg.time);
+		std::tm* tm = std::gmtime(&time_t);
+		char time_buf[64];
+		std::snprintf(time_buf, sizeof(time_buf), "[UTC+8 %04d-%02d-%02d %02d:%02d:%02d]",
+			tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+		std::string line = time_buf;
+		line += " [INFO ] [" + msg.scope + "] " + msg.text + '\n';
+		std::cout.write(line.data(), line.size());
+		std::cout.flush();
+	}
+
+	std::mutex mutex_;
+	std::queue<Message> queue_;
+	std::atomic<bool> stop_ {false};
+	std::thread worker_;
+};
+
+struct Result {
+	double p50, p99, p999, max;
+	double seconds;
+};
+
+constexpr tabxx::LogFormat kOrder {"OnRtnOrder: OrderRef={}, InstrumentID={}, OrderStatus={}"};
+
+template <typename Log, bool Deferred = false>
+Result run() {
+	std::vector<std::vector<double>> latencies(kThreads);
+	const auto begin = Clock::now();
+	{
+		Log log;
+		std::vector<std::thread> threads;
+		for (int t = 0; t < kThreads; ++t) {
+			threads.emplace_back([&log, &mine = latencies[t], t] {
+				mine.reserve(kBursts * kPerBurst);
+				const std::string scope = "thread-" + std::to_string(t);
+				const tabxx::LogScope* deferred_scope = nullptr;
+				if constexpr (Deferred)
+					deferred_scope = &log.scope(scope);
+				for (int b = 0; b < kBursts; ++b) {
+					for (int i = 0; i < kPerBurst; ++i) {
+						const auto start = Clock::now();
+						if constexpr (Deferred) {
+							log.info(kOrder, *deferred_scope, b * kPerBurst + i, "rb2410", '3');
+						} else {
+							log.info("OnRtnOrder: OrderRef=" + std::to_string(b * kPerBurst + i)
+								+ ", InstrumentID=rb2410, OrderStatus=3", scope);
+						}
+						mine.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+					}
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				}
+			});
+		}
+		for (auto& th : threads)
+			th.join();
+	}
+	const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+
+	std::vector<double> all;
+	for (auto& v : latencies)
+		all.insert(all.end(), v.begin(), v.end());
+	std::sort(all.begin(), all.end());
+	auto at = [&] (double q) { return all[static_cast<size_t>(q * (all.size() - 1))]; };
+	return {at(0.5), at(0.99), at(0.999), all.back(), seconds};
+}
+
+void print(const char* name, const Result& r) {
+	std::fprintf(stderr, "%-24s p50 %8.0f ns  p99 %8.0f ns  p99.9 %9.0f ns  max %10.0f ns  (all written in %.2f s)\n",
+		name, r.p50, r.p99, r.p999, r.max, r.seconds);
+}
+
+} // namespace
+
+int main() {
+	if (!std::freopen("/dev/null", "w", stdout)) {
+		std::perror("freopen");
+		return 1;
+	}
+	std::fprintf(stderr, "%d threads, %d bursts of %d messages each\n", kThreads, kBursts, kPerBurst);
+	print("mutex + std::queue", run<OldLogger>());
+	print("tabxx::Logger (ring)", run<tabxx::Logger>());
+	print("tabxx::Logger deferred", run<tabxx::Logger, true>());
+	return 0;
+}
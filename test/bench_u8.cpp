@@ -0,0 +1,121 @@
+// GBK -> UTF-8 conversion of CTP text by tabxx::u8(), decoding with its own
+// table, against the two-pass GBK -> UTF-16 -> UTF-8 conversion through ICU
+// it replaced. The samples are
+// what CTP sends in its char arrays: IDs, dates and times (ASCII), order
+// status and error messages (GBK), instrument names (mixed) and a
+// settlement statement (long, mostly ASCII). Both sides are checked to give
+// the same bytes first. Short samples repeat, as they do from CTP, so u8()
+// answers them from its cache after the first round.
+#include "../src/Encoding.hpp"
+
+#include <unicode/ucnv.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace {
+
+// The previous implementation, for reference.
+std::string two_pass(const std::string& gbk) {
+	thread_local UConverter* gbk_conv = nullptr;
+	thread_local UConverter* utf8_conv = nullptr;
+	thread_local std::vector<UChar> unicode;
+	UErrorCode status = U_ZERO_ERROR;
+	if (!gbk_conv)
+		gbk_conv = ucnv_open("GBK", &status);
+	if (!utf8_conv)
+		utf8_conv = ucnv_open("UTF-8", &status);
+	if (U_FAILURE(status))
+		throw std::runtime_error("ucnv_open");
+	if (gbk.empty())
+		return {};
+	ucnv_reset(gbk_conv);
+	ucnv_reset(utf8_conv);
+	unicode.resize(gbk.size());
+	const int32_t n = ucnv_toUChars(gbk_conv, unicode.data(), static_cast<int32_t>(unicode.size()),
+		gbk.data(), static_cast<int32_t>(gbk.size()), &status);
+	std::string out(static_cast<size_t>(n) * 3, '\0');
+	const int32_t m = ucnv_fromUChars(utf8_conv, out.data(), static_cast<int32_t>(out.size()),
+		unicode.data(), n, &status);
+	if (U_FAILURE(status))
+		throw std::runtime_error("two pass conversion");
+	out.resize(static_cast<size_t>(m));
+	return out;
+}
+
+struct Set {
+	const char* name;
+	std::vector<std::string> samples;
+};
+
+std::string statement() {
+	// Column headers in GBK ("成交记录", "平仓明细") between rows of figures.
+	std::string s;
+	for (int i = 0; i < 40; ++i) {
+		if (i % 10 == 0)
+			s += i % 20 == 0 ? "\xB3\xC9\xBD\xBB\xBC\xC7\xC2\xBC\n" : "\xC6\xBD\xB2\xD6\xC3\xF7\xCF\xB8\n";
+		s += "|20240611|SHFE|rb2410      |Buy |Open |    3500.000|      2|     70000.00|      2.10|\n";
+	}
+	return s;
+}
+
+template <typename F>
+double ns_per_sample(F&& convert, const std::vector<std::string>& samples, int rounds, int64_t& sink) {
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rounds; ++r) {
+		for (const auto& s : samples)
+			sink += static_cast<int64_t>(convert(s).size());
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / (static_cast<double>(rounds) * samples.size());
+}
+
+} // namespace
+
+int main() {
+	const std::vector<Set> sets {
+		{"ascii ids and times", {"rb2410", "SHFE", "20240611", "10:15:32", "      123456", "1", "9999", "0000001"}},
+		{"gbk messages", {
+			"CTP:\xD5\xFD\xC8\xB7",                                                         // CTP:正确
+			"CTP:\xB1\xA8\xB5\xA5\xD7\xD6\xB6\xCE\xD3\xD0\xCE\xF3",                         // CTP:报单字段有误
+			"CTP:\xC6\xBD\xBD\xF1\xB2\xD6\xCE\xBB\xB2\xBB\xD7\xE3",                         // CTP:平今仓位不足
+			"\xC8\xAB\xB2\xBF\xB3\xC9\xBD\xBB\xB1\xA8\xB5\xA5\xD2\xD1\xCC\xE1\xBD\xBB",     // 全部成交报单已提交
+			"\xD2\xD1\xB3\xB7\xB5\xA5",                                                     // 已撤单
+			"\xCE\xB4\xB3\xC9\xBD\xBB",                                                     // 未成交
+			"CTP:\xD5\xFD\xC8",                                                             // cut short
+		}},
+		{"instrument names", {
+			"\xC2\xDD\xCE\xC6\xB8\xD6" "2410",                                              // 螺纹钢2410
+			"\xBB\xA6\xC9\xEE" "300" "\xB9\xC9\xD6\xB8\xC6\xDA\xBB\xF5" "2406",             // 沪深300股指期货2406
+			"IF2406",
+		}},
+		{"settlement statement", {statement()}},
+	};
+
+	int64_t sink = 0;
+	for (const auto& set : sets) {
+		for (const auto& s : set.samples) {
+			if (tabxx::u8(s) != two_pass(s)) {
+				std::cerr << "Mismatch in " << set.name << ": " << two_pass(s) << std::endl;
+				return 1;
+			}
+		}
+	}
+	for (const auto& set : sets) {
+		const int rounds = set.samples.front().size() > 1000 ? 5000 : 200000;
+		auto u8 = [] (const std::string& s) { return tabxx::u8(s); };
+		ns_per_sample(two_pass, set.samples, rounds / 10, sink);
+		ns_per_sample(u8, set.samples, rounds / 10, sink);
+		const double before = ns_per_sample(two_pass, set.samples, rounds, sink);
+		const double after = ns_per_sample(u8, set.samples, rounds, sink);
+		std::cout << set.name << ":\ttwo pass " << before << " ns, u8() " << after << " ns per sample" << std::endl;
+	}
+	const auto cache = tabxx::u8_cache_stats();
+	std::cout << "u8() cache: " << cache.hits << " hits, " << cache.misses << " misses" << std::endl;
+	std::cout << "(checksum " << sink << ")" << std::endl;
+	return 0;
+}
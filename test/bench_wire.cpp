@@ -0,0 +1,165 @@
+// Cost and size of the three wire encodings (src/Wire.hpp) on a MARKET_DATA
+// push, the message a subscribed client receives most. Each encoding is
+// checked to round trip first, then timed for encoding on the server and for
+// decoding on the client. Binary replies key the envelope with integers,
+// which nlohmann::json does not read back, so the client side here reads
+// the envelope itself and leaves each value to nlohmann.
+#include "../src/Wire.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using nlohmann::json;
+using namespace tabxx;
+
+namespace {
+
+// Counts the bytes nlohmann consumes, to find where a value ends.
+struct CountingIterator {
+	using iterator_category = std::input_iterator_tag;
+	using value_type = char;
+	using difference_type = std::ptrdiff_t;
+	using pointer = const char*;
+	using reference = const char&;
+
+	const char* p;
+	const char** last;
+
+	reference operator*() const { return *p; }
+	CountingIterator& operator++() { *last = ++p; return *this; }
+	CountingIterator operator++(int) { auto old = *this; ++*this; return old; }
+	bool operator==(const CountingIterator& o) const { return p == o.p; }
+	bool operator!=(const CountingIterator& o) const { return p != o.p; }
+};
+
+json value(const char*& p, const char* end, Wire wire) {
+	const char* last = p;
+	CountingIterator first {p, &last}, stop {end, &last};
+	json v = wire == Wire::CBOR
+		? json::from_cbor(first, stop, false)
+		: json::from_msgpack(first, stop, false);
+	p = last;
+	return v;
+}
+
+// What a client does with a reply.
+json decode_reply(std::string_view payload, Wire wire) {
+	if (wire == Wire::JSON)
+		return json::parse(payload);
+	static const char* envelope[] = {"msg", "err", "info"};
+	const char* p = payload.data();
+	const char* end = p + payload.size();
+	const int entries = static_cast<uint8_t>(*p++) & 0x0F;
+	json out = json::object();
+	for (int i = 0; i < entries; ++i) {
+		const auto k = static_cast<uint8_t>(*p);
+		std::string key;
+		if (k <= 2) {
+			key = envelope[k];
+			++p;
+		} else {
+			key = value(p, end, wire).get<std::string>();
+		}
+		out[key] = value(p, end, wire);
+	}
+	return out;
+}
+
+json tick(int i) {
+	const double last = 3500.0 + i % 7;
+	return json {
+		{"msg", 1},
+		{"err", json()},
+		{"info", {
+			{"trading_day", "20240611"},
+			{"instrument_id", "rb2410"},
+			{"exchange_id", "SHFE"},
+			{"exchange_inst_id", "rb2410"},
+			{"last_price", last},
+			{"pre_settlement_price", 3498.0},
+			{"pre_close_price", 3495.0},
+			{"pre_open_interest", 1834567.0},
+			{"open_price", 3497.0},
+			{"highest_price", 3512.0},
+			{"lowest_price", 3489.0},
+			{"volume", 512340 + i},
+			{"turnover", 17934567890.0},
+			{"open_interest", 1836789.0},
+			{"close_price", 1.7976931348623157e308},
+			{"settlement_price", 1.7976931348623157e308},
+			{"upper_limit_price", 3778.0},
+			{"lower_limit_price", 3218.0},
+			{"pre_delta", 0.0},
+			{"curr_delta", 1.7976931348623157e308},
+			{"update_time", "10:15:32"},
+			{"update_millisec", 500},
+			{"bp1", last - 1}, {"bv1", 231}, {"ap1", last}, {"av1", 87},
+			{"bp2", last - 2}, {"bv2", 412}, {"ap2", last + 1}, {"av2", 305},
+			{"bp3", last - 3}, {"bv3", 96}, {"ap3", last + 2}, {"av3", 664},
+			{"bp4", last - 4}, {"bv4", 1205}, {"ap4", last + 3}, {"av4", 143},
+			{"bp5", last - 5}, {"bv5", 388}, {"ap5", last + 4}, {"av5", 921},
+			{"average_price", 35003.2},
+			{"action_day", "20240611"},
+			{"banding_upper_price", 0.0},
+			{"banding_lower_price", 0.0}
+		}}
+	};
+}
+
+template <typename F>
+double ns_per_op(F&& run, int rounds, int64_t& sink) {
+	auto start = std::chrono::steady_clock::now();
+	for (int r = 0; r < rounds; ++r)
+		sink += run(r);
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / rounds;
+}
+
+} // namespace
+
+int main() {
+	constexpr Wire wires[] = {Wire::JSON, Wire::MSGPACK, Wire::CBOR};
+	constexpr int ticks = 64;
+	constexpr int rounds = 100000;
+
+	const json request {{"op", "subscribe"}, {"data", {{"instruments", {"rb2410", "ag2412"}}}}};
+	// No envelope keys in a request, so Encode() writes it as is.
+	if (DecodeBinary(Encode(request, Wire::MSGPACK), Wire::MSGPACK) != request
+		|| DecodeBinary(Encode(request, Wire::CBOR), Wire::CBOR) != request) {
+		std::cerr << "Request round trip failed" << std::endl;
+		return 1;
+	}
+
+	std::vector<json> messages;
+	for (int i = 0; i < ticks; ++i)
+		messages.push_back(tick(i));
+
+	int64_t sink = 0;
+	for (Wire wire : wires) {
+		std::vector<std::string> encoded;
+		for (const auto& m : messages) {
+			encoded.push_back(Encode(m, wire));
+			if (decode_reply(encoded.back(), wire) != m) {
+				std::cerr << WireProtocol(wire) << ": tick round trip failed" << std::endl;
+				return 1;
+			}
+		}
+		auto encode = [&] (int r) { return static_cast<int64_t>(Encode(messages[r % ticks], wire).size()); };
+		auto decode = [&] (int r) { return static_cast<int64_t>(decode_reply(encoded[r % ticks], wire).size()); };
+		ns_per_op(encode, rounds / 10, sink);
+		ns_per_op(decode, rounds / 10, sink);
+		const double encode_ns = ns_per_op(encode, rounds, sink);
+		const double decode_ns = ns_per_op(decode, rounds, sink);
+
+		std::cout << WireProtocol(wire) << ":\t" << encoded.front().size() << " bytes/tick, encode "
+			<< encode_ns << " ns, decode " << decode_ns << " ns" << std::endl;
+	}
+	std::cout << "(checksum " << sink << ")" << std::endl;
+	return 0;
+}
@@ -0,0 +1,92 @@
+// Behaviour of tabxx::Correlation along the path of an insert_order: the
+// acknowledgement binds the cid of the client message to the order's
+// req_id, and the events routed by that req_id later, OnRtnOrder among them
+// on the CTP thread, carry it back.
+#include "../src/Correlation.hpp"
+
+#include <iostream>
+#include <string>
+#include <thread>
+
+using nlohmann::json;
+using tabxx::Correlation;
+
+namespace {
+
+int failures = 0;
+
+void expect(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+// As TraderHandler::correlated() does on the loop thread.
+json ack(Correlation& cids, int req_id) {
+	json info {{"req_id", req_id}, {"msg", ""}};
+	if (!cids.current().is_null()) {
+		cids.bind(req_id);
+		info["cid"] = cids.current();
+	}
+	return json {{"msg", 0}, {"err", {{"code", 0}}}, {"info", info}};
+}
+
+json rtn_order(int req_id) {
+	return json {{"msg", 1}, {"data", {{"order_ref", "1"}}}, {"info", {{"req_id", req_id}}}};
+}
+
+void insert_order() {
+	Correlation cids;
+	expect(cids.empty(), "nothing bound yet");
+
+	cids.handle("order-1");
+	const auto reply = ack(cids, 7);
+	cids.handle(nullptr);
+	expect(reply["info"].value("cid", json()) == "order-1", "insert_order reply carries the cid");
+	expect(!cids.empty(), "cid bound by the reply");
+
+	// OnRtnOrder arrives on the CTP thread after the message is handled.
+	json rtn = rtn_order(7);
+	std::thread ctp([&] { cids.tag(rtn, 7); });
+	ctp.join();
+	expect(rtn["info"].value("cid", json()) == "order-1", "OnRtnOrder carries the cid");
+
+	// An integer cid is echoed as it was sent.
+	cids.handle(42);
+	ack(cids, 8);
+	cids.handle(nullptr);
+	json trade = rtn_order(8);
+	cids.tag(trade, 8);
+	expect(trade["info"].value("cid", json()) == 42, "integer cid");
+}
+
+void without_cid() {
+	Correlation cids;
+	const auto reply = ack(cids, 9);
+	expect(!reply["info"].contains("cid"), "no cid sent, none in the reply");
+	json rtn = rtn_order(9);
+	cids.tag(rtn, 9);
+	expect(!rtn["info"].contains("cid"), "no cid sent, none in OnRtnOrder");
+
+	// Another order's cid does not leak to this one.
+	cids.handle("other");
+	ack(cids, 10);
+	cids.handle(nullptr);
+	json mine = rtn_order(9);
+	cids.tag(mine, 9);
+	expect(!mine["info"].contains("cid"), "cid stays with its own req_id");
+}
+
+} // namespace
+
+int main() {
+	insert_order();
+	without_cid();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return 1;
+	}
+	std::cout << "correlation_test: OK" << std::endl;
+	return 0;
+}
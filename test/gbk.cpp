@@ -0,0 +1,143 @@
+// Differential test of tabxx::u8() against ICU's GBK converter over the
+// whole GBK code space: every single byte, every lead byte followed by every
+// byte, lead bytes cut short, and random mixes of all of them.
+//
+// `gbk_test --table` prints src/GbkTable.cpp from ICU's mapping instead.
+#include "../src/Encoding.hpp"
+#include "../src/GbkTable.hpp"
+
+#include <unicode/ucnv.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+
+namespace {
+
+UConverter* open(const char* name) {
+	UErrorCode status = U_ZERO_ERROR;
+	UConverter* conv = ucnv_open(name, &status);
+	if (U_FAILURE(status)) {
+		std::cerr << "Cannot open the " << name << " converter: " << u_errorName(status) << std::endl;
+		std::exit(2);
+	}
+	return conv;
+}
+
+std::u16string to_utf16(UConverter* gbk, const std::string& s) {
+	std::u16string out(s.size() + 1, u'\0');
+	UErrorCode status = U_ZERO_ERROR;
+	ucnv_reset(gbk);
+	const int32_t n = ucnv_toUChars(gbk, out.data(), static_cast<int32_t>(out.size()),
+		s.data(), static_cast<int32_t>(s.size()), &status);
+	out.resize(static_cast<size_t>(n));
+	return out;
+}
+
+std::string reference(UConverter* gbk, UConverter* utf8, const std::string& s) {
+	const auto u = to_utf16(gbk, s);
+	std::string out(u.size() * 3 + 1, '\0');
+	UErrorCode status = U_ZERO_ERROR;
+	ucnv_reset(utf8);
+	const int32_t n = ucnv_fromUChars(utf8, out.data(), static_cast<int32_t>(out.size()),
+		u.data(), static_cast<int32_t>(u.size()), &status);
+	out.resize(static_cast<size_t>(n));
+	return out;
+}
+
+std::string hex(const std::string& s) {
+	std::string out;
+	char buf[4];
+	for (unsigned char c : s) {
+		std::snprintf(buf, sizeof(buf), "%02X ", c);
+		out += buf;
+	}
+	return out;
+}
+
+int print_table(UConverter* gbk) {
+	std::printf("// Generated by `gbk_test --table` from ICU's %s mapping.\n",
+		[&] { UErrorCode status = U_ZERO_ERROR; return ucnv_getName(gbk, &status); }());
+	std::printf("#include \"GbkTable.hpp\"\n\nnamespace tabxx {\n\n");
+	std::printf("extern const uint16_t kGbkTable[kGbkLeads * kGbkTrails] = {\n");
+	for (int lead = 0x81; lead <= 0xFE; ++lead) {
+		std::printf("    // 0x%02X\n", lead);
+		int column = 0;
+		for (int trail = 0x40; trail <= 0xFE; ++trail) {
+			if (trail == 0x7F)
+				continue;
+			const auto u = to_utf16(gbk, std::string {static_cast<char>(lead), static_cast<char>(trail)});
+			if (u.size() != 1 || u[0] < 0x80) {
+				std::cerr << "Unexpected mapping of " << std::hex << lead << " " << trail << std::endl;
+				return 1;
+			}
+			std::printf("%s0x%04X,", column == 0 ? "    " : " ", static_cast<unsigned>(u[0]));
+			if (++column == 10) {
+				std::printf("\n");
+				column = 0;
+			}
+		}
+	}
+	std::printf("};\n\n} // namespace tabxx\n");
+	return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	UConverter* gbk = open("GBK");
+	UConverter* utf8 = open("UTF-8");
+	if (argc > 1 && std::string(argv[1]) == "--table")
+		return print_table(gbk);
+
+	int failures = 0;
+	long checked = 0;
+	auto check = [&] (const std::string& s) {
+		++checked;
+		const auto expected = reference(gbk, utf8, s);
+		const auto got = tabxx::u8(s);
+		if (got == expected)
+			return;
+		if (++failures <= 20) {
+			std::cerr << "Mismatch for " << hex(s) << "\n  icu: " << hex(expected)
+				<< "\n  u8:  " << hex(got) << std::endl;
+		}
+	};
+
+	for (int c = 1; c <= 0xFF; ++c)
+		check(std::string(1, static_cast<char>(c)));
+	for (int lead = 0x81; lead <= 0xFE; ++lead) {
+		for (int trail = 0; trail <= 0xFF; ++trail) {
+			// Behind ASCII and ahead of ASCII, so the fast path is crossed.
+			check(std::string {static_cast<char>(lead), static_cast<char>(trail)});
+			check("ab" + std::string {static_cast<char>(lead), static_cast<char>(trail)} + "cd");
+		}
+	}
+
+	std::mt19937 rng(20240611);
+	std::uniform_int_distribution<int> length(1, 40);
+	std::uniform_int_distribution<int> byte(0, 0xFF);
+	std::uniform_int_distribution<int> ascii(0x20, 0x7E);
+	for (int i = 0; i < 200000; ++i) {
+		std::string s;
+		const int n = length(rng);
+		for (int k = 0; k < n; ++k) {
+			// Half ASCII, so that runs of both come up.
+			const int b = byte(rng) & 1 ? ascii(rng) : byte(rng);
+			s += static_cast<char>(b == 0 ? ' ' : b);
+		}
+		check(s);
+	}
+
+	ucnv_close(gbk);
+	ucnv_close(utf8);
+	if (failures) {
+		std::cerr << failures << " of " << checked << " conversions differ from ICU." << std::endl;
+		return 1;
+	}
+	std::cout << "All " << checked << " conversions match ICU." << std::endl;
+	return 0;
+}
@@ -52,8 +52,16 @@ int main() {
 	logger->info("hello", "scope-a");
 	logger->warn("careful");
 	logger->error("boom", "scope-b");
-
-	if (!wait_for_lines(log_path, 3, std::chrono::milliseconds(1500))) {
+	static constexpr tabxx::LogFormat kDeferred {"order {} of {} at {} {}"};
+	const char instrument[9] = "rb2410";
+	logger->info(kDeferred, logger->scope("scope-c"), 42, instrument, 3850.5, std::string("sent"));
+	// Levels: INFO and up by default, per scope when set.
+	logger->scope("quiet").setLevel(tabxx::LogLevel::WARN);
+	logger->info("hidden", "quiet");
+	logger->warn("shown", "quiet");
+	logger->debug("not at INFO");
+
+	if (!wait_for_lines(log_path, 5, std::chrono::milliseconds(1500))) {
 		std::cerr << "Timeout waiting for log writes" << std::endl;
 		return 1;
 	}
@@ -72,10 +80,22 @@ int main() {
 		return 1;
 	}
 
+	if (basic_content.find("[INFO ] [scope-c] order 42 of rb2410 at 3850.5 sent") == std::string::npos) {
+		std::cerr << "Deferred line missing expected text" << std::endl;
+		return 1;
+	}
+
+	if (basic_content.find("[WARN ] [quiet] shown") == std::string::npos
+			|| basic_content.find("hidden") != std::string::npos
+			|| basic_content.find("not at INFO") != std::string::npos) {
+		std::cerr << "Level filtering did not hold" << std::endl;
+		return 1;
+	}
+
 	// Multi-threaded logging to verify concurrency safety.
 	constexpr int thread_count = 4;
 	constexpr int per_thread = 20;
-	const std::size_t expected_total = 3 + static_cast<std::size_t>(thread_count * per_thread);
+	const std::size_t expected_total = 5 + static_cast<std::size_t>(thread_count * per_thread);
 
 	std::vector<std::thread> workers;
 	workers.reserve(thread_count);
@@ -113,5 +133,25 @@ int main() {
 		return 1;
 	}
 
+	// Held output is written by an ERROR, without waiting for the interval.
+	const fs::path held_path = fs::current_path() / "logger_test_held.log";
+	fs::remove(held_path, ec);
+	tabxx::LogOptions options;
+	options.flush_interval = std::chrono::hours(1);
+	{
+		Logger held(held_path.string(), "held", options);
+		held.info("first");
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		if (!read_all(held_path).empty()) {
+			std::cerr << "INFO written before the flush interval" << std::endl;
+			return 1;
+		}
+		held.error("second");
+		if (!wait_for_lines(held_path, 2, std::chrono::milliseconds(1000))) {
+			std::cerr << "ERROR did not write the held output" << std::endl;
+			return 1;
+		}
+	}
+
 	return 0;
 }
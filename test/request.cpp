@@ -0,0 +1,125 @@
+// Decoding of requests whose fields depend on one another, through
+// nlohmann::json and through JsonDocument: only the fields of the branch an
+// op takes are checked, as the hand-written handlers before Decode() did.
+// The structs mirror QueryOrder and QueryInstrument in MessageHandler.cpp.
+#include "../src/JsonDocument.hpp"
+#include "../src/Request.hpp"
+
+#include <iostream>
+#include <optional>
+#include <string>
+
+using nlohmann::json;
+using tabxx::AllOf;
+using tabxx::Decode;
+using tabxx::FirstOf;
+using tabxx::JsonDocument;
+using tabxx::Optional;
+
+namespace {
+
+int failures = 0;
+
+void expect(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+struct QueryOrder {
+	std::optional<std::string> order_sys_id;
+	std::optional<std::string> exchange_id;
+	std::optional<std::string> from;
+	std::optional<std::string> to;
+	static constexpr auto fields() {
+		return std::make_tuple(
+			FirstOf(
+				AllOf(Optional("order_sys_id", &QueryOrder::order_sys_id)),
+				AllOf(Optional("exchange_id", &QueryOrder::exchange_id)),
+				AllOf(Optional("from", &QueryOrder::from), Optional("to", &QueryOrder::to))));
+	}
+};
+
+struct QueryInstrument {
+	std::string exchange;
+	std::string instrument;
+	std::string exchange_inst_id;
+	std::string product_id;
+	static constexpr auto fields() {
+		constexpr auto ex = Optional("exchange", &QueryInstrument::exchange);
+		constexpr auto inst = Optional("instrument", &QueryInstrument::instrument);
+		constexpr auto ex_inst = Optional("exchange_inst_id", &QueryInstrument::exchange_inst_id);
+		constexpr auto product = Optional("product_id", &QueryInstrument::product_id);
+		return std::make_tuple(
+			FirstOf(
+				AllOf(ex, inst, ex_inst, product),
+				AllOf(ex, inst, ex_inst),
+				AllOf(ex, inst),
+				AllOf(ex)));
+	}
+};
+
+// Decodes `data` both ways and expects the same error from each.
+template <typename R>
+R decode(const std::string& data, const std::string& err, const std::string& what) {
+	R a;
+	expect(Decode(json::parse(data), a) == err, what + " (nlohmann)");
+	JsonDocument doc;
+	R b;
+	if (doc.parse(data))
+		expect(Decode(doc.root(), b) == err, what + " (on demand)");
+	else
+		expect(false, what + ": JsonDocument failed to parse");
+	return a;
+}
+
+void query_order() {
+	auto r = decode<QueryOrder>(R"({"order_sys_id": "  123", "exchange_id": 1})", "",
+		"query_order: exchange_id unread with order_sys_id");
+	expect(r.order_sys_id == std::string("  123") && !r.exchange_id, "query_order: by id");
+
+	r = decode<QueryOrder>(R"({"exchange_id": "SHFE", "from": 1})", "",
+		"query_order: from unread with exchange_id");
+	expect(r.exchange_id == std::string("SHFE") && !r.from, "query_order: by exchange");
+
+	r = decode<QueryOrder>(R"({"from": 1})", "", "query_order: from without to is unread");
+	expect(!r.from && !r.to, "query_order: all orders");
+
+	r = decode<QueryOrder>(R"({"from": "09:00:00", "to": "10:00:00"})", "", "query_order: range");
+	expect(r.from && r.to, "query_order: by range");
+
+	decode<QueryOrder>(R"({"order_sys_id": 1})",
+		"Error: Field \"order_sys_id\" type error (expected string).", "query_order: bad order_sys_id");
+	decode<QueryOrder>(R"({"from": "09:00:00", "to": 1})",
+		"Error: Field \"to\" type error (expected string).", "query_order: bad to");
+}
+
+void query_instrument() {
+	auto r = decode<QueryInstrument>(R"({"instrument": "rb2410"})", "",
+		"query_instrument: instrument without exchange is unread");
+	expect(r.instrument.empty(), "query_instrument: all instruments");
+
+	r = decode<QueryInstrument>(R"({"exchange": "SHFE", "instrument": "rb2410", "product_id": 1})", "",
+		"query_instrument: product_id without exchange_inst_id is unread");
+	expect(r.exchange == "SHFE" && r.instrument == "rb2410" && r.product_id.empty(),
+		"query_instrument: by instrument");
+
+	decode<QueryInstrument>(R"({"exchange": 1, "instrument": 2})",
+		"Error: Field \"exchange\" type error (expected string).", "query_instrument: bad exchange first");
+	decode<QueryInstrument>(R"({"exchange": "SHFE", "instrument": 2})",
+		"Error: Field \"instrument\" type error (expected string).", "query_instrument: bad instrument");
+}
+
+} // namespace
+
+int main() {
+	query_order();
+	query_instrument();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return 1;
+	}
+	std::cout << "request_test: OK" << std::endl;
+	return 0;
+}
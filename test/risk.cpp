@@ -0,0 +1,240 @@
+// Behaviour of tabxx::RiskEngine: each limit on its own, and the working
+// order book it keeps from inserts, OnRtnOrder and OnRtnTrade.
+#include "../src/Trade/RiskEngine.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+using tabxx::RiskEngine;
+using tabxx::RiskLimits;
+using tabxx::RiskOrder;
+using tabxx::TickStore;
+
+namespace {
+
+int failures = 0;
+
+void expect(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAILED: " << what << std::endl;
+		++failures;
+	}
+}
+
+bool passes(RiskEngine& risk, const TickStore& ticks, const RiskOrder& order) {
+	return risk.check(order, ticks).empty();
+}
+
+// The OnRtnOrder CTP sends for the order registered under `ref`.
+CThostFtdcOrderField rtn(const char* ref, const char* instrument, char direction, double price,
+	int volume_left, char status) {
+	CThostFtdcOrderField f;
+	std::memset(&f, 0, sizeof(f));
+	f.FrontID = 1;
+	f.SessionID = 2;
+	std::strcpy(f.OrderRef, ref);
+	std::strcpy(f.InstrumentID, instrument);
+	f.Direction = direction;
+	f.CombOffsetFlag[0] = THOST_FTDC_OF_Open;
+	f.OrderPriceType = THOST_FTDC_OPT_LimitPrice;
+	f.LimitPrice = price;
+	f.VolumeTotal = volume_left;
+	f.OrderStatus = status;
+	f.OrderSubmitStatus = THOST_FTDC_OSS_Accepted;
+	return f;
+}
+
+std::string key(const char* ref) {
+	return std::string("1:2:") + ref;
+}
+
+void order_volume() {
+	RiskEngine risk;
+	TickStore ticks;
+	RiskLimits limits;
+	limits.max_order_volume = 10;
+	risk.setLimits(limits);
+	const std::string rb = "rb2410", au = "au2412";
+	const RiskOrder ok {rb, risk.resolve(rb), THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3800, 10};
+	const RiskOrder big {rb, risk.resolve(rb), THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3800, 11};
+	expect(passes(risk, ticks, ok), "max_order_volume: at the limit");
+	expect(!passes(risk, ticks, big), "max_order_volume: above the limit");
+	risk.setInstrumentLimits(au, 2, -1);
+	const RiskOrder au3 {au, risk.resolve(au), THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 560, 3};
+	expect(!passes(risk, ticks, au3), "max_order_volume: per-instrument override");
+	expect(passes(risk, ticks, ok), "max_order_volume: override is per instrument");
+}
+
+void position() {
+	RiskEngine risk;
+	TickStore ticks;
+	RiskLimits limits;
+	limits.max_position = 5;
+	risk.setLimits(limits);
+	const std::string rb = "rb2410";
+	const auto slot = risk.resolve(rb);
+	const RiskOrder open3 {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3800, 3};
+	expect(risk.reserve(key("1"), open3, ticks).empty(), "max_position: empty book");
+	expect(!passes(risk, ticks, open3), "max_position: working opens count");
+	const RiskOrder close3 {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Close, THOST_FTDC_OPT_LimitPrice, 3800, 3};
+	expect(passes(risk, ticks, close3), "max_position: closes are not limited");
+	const RiskOrder sell3 {rb, slot, THOST_FTDC_D_Sell, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3900, 3};
+	expect(passes(risk, ticks, sell3), "max_position: per side");
+
+	// The working open fills: it turns into position.
+	risk.onOrder(rtn("1", "rb2410", THOST_FTDC_D_Buy, 3800, 0, THOST_FTDC_OST_AllTraded));
+	CThostFtdcTradeField t;
+	std::memset(&t, 0, sizeof(t));
+	std::strcpy(t.InstrumentID, "rb2410");
+	t.Direction = THOST_FTDC_D_Buy;
+	t.OffsetFlag = THOST_FTDC_OF_Open;
+	t.Volume = 3;
+	risk.onTrade(t);
+	expect(!passes(risk, ticks, open3), "max_position: traded position counts");
+	const RiskOrder open2 {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3800, 2};
+	expect(passes(risk, ticks, open2), "max_position: up to the limit");
+
+	// A send that fails is taken back.
+	expect(risk.reserve(key("2"), open2, ticks).empty(), "max_position: at the limit");
+	risk.onRejected(key("2"));
+	expect(passes(risk, ticks, open2), "max_position: rejected order released");
+}
+
+void price_band() {
+	RiskEngine risk;
+	TickStore ticks;
+	RiskLimits limits;
+	limits.price_band = true;
+	risk.setLimits(limits);
+	const std::string rb = "rb2410";
+	const auto slot = risk.resolve(rb);
+	const RiskOrder high {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 4200, 1};
+	expect(passes(risk, ticks, high), "price_band: no tick yet");
+	CThostFtdcDepthMarketDataField md;
+	std::memset(&md, 0, sizeof(md));
+	std::strcpy(md.InstrumentID, "rb2410");
+	md.LastPrice = 3800;
+	md.UpperLimitPrice = 4100;
+	md.LowerLimitPrice = 3500;
+	ticks.update(md);
+	expect(!passes(risk, ticks, high), "price_band: above the upper limit");
+	const RiskOrder low {rb, slot, THOST_FTDC_D_Sell, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3400, 1};
+	expect(!passes(risk, ticks, low), "price_band: below the lower limit");
+	const RiskOrder inside {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 4100, 1};
+	expect(passes(risk, ticks, inside), "price_band: at the upper limit");
+	const RiskOrder market {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_AnyPrice, 0, 1};
+	expect(passes(risk, ticks, market), "price_band: market orders have no price");
+}
+
+void self_cross() {
+	RiskEngine risk;
+	TickStore ticks;
+	RiskLimits limits;
+	limits.self_cross = true;
+	risk.setLimits(limits);
+	const std::string rb = "rb2410";
+	const auto slot = risk.resolve(rb);
+	auto sell = [&] (double price) {
+		return RiskOrder {rb, slot, THOST_FTDC_D_Sell, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, price, 1};
+	};
+	auto buy = [&] (double price) {
+		return RiskOrder {rb, slot, THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, price, 1};
+	};
+	risk.reserve(key("1"), buy(3800), ticks);
+	risk.reserve(key("2"), buy(3790), ticks);
+	risk.reserve(key("3"), buy(3800), ticks);
+	expect(!passes(risk, ticks, sell(3800)), "self_cross: sell at our best buy");
+	expect(passes(risk, ticks, sell(3801)), "self_cross: sell above our best buy");
+	const RiskOrder market {rb, slot, THOST_FTDC_D_Sell, THOST_FTDC_OF_Open, THOST_FTDC_OPT_AnyPrice, 0, 1};
+	expect(!passes(risk, ticks, market), "self_cross: market sell against a resting buy");
+
+	// Two orders rest at 3800: the best stays there until both are gone.
+	risk.onOrder(rtn("1", "rb2410", THOST_FTDC_D_Buy, 3800, 0, THOST_FTDC_OST_Canceled));
+	expect(!passes(risk, ticks, sell(3800)), "self_cross: one of two best buys left");
+	risk.onOrder(rtn("3", "rb2410", THOST_FTDC_D_Buy, 3800, 0, THOST_FTDC_OST_AllTraded));
+	expect(passes(risk, ticks, sell(3800)), "self_cross: best buy gone");
+	expect(!passes(risk, ticks, sell(3790)), "self_cross: next best buy");
+
+	// A partial fill keeps the order resting.
+	risk.onOrder(rtn("2", "rb2410", THOST_FTDC_D_Buy, 3790, 1, THOST_FTDC_OST_PartTradedQueueing));
+	expect(!passes(risk, ticks, sell(3790)), "self_cross: partly traded buy still rests");
+	risk.onOrder(rtn("2", "rb2410", THOST_FTDC_D_Buy, 3790, 0, THOST_FTDC_OST_AllTraded));
+	expect(passes(risk, ticks, sell(3700)), "self_cross: no buys left");
+
+	// Orders of another session are learned from OnRtnOrder.
+	risk.onOrder(rtn("9", "rb2410", THOST_FTDC_D_Sell, 3850, 1, THOST_FTDC_OST_NoTradeQueueing));
+	expect(!passes(risk, ticks, buy(3850)), "self_cross: buy at a sell seen in OnRtnOrder");
+	expect(passes(risk, ticks, buy(3849)), "self_cross: buy below our best sell");
+}
+
+void rate() {
+	RiskEngine risk;
+	TickStore ticks;
+	RiskLimits limits;
+	limits.max_orders_per_second = 3;
+	risk.setLimits(limits);
+	const std::string rb = "rb2410";
+	const RiskOrder o {rb, risk.resolve(rb), THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3800, 1};
+	// Checks alone, and sends that fail, do not count.
+	for (int i = 0; i < 10; ++i)
+		expect(passes(risk, ticks, o), "max_orders_per_second: checks do not count");
+	for (int i = 0; i < 10; ++i) {
+		const auto k = key(std::to_string(100 + i).c_str());
+		expect(risk.reserve(k, o, ticks).empty(), "max_orders_per_second: unsent orders do not count");
+		risk.onUnsent(k);
+	}
+	for (int i = 0; i < 3; ++i)
+		expect(risk.reserve(key(std::to_string(i).c_str()), o, ticks).empty(), "max_orders_per_second: within the limit");
+	expect(!passes(risk, ticks, o), "max_orders_per_second: over the limit");
+}
+
+// Orders placed at once from two threads (the loop and a conditional order
+// firing on the market data thread) share the headroom left by the limits.
+void concurrent() {
+	for (int round = 0; round < 200; ++round) {
+		RiskEngine risk;
+		TickStore ticks;
+		RiskLimits limits;
+		limits.max_position = 1;
+		limits.max_orders_per_second = 1;
+		risk.setLimits(limits);
+		const std::string rb = "rb2410";
+		const RiskOrder o {rb, risk.resolve(rb), THOST_FTDC_D_Buy, THOST_FTDC_OF_Open, THOST_FTDC_OPT_LimitPrice, 3800, 1};
+		std::atomic<bool> go {false};
+		std::atomic<int> passed {0};
+		auto place = [&] (const char* ref) {
+			while (!go.load())
+				;
+			if (risk.reserve(key(ref), o, ticks).empty())
+				++passed;
+		};
+		std::thread a(place, "1"), b(place, "2");
+		go = true;
+		a.join();
+		b.join();
+		if (passed != 1) {
+			expect(false, "concurrent: one of two orders at the limit passes");
+			return;
+		}
+	}
+}
+
+} // namespace
+
+int main() {
+	order_volume();
+	position();
+	price_band();
+	self_cross();
+	rate();
+	concurrent();
+	if (failures > 0) {
+		std::cerr << failures << " check(s) failed" << std::endl;
+		return 1;
+	}
+	std::cout << "risk_test: OK" << std::endl;
+	return 0;
+}